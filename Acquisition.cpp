@@ -0,0 +1,276 @@
+#include "Acquisition.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// one poll reads no more than half a second of samples,
+// so a slow poll never makes the device queue grow unbounded
+const float ScratchSeconds = 0.5f;
+const size_t EventRingSize = 1024;
+const size_t EventScratchSize = 100;
+}
+
+AcquisitionWorker::AcquisitionWorker(int id, size_t sampleSize, float rate, const Settings& settings, DeviceMetrics* metrics) :
+	deviceId(id), rowSize(sampleSize), dataRate(rate), sets(settings), metrics(metrics),
+	dataRing(size_t(std::max(1.f, rate * settings.RingSeconds)) * sampleSize),
+	eventRing(EventRingSize),
+	scratch(size_t(std::max(1.f, rate * ScratchSeconds)) * sampleSize),
+	eventScratch(EventScratchSize),
+	counterOffset(0), lastCounter(0), counted(false), rebasePending(false), clockSync(rate, settings.Clock),
+	running(false), lastError(0), failedFunction(""), overflows(0), eventOverflows(0), pollCount(0), sampleCount(0),
+	reconnectCount(0), gaps(0), lastReconnectNanoseconds(0), firstSampleTime(0) {
+	if (metrics) {
+		metrics->RingCapacity = dataRing.capacity() / sampleSize;
+	}
+}
+
+AcquisitionWorker::~AcquisitionWorker() {
+	stop();
+}
+
+void AcquisitionWorker::start() {
+	if (running.exchange(true)) {
+		return;
+	}
+	lastError = 0;
+	thread = std::thread(&AcquisitionWorker::run, this);
+}
+
+void AcquisitionWorker::stop() {
+	running = false;
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+ClockSync::Fit AcquisitionWorker::clock() const {
+	std::lock_guard<std::mutex> lock(clockMutex);
+	return clockFit;
+}
+
+Nb2Status AcquisitionWorker::status() const {
+	const int code = lastError.load();
+	return Nb2Status(code, code < 0 ? failedFunction.load() : "");
+}
+
+// the interval is chosen so that the next poll gets about TargetLatency of samples;
+// a poll that filled most of the scratch buffer means the device queue has more data
+// and is repeated at once, an empty poll backs off up to MaxInterval
+std::chrono::microseconds AcquisitionWorker::nextInterval(size_t words, std::chrono::microseconds interval) const {
+	const std::chrono::microseconds minInterval = sets.MinInterval;
+	const std::chrono::microseconds maxInterval = sets.MaxInterval;
+	if (words * 2 > scratch.size()) {
+		return std::chrono::microseconds(0);
+	}
+	if (words == 0) {
+		return std::min(maxInterval, std::max(minInterval, interval * 3 / 2));
+	}
+	const std::chrono::microseconds target = sets.TargetLatency;
+	const double samples = double(words / rowSize);
+	const double expected = dataRate * std::chrono::duration<double>(interval).count();
+	// shorten the interval when samples come faster than the nominal rate (catch-up after a BLE delay)
+	const std::chrono::microseconds adjusted(samples > expected * 1.5 ?
+		target.count() / 2 : target.count());
+	return std::min(maxInterval, std::max(minInterval, adjusted));
+}
+
+void AcquisitionWorker::record(const std::chrono::steady_clock::time_point& pollStart, size_t words,
+	const t_nb2Event* events, size_t eventCount) {
+	metrics->PollNanoseconds.record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - pollStart).count()));
+	metrics->PollBytes.record(words * sizeof(int32_t));
+	metrics->RingSamples.record(dataRing.size() / rowSize);
+	metrics->Polls.fetch_add(1, std::memory_order_relaxed);
+	metrics->Samples.fetch_add(words / rowSize, std::memory_order_relaxed);
+	metrics->OverflowSamples.store(overflows.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	metrics->OverflowEvents.store(eventOverflows.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	for (size_t i = 0; i < eventCount; ++i) {
+		const size_t type = std::min<size_t>(events[i].Type, DeviceMetrics::EventTypesCount - 1);
+		metrics->Events[type].fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+// reopen attempts until one succeeds, with backoff, false without a reopen function or if the
+// worker is stopped meanwhile
+bool AcquisitionWorker::reconnect() {
+	if (!reopenDevice) {
+		return false;
+	}
+	if (!rebasePending) {
+		dropFound = std::chrono::steady_clock::now();
+	}
+	std::chrono::milliseconds wait = sets.ReconnectInterval;
+	while (running.load(std::memory_order_relaxed)) {
+		const int id = reopenDevice();
+		if (id >= 0) {
+			deviceId = id;
+			rebasePending = true;
+			heldEvents.clear(); // of a connection which never sent samples
+			return true;
+		}
+		std::this_thread::sleep_for(wait);
+		wait = std::min(sets.ReconnectMaxInterval, wait * 2);
+	}
+	return false;
+}
+
+// the first rows of a new connection: a device which kept counting continues from its own
+// counter if the step is plausible for the time it was away, a restarted one (the counter is
+// reset by nb2Start) continues from the last counter plus the samples of that time
+void AcquisitionWorker::rebase(const std::chrono::steady_clock::time_point& pollStart, size_t words) {
+	uint64_t gap = 0;
+	if (counted) {
+		const size_t rows = words / rowSize;
+		const uint32_t first = uint32_t(scratch[rowSize - 1]);
+		const double away = std::chrono::duration<double>(pollStart - lastData).count() - double(rows - 1) / dataRate;
+		const uint32_t step = uint32_t(std::max(1., std::round(away * dataRate)));
+		const uint32_t deviceStep = first + counterOffset - lastCounter;
+		if (deviceStep >= 1 && deviceStep <= 2 * step + uint32_t(dataRate)) {
+			gap = deviceStep - 1;
+		}
+		else {
+			counterOffset = lastCounter + step - first;
+			gap = step - 1;
+			clockSync.reset(); // the rebased counters are as exact as the poll times
+		}
+	}
+	const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - dropFound);
+	gaps.fetch_add(gap, std::memory_order_relaxed);
+	lastReconnectNanoseconds = duration.count();
+	reconnectCount.fetch_add(1, std::memory_order_relaxed); // the values above are ready
+	if (metrics) {
+		metrics->Reconnects.fetch_add(1, std::memory_order_relaxed);
+		metrics->GapSamples.fetch_add(gap, std::memory_order_relaxed);
+		metrics->LastReconnectNanoseconds.store(uint64_t(duration.count()), std::memory_order_relaxed);
+		metrics->ReconnectNanoseconds.fetch_add(uint64_t(duration.count()), std::memory_order_relaxed);
+	}
+	rebasePending = false;
+	for (t_nb2Event& event : heldEvents) {
+		event.Counter += counterOffset;
+	}
+	writeEvents(heldEvents.data(), heldEvents.size());
+	heldEvents.clear();
+}
+
+void AcquisitionWorker::writeEvents(const t_nb2Event* events, size_t count) {
+	const size_t written = eventRing.write(events, count);
+	if (written < count) {
+		eventOverflows.fetch_add(count - written, std::memory_order_relaxed);
+	}
+}
+
+// failures of the status functions do not stop the acquisition, the last values stay
+void AcquisitionWorker::updateStatus() {
+	t_nb2DataStatus status;
+	if (nb2GetDataStatus(deviceId.load(std::memory_order_relaxed), &status) == ErrOk) {
+		metrics->setDataStatus(status);
+	}
+	t_nb2UsageStats usage;
+	if (nb2GetUsageStats(deviceId.load(std::memory_order_relaxed), &usage) == ErrOk) {
+		metrics->setErrorsStats(usage.ErrorsStats);
+	}
+}
+
+void AcquisitionWorker::run() {
+	std::chrono::microseconds interval = sets.MinInterval;
+	auto nextPoll = std::chrono::steady_clock::now();
+	auto nextStatus = nextPoll;
+	auto alive = nextPoll; // last samples or reconnect
+	while (running.load(std::memory_order_relaxed)) {
+		std::this_thread::sleep_until(nextPoll);
+		const auto pollStart = std::chrono::steady_clock::now();
+		const int id = deviceId.load(std::memory_order_relaxed);
+
+		// EEG samples, buffer size in bytes, returns count of 32-bit words
+		const int words = nb2GetData(id, scratch.data(), uint32_t(scratch.size() * sizeof(int32_t)));
+		const auto returned = std::chrono::steady_clock::now();
+		const bool stalled = words == 0 && reopenDevice && pollStart - alive > sets.StallTimeout;
+		if (words < 0 || stalled) {
+			if (reconnect()) {
+				alive = std::chrono::steady_clock::now();
+				interval = sets.MinInterval;
+				nextPoll = alive;
+				continue;
+			}
+			if (!running.load(std::memory_order_relaxed)) {
+				break; // stopped while reconnecting, not an error
+			}
+		}
+		if (words < 0 || stalled || size_t(words) % rowSize != 0) {
+			failedFunction = "nb2GetData";
+			lastError = words < 0 ? words : int(ErrFail);
+			break;
+		}
+		if (words > 0) {
+			if (rebasePending) {
+				rebase(pollStart, size_t(words));
+			}
+			if (counterOffset != 0) {
+				for (size_t i = rowSize - 1; i < size_t(words); i += rowSize) {
+					scratch[i] = int32_t(uint32_t(scratch[i]) + counterOffset);
+				}
+			}
+			lastCounter = uint32_t(scratch[size_t(words) - 1]);
+			counted = true;
+			lastData = pollStart;
+			alive = pollStart;
+			if (firstSampleTime.load(std::memory_order_relaxed) == 0) {
+				firstSampleTime = pollStart.time_since_epoch().count();
+			}
+			if (clockSync.add(lastCounter, returned)) {
+				std::lock_guard<std::mutex> lock(clockMutex);
+				clockFit = clockSync.fit();
+				if (metrics) {
+					metrics->ClockErrorNanoseconds.store(uint64_t(clockFit.Error * 1e9), std::memory_order_relaxed);
+					metrics->ClockDriftPpm.store(clockFit.driftPpm(dataRate), std::memory_order_relaxed);
+				}
+			}
+		}
+		const size_t written = dataRing.write(scratch.data(), size_t(words));
+		sampleCount.fetch_add(written / rowSize, std::memory_order_relaxed);
+		if (written < size_t(words)) {
+			overflows.fetch_add((size_t(words) - written) / rowSize, std::memory_order_relaxed);
+		}
+
+		// events, buffer size and return value in bytes
+		const int bytes = nb2GetEvent(id, eventScratch.data(), uint32_t(eventScratch.size() * sizeof(t_nb2Event)));
+		if (bytes < 0) {
+			if (reconnect()) {
+				alive = std::chrono::steady_clock::now();
+				interval = sets.MinInterval;
+				nextPoll = alive;
+				continue;
+			}
+			if (!running.load(std::memory_order_relaxed)) {
+				break;
+			}
+			failedFunction = "nb2GetEvent";
+			lastError = bytes;
+			break;
+		}
+		const size_t eventCount = size_t(bytes) / sizeof(t_nb2Event);
+		if (rebasePending) {
+			heldEvents.insert(heldEvents.end(), eventScratch.begin(), eventScratch.begin() + eventCount);
+		}
+		else {
+			if (counterOffset != 0) {
+				for (size_t i = 0; i < eventCount; ++i) {
+					eventScratch[i].Counter += counterOffset;
+				}
+			}
+			writeEvents(eventScratch.data(), eventCount);
+		}
+		pollCount.fetch_add(1, std::memory_order_relaxed);
+		if (metrics) {
+			record(pollStart, size_t(words), eventScratch.data(), eventCount);
+			if (pollStart >= nextStatus) {
+				updateStatus();
+				nextStatus = pollStart + sets.StatusInterval;
+			}
+		}
+
+		interval = nextInterval(size_t(words), interval);
+		nextPoll = pollStart + interval;
+	}
+	running = false;
+}
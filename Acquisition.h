@@ -0,0 +1,128 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include "ClockSync.h"
+#include "Metrics.h"
+#include "Nb2Device.h"
+#include "SpscRing.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// acquisition thread: polls nb2GetData/nb2GetEvent of one opened and started device
+// on a short adaptive interval and pushes sample rows and events into lock-free
+// rings, analysis code reads them from another thread; with DeviceMetrics it also records
+// poll duration and size, ring occupancy and events, and copies the device data status
+// and error statistics every StatusInterval.
+// With a reopen function a link drop (an nb2GetData or nb2GetEvent error, or no data for
+// StallTimeout) does not stop the acquisition: the device is reopened with backoff from
+// ReconnectInterval to ReconnectMaxInterval until it is back, and the sample counters of the
+// new connection are rebased to continue the old ones, the samples missed while the device was
+// away estimated by the host clock are counted as a gap; events of the new connection are held
+// until its first samples give the rebase.
+// The return of every nb2GetData call with samples is a point of ClockSync, its fit maps the
+// counters of samples and events to the host steady clock; it starts over after a rebase
+class AcquisitionWorker {
+public:
+	struct Settings {
+		Settings() : RingSeconds(10.f), TargetLatency(10), MinInterval(1), MaxInterval(40), StatusInterval(5000),
+			StallTimeout(2000), ReconnectInterval(50), ReconnectMaxInterval(1000) {}
+		float RingSeconds; // data ring length, seconds of samples
+		std::chrono::milliseconds TargetLatency; // desired age of the oldest sample in a poll
+		std::chrono::milliseconds MinInterval; // poll interval limits
+		std::chrono::milliseconds MaxInterval;
+		std::chrono::milliseconds StatusInterval; // nb2GetDataStatus and nb2GetUsageStats for metrics
+		std::chrono::milliseconds StallTimeout; // no data for so long is a link drop
+		std::chrono::milliseconds ReconnectInterval; // reopen attempt interval limits
+		std::chrono::milliseconds ReconnectMaxInterval;
+		ClockSync::Settings Clock;
+	};
+	// one attempt to reopen and start the device, returns its new id or an nb2 error code;
+	// called from the acquisition thread
+	typedef std::function<int()> Reopen;
+
+	AcquisitionWorker(int id, size_t sampleSize, float rate, const Settings& settings = Settings(),
+		DeviceMetrics* metrics = nullptr);
+	~AcquisitionWorker();
+	AcquisitionWorker(const AcquisitionWorker&) = delete;
+	AcquisitionWorker& operator=(const AcquisitionWorker&) = delete;
+
+	// before start
+	void setReopen(Reopen reopen) { reopenDevice = std::move(reopen); }
+	void start();
+	void stop();
+
+	int id() const { return deviceId.load(); }
+	size_t sampleSize() const { return rowSize; }
+	// sample rows, (ChannelsCount + 2) words each, counter is the last word
+	SpscRing<int32_t>& data() { return dataRing; }
+	SpscRing<t_nb2Event>& events() { return eventRing; }
+
+	// nb2 error code which stopped the acquisition, 0 while running
+	int error() const { return lastError.load(); }
+	// the error and the nb2 function which returned it
+	Nb2Status status() const;
+	// samples dropped because the consumer did not keep up with the ring
+	uint64_t overflowSamples() const { return overflows.load(); }
+	// events dropped because the consumer did not keep up with the event ring
+	uint64_t overflowEvents() const { return eventOverflows.load(); }
+	uint64_t polls() const { return pollCount.load(); }
+	uint64_t samples() const { return sampleCount.load(); }
+	// reconnects which brought samples again
+	uint64_t reconnects() const { return reconnectCount.load(); }
+	// samples missed while the device was reconnected
+	uint64_t gapSamples() const { return gaps.load(); }
+	// from the link drop found to the first samples of the new connection
+	std::chrono::nanoseconds lastReconnect() const { return std::chrono::nanoseconds(lastReconnectNanoseconds.load()); }
+	// when the first samples came, a zero time point before
+	std::chrono::steady_clock::time_point firstSample() const {
+		return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(firstSampleTime.load()));
+	}
+	// host time of the counters as of the last segment, not valid before the first samples
+	ClockSync::Fit clock() const;
+
+private:
+	void run();
+	void record(const std::chrono::steady_clock::time_point& pollStart, size_t words, const t_nb2Event* events, size_t eventCount);
+	void updateStatus();
+	std::chrono::microseconds nextInterval(size_t words, std::chrono::microseconds interval) const;
+	void writeEvents(const t_nb2Event* events, size_t count);
+	bool reconnect();
+	void rebase(const std::chrono::steady_clock::time_point& pollStart, size_t words);
+
+	std::atomic<int> deviceId;
+	const size_t rowSize;
+	const float dataRate;
+	const Settings sets;
+	DeviceMetrics* const metrics;
+	SpscRing<int32_t> dataRing;
+	SpscRing<t_nb2Event> eventRing;
+	std::vector<int32_t> scratch;
+	std::vector<t_nb2Event> eventScratch;
+	std::vector<t_nb2Event> heldEvents; // of a new connection before its first samples
+	Reopen reopenDevice;
+	// counter continuity over reconnects, of the acquisition thread
+	uint32_t counterOffset; // added to the counters of the device
+	uint32_t lastCounter;   // of the last row, rebased
+	bool counted;           // lastCounter is set
+	bool rebasePending;     // reconnected, no samples yet
+	std::chrono::steady_clock::time_point lastData; // poll which returned the last row
+	std::chrono::steady_clock::time_point dropFound;
+	ClockSync clockSync;
+	mutable std::mutex clockMutex;
+	ClockSync::Fit clockFit; // of clockSync, for other threads
+	std::atomic<bool> running;
+	std::atomic<int> lastError;
+	std::atomic<const char*> failedFunction; // set before lastError
+	std::atomic<uint64_t> overflows;
+	std::atomic<uint64_t> eventOverflows;
+	std::atomic<uint64_t> pollCount;
+	std::atomic<uint64_t> sampleCount;
+	std::atomic<uint64_t> reconnectCount;
+	std::atomic<uint64_t> gaps;
+	std::atomic<int64_t> lastReconnectNanoseconds;
+	std::atomic<std::chrono::steady_clock::rep> firstSampleTime;
+	std::thread thread;
+};
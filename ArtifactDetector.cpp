@@ -0,0 +1,218 @@
+#include "ArtifactDetector.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define ARTIFACT_WIDTH 8
+#elif defined(__SSE4_1__) || defined(__AVX__)
+	#include <smmintrin.h>
+	#define ARTIFACT_WIDTH 4
+#else
+	#define ARTIFACT_WIDTH 1
+#endif
+
+namespace {
+// rows are processed in tiles small enough to stay in L1 cache, as in SignalStats
+const size_t TileRows = 64;
+
+int32_t bits(float microvolts, float resolution) {
+	return int32_t(std::min(2e9, std::floor(double(microvolts) * 1e-6 / double(resolution))));
+}
+
+uint32_t counterOf(const int32_t* row, size_t sampleSize) {
+	return uint32_t(row[sampleSize - 1]);
+}
+} // namespace
+
+ArtifactDetector::ArtifactDetector(size_t channelsCount, const t_nb2Property& property, const Settings& settings) :
+	channelsCount(channelsCount),
+	paddedCount((channelsCount + ARTIFACT_WIDTH - 1) / ARTIFACT_WIDTH * ARTIFACT_WIDTH),
+	windowLength(std::max<size_t>(1, size_t(std::lround(settings.WindowSeconds * property.Rate)))),
+	clipLimit(std::max(1, bits(settings.ClipFraction * property.Range * 1e6f, property.Resolution))),
+	flatLimit(bits(settings.FlatMicrovolts, property.Resolution)),
+	jumpLimit(bits(settings.JumpMicrovolts, property.Resolution)),
+	burstLimit(bits(settings.BurstMicrovolts, property.Resolution)),
+	minimum(paddedCount), maximum(paddedCount), previous(paddedCount), jump(paddedCount), clipped(paddedCount),
+	history(std::max<size_t>(1, size_t(settings.HistorySeconds * property.Rate) / windowLength)) {
+	if (channelsCount > MaxChannels) {
+		throw std::runtime_error("Artifact detector supports up to 32 channels");
+	}
+	reset();
+}
+
+void ArtifactDetector::reset() {
+	started = false;
+	filled = 0;
+	firstCounter = lastCounter = 0;
+	std::fill(minimum.begin(), minimum.end(), std::numeric_limits<int32_t>::max());
+	std::fill(maximum.begin(), maximum.end(), std::numeric_limits<int32_t>::min());
+	std::fill(previous.begin(), previous.end(), 0);
+	std::fill(jump.begin(), jump.end(), 0);
+	std::fill(clipped.begin(), clipped.end(), 0);
+	historyNext = 0;
+	windowCount = 0;
+	flaggedCount = 0;
+}
+
+size_t ArtifactDetector::push(const int32_t* data, size_t sampleCount, size_t sampleSize, const Emit& emit) {
+	if (sampleCount && !started) {
+		std::copy(data, data + channelsCount, previous.begin());
+		started = true;
+	}
+	size_t finished = 0;
+	while (sampleCount) {
+		const size_t count = std::min(sampleCount, windowLength - filled);
+		if (filled == 0) {
+			firstCounter = counterOf(data, sampleSize);
+		}
+		accumulate(data, count, sampleSize);
+		lastCounter = counterOf(data + (count - 1) * sampleSize, sampleSize);
+		filled += count;
+		data += count * sampleSize;
+		sampleCount -= count;
+		if (filled == windowLength) {
+			finish(emit);
+			++finished;
+		}
+	}
+	return finished;
+}
+
+void ArtifactDetector::accumulate(const int32_t* data, size_t count, size_t sampleSize) {
+	for (size_t tile = 0; tile < count; tile += TileRows) {
+		const int32_t* rows = data + tile * sampleSize;
+		const size_t tileCount = std::min(TileRows, count - tile);
+		size_t channel = 0;
+
+#if ARTIFACT_WIDTH == 8
+		const __m256i limit = _mm256_set1_epi32(clipLimit - 1);
+		for (; channel < channelsCount; channel += 8) {
+			// the last group is loaded with a mask, so it never reads past the row
+			const int lanes = int(std::min<size_t>(8, channelsCount - channel));
+			const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+			__m256i mn = _mm256_loadu_si256((const __m256i*)&minimum[channel]);
+			__m256i mx = _mm256_loadu_si256((const __m256i*)&maximum[channel]);
+			__m256i prev = _mm256_loadu_si256((const __m256i*)&previous[channel]);
+			__m256i step = _mm256_loadu_si256((const __m256i*)&jump[channel]);
+			__m256i clip = _mm256_loadu_si256((const __m256i*)&clipped[channel]);
+			for (size_t i = 0; i < tileCount; ++i) {
+				const int32_t* row = rows + i * sampleSize + channel;
+				const __m256i v = lanes == 8 ? _mm256_loadu_si256((const __m256i*)row) : _mm256_maskload_epi32(row, mask);
+				mn = _mm256_min_epi32(mn, v);
+				mx = _mm256_max_epi32(mx, v);
+				step = _mm256_max_epi32(step, _mm256_abs_epi32(_mm256_sub_epi32(v, prev)));
+				prev = v;
+				clip = _mm256_sub_epi32(clip, _mm256_cmpgt_epi32(_mm256_abs_epi32(v), limit)); // -1 is true
+			}
+			_mm256_storeu_si256((__m256i*)&minimum[channel], mn);
+			_mm256_storeu_si256((__m256i*)&maximum[channel], mx);
+			_mm256_storeu_si256((__m256i*)&previous[channel], prev);
+			_mm256_storeu_si256((__m256i*)&jump[channel], step);
+			_mm256_storeu_si256((__m256i*)&clipped[channel], clip);
+		}
+#elif ARTIFACT_WIDTH == 4
+		const __m128i limit = _mm_set1_epi32(clipLimit - 1);
+		for (; channel + 4 <= channelsCount; channel += 4) {
+			__m128i mn = _mm_loadu_si128((const __m128i*)&minimum[channel]);
+			__m128i mx = _mm_loadu_si128((const __m128i*)&maximum[channel]);
+			__m128i prev = _mm_loadu_si128((const __m128i*)&previous[channel]);
+			__m128i step = _mm_loadu_si128((const __m128i*)&jump[channel]);
+			__m128i clip = _mm_loadu_si128((const __m128i*)&clipped[channel]);
+			for (size_t i = 0; i < tileCount; ++i) {
+				const __m128i v = _mm_loadu_si128((const __m128i*)(rows + i * sampleSize + channel));
+				mn = _mm_min_epi32(mn, v);
+				mx = _mm_max_epi32(mx, v);
+				step = _mm_max_epi32(step, _mm_abs_epi32(_mm_sub_epi32(v, prev)));
+				prev = v;
+				clip = _mm_sub_epi32(clip, _mm_cmpgt_epi32(_mm_abs_epi32(v), limit));
+			}
+			_mm_storeu_si128((__m128i*)&minimum[channel], mn);
+			_mm_storeu_si128((__m128i*)&maximum[channel], mx);
+			_mm_storeu_si128((__m128i*)&previous[channel], prev);
+			_mm_storeu_si128((__m128i*)&jump[channel], step);
+			_mm_storeu_si128((__m128i*)&clipped[channel], clip);
+		}
+#endif
+		// scalar code for the remaining channels
+		for (size_t i = 0; i < tileCount && channel < channelsCount; ++i) {
+			const int32_t* row = rows + i * sampleSize;
+			for (size_t ch = channel; ch < channelsCount; ++ch) {
+				const int32_t value = row[ch];
+				minimum[ch] = std::min(minimum[ch], value);
+				maximum[ch] = std::max(maximum[ch], value);
+				// in 64 bits, the step of two int32 values and |INT32_MIN| overflow int32
+				const int64_t step = std::min<int64_t>(std::abs(int64_t(value) - previous[ch]), std::numeric_limits<int32_t>::max());
+				jump[ch] = std::max(jump[ch], int32_t(step));
+				previous[ch] = value;
+				clipped[ch] += std::abs(int64_t(value)) >= clipLimit ? 1 : 0;
+			}
+		}
+	}
+}
+
+// flatline and disconnect need the whole window
+ArtifactDetector::Window ArtifactDetector::current(bool finished) const {
+	Window window = Window();
+	window.FirstCounter = firstCounter;
+	window.LastCounter = lastCounter;
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		const uint32_t bit = 1u << ch;
+		const int64_t peakToPeak = int64_t(maximum[ch]) - minimum[ch];
+		if (finished && size_t(clipped[ch]) == filled) {
+			window.Disconnect |= bit;
+			continue;
+		}
+		if (clipped[ch] > 0) window.Clipping |= bit;
+		if (jump[ch] > jumpLimit) window.Jump |= bit;
+		if (peakToPeak > burstLimit) window.Burst |= bit;
+		if (finished && peakToPeak <= flatLimit) window.Flatline |= bit;
+	}
+	return window;
+}
+
+void ArtifactDetector::finish(const Emit& emit) {
+	const Window window = current(true);
+	history[historyNext] = window;
+	historyNext = (historyNext + 1) % history.size();
+	++windowCount;
+	if (window.bad()) {
+		++flaggedCount;
+	}
+	filled = 0;
+	std::fill(minimum.begin(), minimum.end(), std::numeric_limits<int32_t>::max());
+	std::fill(maximum.begin(), maximum.end(), std::numeric_limits<int32_t>::min());
+	std::fill(jump.begin(), jump.end(), 0);
+	std::fill(clipped.begin(), clipped.end(), 0);
+	if (emit) {
+		emit(*this, window);
+	}
+}
+
+// counter ranges are compared modulo 2^32
+uint32_t ArtifactDetector::flags(uint32_t first, size_t sampleCount) const {
+	if (sampleCount == 0) {
+		return 0;
+	}
+	const uint32_t last = first + uint32_t(sampleCount - 1);
+	const auto overlaps = [first, last](const Window& w) {
+		return int32_t(last - w.FirstCounter) >= 0 && int32_t(w.LastCounter - first) >= 0;
+	};
+	uint32_t result = 0;
+	const size_t kept = size_t(std::min<uint64_t>(windowCount, history.size())); // slots are filled from 0
+	for (size_t i = 0; i < kept; ++i) {
+		if (overlaps(history[i])) {
+			result |= history[i].bad();
+		}
+	}
+	if (filled) {
+		const Window partial = current(false);
+		if (overlaps(partial)) {
+			result |= partial.bad();
+		}
+	}
+	return result;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// streaming artifact detection on sample rows in ADC bits: rows are cut into windows of
+// WindowSeconds and every window keeps min, max, the largest step between neighbouring
+// samples and the number of samples near the ADC limit of every channel, accumulated in one
+// pass over the rows (AVX2, SSE4.1 or scalar code); a finished window becomes channel bitmasks,
+// bit ch for channel ch, which are kept for HistorySeconds, so later stages ask for the flags
+// of any counter range instead of scanning the samples again. Thresholds are in microvolts
+// of the uncalibrated resolution, the calibration gain error does not matter for them.
+// The SIMD steps are exact for samples within +-2^30, the 24-bit ADC words always are;
+// the scalar code takes any int32 value
+class ArtifactDetector {
+public:
+	enum { MaxChannels = 32 };
+
+	struct Settings {
+		Settings() : WindowSeconds(0.25f), ClipFraction(0.98f), FlatMicrovolts(0.5f), JumpMicrovolts(250.f),
+			BurstMicrovolts(500.f), HistorySeconds(10.f) {}
+		float WindowSeconds;
+		float ClipFraction;    // of the input range, |sample| from it on is near the ADC limit
+		float FlatMicrovolts;  // peak-to-peak of a window up to it is a flatline
+		float JumpMicrovolts;  // step between two samples above it is a jump
+		float BurstMicrovolts; // peak-to-peak of a window above it is a high-amplitude burst
+		float HistorySeconds;  // windows kept for flags()
+	};
+
+	// channel bitmasks of one window
+	struct Window {
+		uint32_t FirstCounter; // counters of the first and the last row of the window
+		uint32_t LastCounter;
+		uint32_t Clipping;   // some samples near the ADC limit
+		uint32_t Disconnect; // all samples near the ADC limit, electrode is off
+		uint32_t Flatline;
+		uint32_t Jump;
+		uint32_t Burst;
+		uint32_t bad() const { return Clipping | Disconnect | Flatline | Jump | Burst; }
+	};
+
+	typedef std::function<void(const ArtifactDetector&, const Window&)> Emit;
+
+	// rate, input range and resolution from nb2GetProperty
+	ArtifactDetector(size_t channelsCount, const t_nb2Property& property, const Settings& settings = Settings());
+
+	// sampleCount rows of sampleSize words (counter last), the first channelsCount words of a row
+	// are used; emit is called after every finished window, returns the number of them
+	size_t push(const int32_t* data, size_t sampleCount, size_t sampleSize, const Emit& emit = nullptr);
+	void reset();
+
+	size_t channels() const { return channelsCount; }
+	size_t windowSize() const { return windowLength; }
+	// channels flagged in the windows with samples from firstCounter to firstCounter + sampleCount - 1,
+	// the unfinished window included with its clipping, jumps and bursts so far
+	uint32_t flags(uint32_t firstCounter, size_t sampleCount) const;
+	uint64_t windows() const { return windowCount; }
+	// windows with any flag
+	uint64_t flaggedWindows() const { return flaggedCount; }
+
+private:
+	void accumulate(const int32_t* data, size_t count, size_t sampleSize);
+	Window current(bool finished) const;
+	void finish(const Emit& emit);
+
+	const size_t channelsCount;
+	const size_t paddedCount; // multiple of SIMD width, padding lanes are ignored
+	const size_t windowLength;
+	const int32_t clipLimit;
+	const int32_t flatLimit;
+	const int32_t jumpLimit;
+	const int32_t burstLimit;
+	// state of the current window
+	size_t filled;
+	uint32_t firstCounter;
+	uint32_t lastCounter;
+	std::vector<int32_t> minimum;
+	std::vector<int32_t> maximum;
+	std::vector<int32_t> previous; // the last sample, steps continue across windows
+	std::vector<int32_t> jump;     // largest step
+	std::vector<int32_t> clipped;  // samples near the limit
+	bool started;
+	// finished windows, oldest overwritten first
+	std::vector<Window> history;
+	size_t historyNext;
+	uint64_t windowCount;
+	uint64_t flaggedCount;
+};
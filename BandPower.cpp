@@ -0,0 +1,184 @@
+#include "BandPower.h"
+#include <cmath>
+
+namespace {
+
+const double Pi = 3.14159265358979323846;
+
+// FFT of one segment length: a real sequence of N samples is transformed as N/2 complex values
+struct Tables {
+	explicit Tables(size_t rate) : N(1) {
+		while (N < rate) N *= 2; // about 1 second
+		const size_t M = N / 2;
+		window.resize(N);
+		double squares = 0.;
+		for (size_t n = 0; n < N; ++n) {
+			const double w = 0.5 - 0.5 * std::cos(2. * Pi * double(n) / double(N));
+			window[n] = float(w);
+			squares += w * w;
+		}
+		// one-sided power of a bin in uV^2, the sum over bins gives the signal power
+		scale = float(2. / (double(N) * squares));
+		reversed.resize(M);
+		unsigned bits = 0;
+		while ((size_t(1) << bits) < M) ++bits;
+		for (size_t i = 0; i < M; ++i) {
+			size_t r = 0;
+			for (unsigned b = 0; b < bits; ++b) r |= ((i >> b) & 1) << (bits - 1 - b);
+			reversed[i] = uint32_t(r);
+		}
+		for (size_t k = 0; k < M; ++k) {
+			cosN.push_back(float(std::cos(2. * Pi * double(k) / double(N))));
+			sinN.push_back(float(-std::sin(2. * Pi * double(k) / double(N))));
+		}
+	}
+
+	size_t N;
+	float scale;
+	std::vector<float> window;
+	std::vector<uint32_t> reversed;
+	std::vector<float> cosN, sinN; // e^(-2 pi i k / N), k < N/2; every other one is the N/2 point twiddle
+};
+
+const Tables& tables(Nb2Rate rate) {
+	static const Tables all[] = { Tables(125), Tables(250), Tables(500), Tables(1000) };
+	return all[rate];
+}
+
+// in-place radix-2 decimation in time of M = N/2 complex values
+void fft(const Tables& t, float* re, float* im) {
+	const size_t M = t.N / 2;
+	for (size_t i = 0; i < M; ++i) {
+		const size_t j = t.reversed[i];
+		if (i < j) {
+			std::swap(re[i], re[j]);
+			std::swap(im[i], im[j]);
+		}
+	}
+	for (size_t half = 1, stride = M; half < M; half *= 2) {
+		stride /= 2; // twiddle step in the N point table is 2 * stride
+		for (size_t start = 0; start < M; start += 2 * half) {
+			for (size_t k = 0; k < half; ++k) {
+				const float wr = t.cosN[2 * k * stride], wi = t.sinN[2 * k * stride];
+				const size_t a = start + k, b = a + half;
+				const float tr = re[b] * wr - im[b] * wi;
+				const float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+} // namespace
+
+BandPower::BandPower(size_t channelsCount, Nb2Rate rate, const Settings& settings) :
+	channelsCount(channelsCount),
+	segmentLength(tables(rate).N),
+	hopLength(std::max<size_t>(1, size_t(std::lround(settings.HopSeconds * 125.f * float(1 << rate))))),
+	windowSegments(std::max<long>(1, std::lround((settings.WindowSeconds - float(segmentLength) / (125.f * float(1 << rate))) / settings.HopSeconds) + 1)),
+	dataRate(rate),
+	history(channelsCount * segmentLength),
+	segmentPowers(windowSegments * channelsCount * BandsCount),
+	sums(channelsCount * BandsCount),
+	re(segmentLength / 2), im(segmentLength / 2), segment(segmentLength) {
+	const double binHz = 125. * double(1 << rate) / double(segmentLength);
+	for (size_t b = 0; b <= BandsCount; ++b) {
+		bins[b] = std::min(segmentLength / 2 + 1, size_t(std::ceil(double(settings.Edges[b]) / binHz)));
+	}
+	reset();
+}
+
+void BandPower::reset() {
+	position = 0;
+	filled = 0;
+	hopFill = 0;
+	segmentCount = 0;
+	std::fill(sums.begin(), sums.end(), 0.);
+}
+
+double BandPower::power(size_t channel, Band band) const {
+	return segmentCount ? sums[channel * BandsCount + band] / double(segments()) : 0.;
+}
+
+// band powers of the last segmentLength samples of the channel
+void BandPower::transform(size_t channel, float* powers) {
+	const Tables& t = tables(dataRate);
+	const size_t M = segmentLength / 2;
+	const float* samples = &history[channel * segmentLength];
+	double mean = 0.;
+	for (size_t n = 0; n < segmentLength; ++n) {
+		segment[n] = samples[(position + n) & (segmentLength - 1)]; // oldest first
+		mean += segment[n];
+	}
+	mean /= double(segmentLength);
+	for (size_t n = 0; n < M; ++n) {
+		re[n] = (segment[2 * n] - float(mean)) * t.window[2 * n];
+		im[n] = (segment[2 * n + 1] - float(mean)) * t.window[2 * n + 1];
+	}
+	fft(t, re.data(), im.data());
+
+	// spectrum of the real sequence from the half length complex one, bins up to the last band only
+	for (size_t b = 0; b < BandsCount; ++b) {
+		double power = 0.;
+		for (size_t k = bins[b]; k < bins[b + 1]; ++k) {
+			const size_t m = k % M, mk = (M - k) % M;
+			const float er = 0.5f * (re[m] + re[mk]), ei = 0.5f * (im[m] - im[mk]);
+			const float or_ = 0.5f * (im[m] + im[mk]), oi = -0.5f * (re[m] - re[mk]);
+			const float wr = k < M ? t.cosN[k] : -1.f, wi = k < M ? t.sinN[k] : 0.f;
+			const float xr = er + or_ * wr - oi * wi;
+			const float xi = ei + or_ * wi + oi * wr;
+			power += double(xr * xr + xi * xi) * ((k == 0 || k == M) ? 0.5 : 1.);
+		}
+		powers[b] = float(power * t.scale);
+	}
+}
+
+size_t BandPower::push(const float* data, size_t sampleCount, size_t planeStride,
+	const std::function<void(const BandPower&)>& emit) {
+	size_t estimates = 0;
+	for (size_t i = 0; i < sampleCount;) {
+		// up to the end of the current hop
+		const size_t count = std::min(sampleCount - i, hopLength - hopFill);
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			float* samples = &history[ch * segmentLength];
+			const float* in = data + ch * planeStride + i;
+			for (size_t n = 0, p = position; n < count; ++n, p = (p + 1) & (segmentLength - 1)) {
+				samples[p] = in[n];
+			}
+		}
+		position = (position + count) % segmentLength;
+		filled = std::min(segmentLength, filled + count);
+		hopFill += count;
+		i += count;
+		if (hopFill < hopLength) {
+			continue;
+		}
+		hopFill = 0;
+		if (filled < segmentLength) {
+			continue; // the first segment is not complete
+		}
+
+		// the new segment replaces the oldest one of the window
+		float* powers = &segmentPowers[(segmentCount % windowSegments) * channelsCount * BandsCount];
+		const bool full = segmentCount >= windowSegments;
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			float* channelPowers = powers + ch * BandsCount;
+			for (size_t b = 0; b < BandsCount && full; ++b) {
+				sums[ch * BandsCount + b] -= channelPowers[b];
+			}
+			transform(ch, channelPowers);
+			for (size_t b = 0; b < BandsCount; ++b) {
+				sums[ch * BandsCount + b] += channelPowers[b];
+			}
+		}
+		++segmentCount;
+		++estimates;
+		if (emit) {
+			emit(*this);
+		}
+	}
+	return estimates;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// streaming Welch estimate of delta, theta, alpha and beta power of all channels:
+// every hop one new segment of about 1 second (a power of two samples, Hann window,
+// mean removed) is transformed by a radix-2 real FFT and its band powers are added to
+// a running sum over the segments of the window, the oldest segment is subtracted,
+// so overlapping segments are never transformed twice; FFT twiddles, bit reversal
+// and windows are precomputed once for every Nb2Rate
+class BandPower {
+public:
+	enum Band { Delta, Theta, Alpha, Beta, BandsCount };
+
+	struct Settings {
+		Settings() : WindowSeconds(4.f), HopSeconds(0.25f), Edges{ 1.f, 4.f, 8.f, 13.f, 30.f } {}
+		float WindowSeconds; // averaging window
+		float HopSeconds;    // interval between estimates
+		float Edges[BandsCount + 1]; // band edges, Hz
+	};
+
+	BandPower(size_t channelsCount, Nb2Rate rate, const Settings& settings = Settings());
+
+	// sampleCount values of every channel, channel ch at data + ch * planeStride (microvolts);
+	// emit is called after every new estimate, returns the number of new estimates
+	size_t push(const float* data, size_t sampleCount, size_t planeStride,
+		const std::function<void(const BandPower&)>& emit = nullptr);
+	void reset();
+
+	size_t channels() const { return channelsCount; }
+	size_t segmentSize() const { return segmentLength; }
+	size_t hopSize() const { return hopLength; }
+	// segments in the current estimate, up to the window
+	size_t segments() const { return std::min(segmentCount, windowSegments); }
+	bool ready() const { return segmentCount > 0; }
+	// band power of the last estimate, uV^2
+	double power(size_t channel, Band band) const;
+
+private:
+	void transform(size_t channel, float* powers);
+
+	const size_t channelsCount;
+	const size_t segmentLength;
+	const size_t hopLength;
+	const size_t windowSegments;
+	const Nb2Rate dataRate;
+	size_t bins[BandsCount + 1]; // first FFT bin of every band and the end of the last one
+	std::vector<float> history; // [channel][segmentLength], circular
+	size_t position;            // next write index of the history
+	size_t filled;              // samples in the history, up to segmentLength
+	size_t hopFill;             // samples since the last segment
+	size_t segmentCount;        // segments since reset
+	std::vector<float> segmentPowers; // [windowSegments][channel][band], circular
+	std::vector<double> sums;         // [channel][band] over the window
+	std::vector<float> re, im, segment; // FFT scratch
+};
@@ -0,0 +1,298 @@
+#include "BatchProcessor.h"
+#include "ArtifactDetector.h"
+#include "MappedRecording.h"
+#include "Nb2Format.h"
+#include "SampleConverter.h"
+#include "SignalStats.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#define NOMINMAX // std::min and std::max
+	#include <windows.h>
+#else
+	#include <dirent.h>
+#endif
+
+namespace {
+// rows processed at a time, the buffers of a chunk do not depend on its length
+const size_t BlockRows = 1000;
+} // namespace
+
+// statistics of one chunk, merged in chunk order
+struct BatchProcessor::ChunkResult {
+	struct Channel {
+		uint64_t Count;
+		double Mean;    // ADC bits
+		double Squares; // sum of squared deviations from the mean
+		int32_t Min;
+		int32_t Max;
+		double Power[BandPower::BandsCount]; // sum of the estimates
+		uint64_t FlaggedWindows;
+	};
+	std::vector<Channel> Channels;
+	uint64_t Estimates;
+	uint64_t Windows;
+	uint64_t FlaggedWindows;
+	std::string Error;
+};
+
+struct BatchProcessor::FileJob {
+	std::string Path;
+	WorkStealingPool* Pool;
+	std::unique_ptr<RecordingReader> Reader;
+	uint64_t ChunkSamples;
+	std::vector<ChunkResult> Chunks;
+	std::atomic<size_t> Remaining;
+	FileSummary Summary;
+	bool Done;
+};
+
+BatchProcessor::BatchProcessor(const Settings& settings) : settings(settings), stolen(0) {
+}
+
+void BatchProcessor::run(const std::vector<std::string>& paths, const Emit& emit) {
+	WorkStealingPool pool(settings.ThreadsCount);
+	const size_t maxFiles = 2 * pool.size();
+	std::deque<std::shared_ptr<FileJob>> active;
+	size_t next = 0;
+	while (next < paths.size() || !active.empty()) {
+		while (next < paths.size() && active.size() < maxFiles) {
+			const std::shared_ptr<FileJob> job = std::make_shared<FileJob>();
+			job->Path = paths[next++];
+			job->Pool = &pool;
+			job->Done = false;
+			active.push_back(job);
+			pool.submit([this, job] { open(job); });
+		}
+		const std::shared_ptr<FileJob> job = active.front();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [&job] { return job->Done; });
+		}
+		active.pop_front();
+		emit(job->Summary);
+	}
+	stolen = pool.steals();
+}
+
+// a pool thread: the chunks of the file are queued to this thread, the others steal them
+void BatchProcessor::open(const std::shared_ptr<FileJob>& job) {
+	FileSummary& summary = job->Summary;
+	summary.Path = job->Path;
+	summary.Samples = 0;
+	summary.Chunks = 0;
+	summary.Rate = 0.f;
+	summary.Windows = summary.FlaggedWindows = 0;
+	size_t chunks = 0;
+	try {
+		job->Reader.reset(new RecordingReader(job->Path));
+		const RecordingReader& reader = *job->Reader;
+		summary.Rate = reader.header().Property.Rate;
+		const uint64_t window = std::max<long>(1, std::lround(ArtifactDetector::Settings().WindowSeconds * summary.Rate));
+		job->ChunkSamples = std::max<uint64_t>(1, uint64_t(std::lround(settings.ChunkSeconds * summary.Rate)) / window) * window;
+		chunks = size_t((reader.endSample() - reader.firstSample() + job->ChunkSamples - 1) / job->ChunkSamples);
+	}
+	catch (const std::exception& ex) {
+		summary.Error = ex.what();
+		job->Reader.reset();
+	}
+	job->Chunks.resize(chunks);
+	job->Remaining = chunks;
+	if (chunks == 0) {
+		merge(*job);
+		return;
+	}
+	for (size_t i = 0; i < chunks; ++i) {
+		job->Pool->submit([this, job, i] {
+			process(*job, i);
+			if (--job->Remaining == 0) {
+				merge(*job);
+			}
+		});
+	}
+}
+
+void BatchProcessor::process(FileJob& job, size_t index) {
+	ChunkResult& result = job.Chunks[index];
+	try {
+		const RecordingReader& reader = *job.Reader;
+		const t_nb2Property& property = reader.header().Property;
+		const size_t channels = reader.channels();
+		const size_t sampleSize = reader.sampleSize();
+		const Nb2Rate rate = dataRateArg(std::to_string(int(property.Rate)));
+		const uint64_t begin = reader.firstSample() + index * job.ChunkSamples;
+		const uint64_t end = std::min(begin + job.ChunkSamples, reader.endSample());
+		const uint64_t warmup = std::min<uint64_t>(begin - reader.firstSample(), uint64_t(settings.WarmupSeconds * property.Rate));
+
+		FilterBank filter(settings.Filter, channels, rate);
+		BandPower bands(channels, rate);
+		SignalStats stats(channels);
+		ArtifactDetector artifacts(channels, property);
+		const SampleConverter converter(channels, property.Resolution);
+		std::vector<int32_t> rows(BlockRows * sampleSize);
+		std::vector<float> planar(channels * BlockRows);
+		std::vector<double> power(channels * BandPower::BandsCount);
+		std::vector<uint64_t> flagged(channels);
+		result.Estimates = 0;
+		result.Windows = result.FlaggedWindows = 0;
+		bool counting = false;
+
+		const std::function<void(const BandPower&)> addPower = [&power, &result, &counting](const BandPower& estimate) {
+			if (!counting) {
+				return;
+			}
+			for (size_t ch = 0; ch < estimate.channels(); ++ch) {
+				for (size_t band = 0; band < BandPower::BandsCount; ++band) {
+					power[ch * BandPower::BandsCount + band] += estimate.power(ch, BandPower::Band(band));
+				}
+			}
+			++result.Estimates;
+		};
+		const ArtifactDetector::Emit addWindow = [&flagged, &result](const ArtifactDetector& detector, const ArtifactDetector::Window& window) {
+			const uint32_t bad = window.bad();
+			for (size_t ch = 0; ch < detector.channels(); ++ch) {
+				flagged[ch] += (bad >> ch) & 1;
+			}
+			++result.Windows;
+			result.FlaggedWindows += bad ? 1 : 0;
+		};
+
+		reader.visit(begin - warmup, end - begin + warmup, [&](const int32_t* data, size_t sampleCount, uint64_t first) {
+			for (size_t done = 0; done < sampleCount;) {
+				// a block is all warm-up or all counted
+				size_t count = std::min(BlockRows, sampleCount - done);
+				counting = first + done >= begin;
+				if (!counting) {
+					count = size_t(std::min<uint64_t>(count, begin - first - done));
+				}
+				std::copy(data + done * sampleSize, data + (done + count) * sampleSize, rows.begin());
+				if (counting) {
+					artifacts.push(rows.data(), count, sampleSize, addWindow); // on unfiltered samples
+				}
+				if (settings.Filter.enabled()) {
+					filter.process(rows.data(), count, sampleSize);
+				}
+				if (counting) {
+					stats.accumulate(rows.data(), count, sampleSize);
+				}
+				converter.convertPlanar(rows.data(), count, sampleSize, planar.data(), BlockRows);
+				bands.push(planar.data(), count, BlockRows, addPower);
+				done += count;
+			}
+		});
+
+		result.Channels.resize(channels);
+		for (size_t ch = 0; ch < channels; ++ch) {
+			ChunkResult::Channel& channel = result.Channels[ch];
+			channel.Count = stats.count();
+			channel.Mean = stats.mean(ch);
+			channel.Squares = stats.variance(ch) * double(stats.count());
+			channel.Min = stats.count() ? stats.min(ch) : 0;
+			channel.Max = stats.count() ? stats.max(ch) : 0;
+			std::copy(&power[ch * BandPower::BandsCount], &power[ch * BandPower::BandsCount] + BandPower::BandsCount, channel.Power);
+			channel.FlaggedWindows = flagged[ch];
+		}
+	}
+	catch (const std::exception& ex) {
+		result.Error = ex.what();
+	}
+}
+
+// the last chunk of the file done, on its pool thread
+void BatchProcessor::merge(FileJob& job) {
+	FileSummary& summary = job.Summary;
+	const size_t channels = job.Reader ? job.Reader->channels() : 0;
+	const double microvolts = job.Reader ? double(job.Reader->header().Property.Resolution) * 1e6 : 0.;
+	summary.Chunks = job.Chunks.size();
+	std::vector<ChunkResult::Channel> total(channels, ChunkResult::Channel());
+	uint64_t estimates = 0;
+	for (size_t ch = 0; ch < channels; ++ch) {
+		total[ch].Min = std::numeric_limits<int32_t>::max();
+		total[ch].Max = std::numeric_limits<int32_t>::min();
+	}
+	for (const ChunkResult& chunk : job.Chunks) {
+		if (!chunk.Error.empty()) {
+			if (summary.Error.empty()) summary.Error = chunk.Error;
+			continue;
+		}
+		summary.Windows += chunk.Windows;
+		summary.FlaggedWindows += chunk.FlaggedWindows;
+		estimates += chunk.Estimates;
+		for (size_t ch = 0; ch < channels; ++ch) {
+			const ChunkResult::Channel& part = chunk.Channels[ch];
+			ChunkResult::Channel& sum = total[ch];
+			if (part.Count) {
+				// pairwise update of mean and squared deviations
+				const uint64_t count = sum.Count + part.Count;
+				const double delta = part.Mean - sum.Mean;
+				sum.Mean += delta * double(part.Count) / double(count);
+				sum.Squares += part.Squares + delta * delta * double(sum.Count) * double(part.Count) / double(count);
+				sum.Count = count;
+				sum.Min = std::min(sum.Min, part.Min);
+				sum.Max = std::max(sum.Max, part.Max);
+			}
+			for (size_t band = 0; band < BandPower::BandsCount; ++band) {
+				sum.Power[band] += part.Power[band];
+			}
+			sum.FlaggedWindows += part.FlaggedWindows;
+		}
+	}
+	summary.Samples = channels ? total[0].Count : 0;
+	summary.Channels.resize(channels);
+	for (size_t ch = 0; ch < channels; ++ch) {
+		const ChunkResult::Channel& sum = total[ch];
+		ChannelSummary& out = summary.Channels[ch];
+		out.Mean = sum.Mean * microvolts;
+		out.Deviation = sum.Count ? std::sqrt(sum.Squares / double(sum.Count)) * microvolts : 0.;
+		out.Min = sum.Count ? sum.Min * microvolts : 0.;
+		out.Max = sum.Count ? sum.Max * microvolts : 0.;
+		for (size_t band = 0; band < BandPower::BandsCount; ++band) {
+			out.Power[band] = estimates ? sum.Power[band] / double(estimates) : 0.;
+		}
+		out.FlaggedWindows = sum.FlaggedWindows;
+	}
+	// the mapping and the chunk results are not kept until the file is emitted
+	job.Reader.reset();
+	std::vector<ChunkResult>().swap(job.Chunks);
+	std::lock_guard<std::mutex> lock(mutex);
+	job.Done = true;
+	done.notify_all();
+}
+
+std::vector<std::string> BatchProcessor::list(const std::string& directory, const std::string& extension) {
+	std::vector<std::string> paths;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	const HANDLE search = FindFirstFileA((directory + "\\*" + extension).c_str(), &found);
+	if (search == INVALID_HANDLE_VALUE) {
+		if (GetLastError() == ERROR_FILE_NOT_FOUND) return paths;
+		throw std::runtime_error("Cannot read directory: " + directory);
+	}
+	do {
+		if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+			paths.push_back(directory + "\\" + found.cFileName);
+		}
+	} while (FindNextFileA(search, &found));
+	FindClose(search);
+#else
+	DIR* dir = ::opendir(directory.c_str());
+	if (!dir) {
+		throw std::runtime_error("Cannot read directory: " + directory);
+	}
+	while (const dirent* entry = ::readdir(dir)) {
+		const std::string name = entry->d_name;
+		if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0) {
+			paths.push_back(directory + "/" + name);
+		}
+	}
+	::closedir(dir);
+#endif
+	std::sort(paths.begin(), paths.end());
+	return paths;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "BandPower.h"
+#include "IirFilter.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// offline processing of recording files (see MappedRecording.h): every file is cut into
+// chunks of ChunkSeconds, a chunk is filtered, its band power estimated and its artifacts
+// detected from WarmupSeconds before its start, so the filter and the band power window are
+// settled at the start, and only its own samples are counted. Chunks run on a work-stealing
+// pool, a large file is shared by all threads; the results of the chunks are merged in the
+// order of the chunks, so they do not depend on the number of threads or on scheduling.
+// Files are memory mapped and at most two per thread are open, memory does not grow with
+// the archive
+class BatchProcessor {
+public:
+	struct Settings {
+		Settings() : ChunkSeconds(60.f), WarmupSeconds(5.f), ThreadsCount(std::thread::hardware_concurrency()) {}
+		FilterSettings Filter;
+		float ChunkSeconds;  // rounded to whole artifact windows
+		float WarmupSeconds; // overlap with the previous chunk, not counted
+		size_t ThreadsCount;
+	};
+
+	// filtered samples, uV
+	struct ChannelSummary {
+		double Mean;
+		double Deviation;
+		double Min;
+		double Max;
+		double Power[BandPower::BandsCount]; // mean of the estimates, uV^2
+		uint64_t FlaggedWindows;             // artifact windows with the channel flagged
+	};
+
+	struct FileSummary {
+		std::string Path;
+		std::string Error; // empty if the file was processed
+		uint64_t Samples;
+		size_t Chunks;
+		float Rate;
+		uint64_t Windows;        // artifact windows
+		uint64_t FlaggedWindows; // windows with any channel flagged
+		std::vector<ChannelSummary> Channels;
+	};
+
+	typedef std::function<void(const FileSummary&)> Emit;
+
+	explicit BatchProcessor(const Settings& settings = Settings());
+
+	// emit is called on the calling thread for every file in the order of paths
+	void run(const std::vector<std::string>& paths, const Emit& emit);
+	// tasks taken by idle threads from the queues of busy ones in the last run
+	uint64_t steals() const { return stolen; }
+
+	// recording files of a directory, sorted by name
+	static std::vector<std::string> list(const std::string& directory, const std::string& extension = ".nbr");
+
+private:
+	struct ChunkResult;
+	struct FileJob;
+
+	void open(const std::shared_ptr<FileJob>& job);
+	void process(FileJob& job, size_t chunk);
+	void merge(FileJob& job);
+
+	const Settings settings;
+	uint64_t stolen;
+	std::mutex mutex;
+	std::condition_variable done;
+};
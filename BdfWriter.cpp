@@ -0,0 +1,281 @@
+#include "BdfWriter.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const int32_t DigitalMin = -8388608; // 24-bit samples
+const int32_t DigitalMax = 8388607;
+const size_t AnnotationSamples = 128; // 384 bytes of TALs per record, about 10 events
+const size_t RecordCountOffset = 236;
+const char* Months[] = { "JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC" };
+
+std::tm localTime(std::time_t time) {
+	std::tm tm = {};
+#ifdef _WIN32
+	localtime_s(&tm, &time);
+#else
+	localtime_r(&time, &tm);
+#endif
+	return tm;
+}
+
+// header fields are space padded ASCII
+void field(std::string& header, const std::string& value, size_t width) {
+	header += value.substr(0, width);
+	header.append(width - std::min(width, value.size()), ' ');
+}
+
+// number in no more than 8 characters
+std::string number(double value) {
+	char text[32];
+	for (int precision = 6; precision >= 0; --precision) {
+		std::snprintf(text, sizeof(text), "%.*f", precision, value);
+		if (std::strlen(text) <= 8) break;
+	}
+	return text;
+}
+
+// EDF+ subfields must not contain spaces
+std::string subfield(const uint8_t* text, size_t size) {
+	std::string value(reinterpret_cast<const char*>(text), strnlen(reinterpret_cast<const char*>(text), size));
+	std::replace(value.begin(), value.end(), ' ', '_');
+	return value.empty() ? "X" : value;
+}
+
+std::vector<uint32_t> enabledChannels(uint32_t count, uint32_t enabled) {
+	std::vector<uint32_t> channels;
+	for (uint32_t ch = 0; ch < count; ++ch) {
+		if ((enabled >> ch) & 1) {
+			channels.push_back(ch);
+		}
+	}
+	return channels;
+}
+
+std::string edfDate(const std::tm& tm) {
+	char text[16];
+	std::snprintf(text, sizeof(text), "%02d-%s-%04d", tm.tm_mday, Months[tm.tm_mon % 12], tm.tm_year + 1900);
+	return text;
+}
+
+} // namespace
+
+BdfWriter::BdfWriter(const std::string& path, const Header& header, size_t recordsPerBuffer) :
+	header(header),
+	channels(enabledChannels(header.ChannelsCount, header.EnabledChannels)),
+	samplesPerRecord(size_t(header.Property.Rate)),
+	annotationBytes(AnnotationSamples * 3),
+	recordBytes(channels.size() * samplesPerRecord * 3 + annotationBytes),
+	recordsPerBuffer(std::max<size_t>(1, recordsPerBuffer)),
+	record(nullptr), recordIndex(0), recordFill(0), started(false),
+	lastCounter(0), counterBase(0), firstSample(0),
+	backReady(false), stopping(false), written(0), dropped(0) {
+	front.Data.resize(recordBytes * this->recordsPerBuffer);
+	back.Data.resize(recordBytes * this->recordsPerBuffer);
+	discard.resize(recordBytes);
+
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("Cannot create file: " + path);
+	}
+	writeHeader();
+	thread = std::thread(&BdfWriter::run, this);
+}
+
+BdfWriter::~BdfWriter() {
+	try {
+		close();
+	}
+	catch (...) {
+	}
+}
+
+void BdfWriter::writeHeader() {
+	const std::tm start = localTime(header.StartTime);
+	const t_nb2Patient& patient = header.Patient;
+	const size_t signals = channels.size() + 1;
+	char text[32];
+
+	std::string h;
+	h += '\xFF';
+	field(h, "BIOSEMI", 7);
+	// EDF+ patient: code sex birthdate name
+	field(h, subfield(patient.id, sizeof(patient.id)) + ' ' + (patient.gender ? "F" : "M") + ' ' +
+		(patient.dateOfBirth ? edfDate(localTime(std::time_t(patient.dateOfBirth))) : "X") + ' ' +
+		subfield(patient.name, sizeof(patient.name)), 80);
+	// EDF+ recording: Startdate date admincode technician equipment
+	field(h, "Startdate " + edfDate(start) + " X X " + header.Equipment, 80);
+	std::snprintf(text, sizeof(text), "%02d.%02d.%02d", start.tm_mday, start.tm_mon + 1, start.tm_year % 100);
+	field(h, text, 8);
+	std::snprintf(text, sizeof(text), "%02d.%02d.%02d", start.tm_hour, start.tm_min, start.tm_sec);
+	field(h, text, 8);
+	field(h, std::to_string(256 * (signals + 1)), 8);
+	field(h, "BDF+D", 44);
+	field(h, "-1", 8); // number of records, written by close
+	field(h, "1", 8); // record duration, s
+	field(h, std::to_string(signals), 4);
+
+	// physical range of every channel from its calibrated scaling, digital values are raw codes
+	std::vector<double> gain(channels.size(), double(header.Property.Resolution) * 1e6), offset(channels.size(), 0.);
+	for (size_t i = 0; i < channels.size(); ++i) {
+		if (channels[i] < header.Gain.size() && channels[i] < header.Offset.size()) {
+			gain[i] = header.Gain[channels[i]];
+			offset[i] = header.Offset[channels[i]];
+		}
+	}
+	for (uint32_t ch : channels) field(h, "EEG " + std::to_string(ch + 1), 16);
+	field(h, "BDF Annotations", 16);
+	for (size_t i = 0; i < channels.size(); ++i) field(h, "AgAgCl electrode", 80);
+	field(h, "", 80);
+	for (size_t i = 0; i < channels.size(); ++i) field(h, "uV", 8);
+	field(h, "", 8);
+	for (size_t i = 0; i < channels.size(); ++i) field(h, number(DigitalMin * gain[i] + offset[i]), 8);
+	field(h, "-1", 8);
+	for (size_t i = 0; i < channels.size(); ++i) field(h, number(DigitalMax * gain[i] + offset[i]), 8);
+	field(h, "1", 8);
+	for (size_t i = 0; i < signals; ++i) field(h, std::to_string(DigitalMin), 8);
+	for (size_t i = 0; i < signals; ++i) field(h, std::to_string(DigitalMax), 8);
+	for (size_t i = 0; i < channels.size(); ++i) field(h, "DC", 80);
+	field(h, "", 80);
+	for (size_t i = 0; i < channels.size(); ++i) field(h, std::to_string(samplesPerRecord), 8);
+	field(h, std::to_string(AnnotationSamples), 8);
+	for (size_t i = 0; i < signals; ++i) field(h, "", 32);
+	file.write(h.data(), std::streamsize(h.size()));
+}
+
+void BdfWriter::write(const int32_t* data, size_t sampleCount, size_t sampleSize) {
+	for (size_t i = 0; i < sampleCount; ++i) {
+		const int32_t* row = data + i * sampleSize;
+		const uint32_t counter = uint32_t(row[sampleSize - 1]);
+		if (started && counter < lastCounter) {
+			counterBase += uint64_t(lastCounter) + 1; // counter reset or wrap, continue the time line
+		}
+		lastCounter = counter;
+		const uint64_t sample = counterBase + counter;
+		if (!started) {
+			firstSample = sample;
+			started = true;
+		}
+		const uint64_t position = sample - firstSample;
+		const uint64_t index = position / samplesPerRecord;
+		const size_t offset = size_t(position % samplesPerRecord);
+
+		if (record && index != recordIndex) {
+			finishRecord();
+		}
+		if (!record) {
+			startRecord(index);
+		}
+		if (offset > recordFill) { // zeros are left in place of lost samples
+			annotate(uint32_t(counter - (offset - recordFill)), "lost " + std::to_string(offset - recordFill) + " samples");
+		}
+		uint8_t* out = record + offset * 3;
+		for (size_t j = 0; j < channels.size(); ++j, out += samplesPerRecord * 3) {
+			const int32_t value = std::min(DigitalMax, std::max(DigitalMin, row[channels[j]]));
+			out[0] = uint8_t(value);
+			out[1] = uint8_t(value >> 8);
+			out[2] = uint8_t(value >> 16);
+		}
+		recordFill = offset + 1;
+	}
+}
+
+void BdfWriter::annotate(uint32_t counter, const std::string& text) {
+	// onset from the extended counter, counters before the first sample give negative onset
+	const double onset = (double(counterBase + counter) - double(firstSample)) / samplesPerRecord;
+	char time[32];
+	std::snprintf(time, sizeof(time), "%+.3f", onset);
+	std::string tal = std::string(time) + '\x14' + text + '\x14' + '\0';
+	if (tal.size() <= annotationBytes / 2) {
+		annotations.push_back(std::move(tal));
+	}
+}
+
+void BdfWriter::startRecord(uint64_t index) {
+	record = front.Records < recordsPerBuffer ? &front.Data[front.Records * recordBytes] : discard.data();
+	std::memset(record, 0, recordBytes);
+	recordIndex = index;
+	recordFill = 0;
+}
+
+void BdfWriter::finishRecord() {
+	if (record == discard.data()) {
+		++dropped; // both buffers are full, the disk does not keep up
+	}
+	else {
+		// time-keeping TAL, then as many pending annotations as fit
+		const std::string timekeeping = '+' + std::to_string(recordIndex) + "\x14\x14" + '\0';
+		uint8_t* tal = record + recordBytes - annotationBytes;
+		std::memcpy(tal, timekeeping.data(), timekeeping.size());
+		size_t used = timekeeping.size();
+		while (!annotations.empty() && used + annotations.front().size() <= annotationBytes) {
+			std::memcpy(tal + used, annotations.front().data(), annotations.front().size());
+			used += annotations.front().size();
+			annotations.pop_front();
+		}
+		++front.Records;
+	}
+	record = nullptr;
+	handOff(false);
+}
+
+void BdfWriter::handOff(bool wait) {
+	if (front.Records == 0) {
+		return;
+	}
+	std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+	if (wait) {
+		lock.lock();
+		idle.wait(lock, [this] { return !backReady; });
+	}
+	else if (!lock.try_lock() || backReady) {
+		return; // I/O thread is busy, records stay in the front buffer
+	}
+	std::swap(front, back);
+	backReady = true;
+	wake.notify_one();
+}
+
+void BdfWriter::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		wake.wait(lock, [this] { return backReady || stopping; });
+		if (!backReady) {
+			break;
+		}
+		lock.unlock();
+		file.write(reinterpret_cast<const char*>(back.Data.data()), std::streamsize(back.Records * recordBytes));
+		written += back.Records;
+		lock.lock();
+		back.Records = 0;
+		backReady = false;
+		idle.notify_all();
+	}
+}
+
+void BdfWriter::close() {
+	if (!thread.joinable()) {
+		return;
+	}
+	if (record) {
+		finishRecord();
+	}
+	handOff(true);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	thread.join();
+
+	std::string count;
+	field(count, std::to_string(written.load()), 8);
+	file.seekp(RecordCountOffset);
+	file.write(count.data(), std::streamsize(count.size()));
+	file.close();
+	if (!file) {
+		throw std::runtime_error("BDF file write error");
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// host-side continuous recording of nb2GetData samples and events into a 24-bit BDF+ file;
+// 1 second data records are formatted on the acquisition thread into the front buffer and
+// written to disk by a background thread from the back buffer, the buffers are swapped
+// without waiting, so a disk stall never blocks acquisition: if both buffers are full
+// the newest records are dropped and counted, memory use is fixed by RecordsPerBuffer;
+// the file is BDF+D (discontinuous): lost samples are zero-filled inside a record and
+// records lost entirely are skipped, every record keeps its own onset time
+class BdfWriter {
+public:
+	struct Header {
+		t_nb2Property Property;         // Rate and Resolution of the samples
+		uint32_t ChannelsCount;         // channels in a sample row
+		uint32_t EnabledChannels;       // only enabled channels are written
+		t_nb2Patient Patient;
+		std::string Equipment;          // model and serial number
+		std::time_t StartTime;
+		std::vector<float> Gain;        // uV per bit of every channel, Resolution if empty
+		std::vector<float> Offset;      // uV at zero code of every channel
+	};
+
+	BdfWriter(const std::string& path, const Header& header, size_t recordsPerBuffer = 30);
+	~BdfWriter();
+	BdfWriter(const BdfWriter&) = delete;
+	BdfWriter& operator=(const BdfWriter&) = delete;
+
+	// acquisition thread: sample rows, (ChannelsCount + 2) words, counter is the last word
+	void write(const int32_t* data, size_t sampleCount, size_t sampleSize);
+	// acquisition thread: annotation at the sample with the given counter
+	void annotate(uint32_t counter, const std::string& text);
+	// writes the last record and the count of records into the header, waits for the disk
+	void close();
+
+	uint64_t recordsWritten() const { return written.load(); }
+	uint64_t recordsDropped() const { return dropped.load(); }
+
+private:
+	struct Buffer {
+		std::vector<uint8_t> Data;
+		size_t Records = 0;
+	};
+
+	void writeHeader();
+	void startRecord(uint64_t index);
+	void finishRecord();
+	void handOff(bool wait);
+	void run();
+
+	const Header header;
+	const std::vector<uint32_t> channels; // enabled channel numbers
+	const size_t samplesPerRecord;
+	const size_t annotationBytes;
+	const size_t recordBytes;
+	const size_t recordsPerBuffer;
+	std::ofstream file;
+
+	// acquisition side
+	Buffer front;
+	std::vector<uint8_t> discard; // record which did not fit into the full front buffer
+	uint8_t* record;
+	uint64_t recordIndex;
+	size_t recordFill;
+	bool started;
+	uint32_t lastCounter;
+	uint64_t counterBase; // extends 32-bit counter over resets
+	uint64_t firstSample;
+	std::deque<std::string> annotations; // TALs waiting for space in a record
+
+	// I/O thread side
+	Buffer back;
+	bool backReady;
+	bool stopping;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::atomic<uint64_t> written;
+	std::atomic<uint64_t> dropped;
+	std::thread thread;
+};
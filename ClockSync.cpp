@@ -0,0 +1,169 @@
+#include "ClockSync.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+// points closer to the line than this are never rejected, the median deviation of good
+// segments may be much smaller than a poll interval
+const double MinDeviation = 0.5e-3;
+}
+
+ClockSync::ClockSync(double rate, const Settings& settings) :
+	nominalRate(rate), sets(settings), period(1. / rate), started(false), baseCounter(0), baseTime(0.), lastRaw(0), unwrapped(0),
+	segmentStart(0.), segmentUsed(false), lowest(), lowestResidual(0.), highestResidual(0.),
+	window(settings.WindowSegments), windowNext(0), windowCount(0),
+	residuals(settings.WindowSegments), deviations(settings.WindowSegments), accepted(settings.WindowSegments) {
+	if (!(rate > 0.) || !(settings.SegmentSeconds > 0.) || settings.WindowSegments < 2) {
+		throw std::runtime_error("Invalid clock sync settings");
+	}
+}
+
+void ClockSync::reset() {
+	current = Fit();
+	started = false;
+	segmentUsed = false;
+	windowNext = 0;
+	windowCount = 0;
+}
+
+bool ClockSync::add(uint32_t lastCounter, std::chrono::steady_clock::time_point arrival) {
+	const double time = seconds(arrival);
+	// a counter going back or a point far before the line: the old points do not apply
+	if (started && (int32_t(lastCounter - lastRaw) < 0
+		|| (windowCount && time - current.time(lastCounter) < -sets.JumpTolerance))) {
+		reset();
+	}
+	if (!started) {
+		started = true;
+		baseCounter = lastCounter;
+		baseTime = time;
+		lastRaw = lastCounter;
+		unwrapped = 0;
+	}
+	unwrapped += int32_t(lastCounter - lastRaw);
+	lastRaw = lastCounter;
+	const Point point = { double(unwrapped), time - baseTime };
+
+	bool changed = false;
+	if (segmentUsed && point.Time - segmentStart >= sets.SegmentSeconds) {
+		closeSegment();
+		changed = true;
+	}
+	const double slope = windowCount ? current.Period : period;
+	const double residual = point.Time - point.Counter * slope;
+	if (!segmentUsed) {
+		segmentUsed = true;
+		segmentStart = point.Time;
+		lowest = point;
+		lowestResidual = residual;
+		highestResidual = residual;
+	}
+	else if (residual < lowestResidual) {
+		lowest = point;
+		lowestResidual = residual;
+	}
+	highestResidual = std::max(highestResidual, residual);
+	// until the first segment is closed: the known drift through the lowest point
+	if (windowCount == 0 && lowestResidual == residual) {
+		current.Counter = lastCounter;
+		current.Time = time;
+		current.Period = slope;
+		current.Error = highestResidual - lowestResidual;
+		current.Points = 1;
+		changed = true;
+	}
+	return changed;
+}
+
+void ClockSync::closeSegment() {
+	window[windowNext] = lowest;
+	windowNext = (windowNext + 1) % window.size();
+	windowCount = std::min(windowCount + 1, window.size());
+	segmentUsed = false;
+	refit();
+}
+
+void ClockSync::refit() {
+	const size_t n = windowCount;
+	double slope = period;
+	double intercept = 0.;
+	std::fill(accepted.begin(), accepted.begin() + n, char(1));
+	if (n < sets.MinSegments) {
+		// the known drift through the lowest of the points
+		intercept = window[0].Time - window[0].Counter * slope;
+		for (size_t i = 1; i < n; ++i) {
+			intercept = std::min(intercept, window[i].Time - window[i].Counter * slope);
+		}
+	}
+	else {
+		for (int pass = 0; pass < 2; ++pass) {
+			// centered sums, the counters grow large
+			double count = 0., meanCounter = 0., meanTime = 0.;
+			for (size_t i = 0; i < n; ++i) {
+				if (!accepted[i]) continue;
+				count += 1.;
+				meanCounter += window[i].Counter;
+				meanTime += window[i].Time;
+			}
+			meanCounter /= count;
+			meanTime /= count;
+			double sxx = 0., sxy = 0.;
+			for (size_t i = 0; i < n; ++i) {
+				if (!accepted[i]) continue;
+				const double dx = window[i].Counter - meanCounter;
+				sxx += dx * dx;
+				sxy += dx * (window[i].Time - meanTime);
+			}
+			if (sxx > 0.) {
+				slope = sxy / sxx;
+			}
+			intercept = meanTime - slope * meanCounter;
+			if (pass == 1) {
+				break;
+			}
+
+			// late segments only lie far above the line
+			for (size_t i = 0; i < n; ++i) {
+				residuals[i] = window[i].Time - (intercept + slope * window[i].Counter);
+			}
+			std::copy(residuals.begin(), residuals.begin() + n, deviations.begin());
+			std::nth_element(deviations.begin(), deviations.begin() + n / 2, deviations.begin() + n);
+			const double median = deviations[n / 2];
+			for (size_t i = 0; i < n; ++i) {
+				deviations[i] = std::fabs(residuals[i] - median);
+			}
+			std::nth_element(deviations.begin(), deviations.begin() + n / 2, deviations.begin() + n);
+			const double limit = median + std::max(MinDeviation, sets.RejectDeviations * 1.4826 * deviations[n / 2]);
+			size_t rejected = 0;
+			for (size_t i = 0; i < n; ++i) {
+				accepted[i] = residuals[i] <= limit;
+				rejected += accepted[i] ? 0 : 1;
+			}
+			if (rejected == 0 || rejected * 2 > n) {
+				std::fill(accepted.begin(), accepted.begin() + n, char(1));
+				break;
+			}
+		}
+	}
+
+	double error = 0.;
+	size_t rejected = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (accepted[i]) {
+			error = std::max(error, std::fabs(window[i].Time - (intercept + slope * window[i].Counter)));
+		}
+		else {
+			++rejected;
+		}
+	}
+	current.Counter = baseCounter + uint32_t(uint64_t(unwrapped));
+	current.Time = baseTime + intercept + slope * double(unwrapped);
+	current.Period = slope;
+	if (n >= sets.MinSegments) {
+		period = slope;
+	}
+	current.Error = error;
+	current.Points = n - rejected;
+	current.Rejected = rejected;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// mapping of the device sample counter to the host monotonic clock (offset and drift).
+// Every nb2GetData return is a point: the counter of its last row and the host time of the
+// return. A BLE packet is never delivered before it was sampled, so delivery jitter only
+// delays points and the lowest point of a segment (SegmentSeconds of host time) is its best
+// one. A line is fitted by least squares to the lowest points of the last WindowSegments,
+// points above it by more than RejectDeviations median deviations (a segment of late packets
+// only) are rejected and the line is fitted again; a point below it by more than
+// JumpTolerance (the counter was rebased or the clock stepped) starts the window over.
+// Adding a block is O(1), the fit is O(WindowSegments) once a segment. The host time of a
+// sample includes the least link latency seen, the latency itself is not observable
+class ClockSync {
+public:
+	struct Settings {
+		Settings() : SegmentSeconds(1.), WindowSegments(60), MinSegments(10), RejectDeviations(3.), JumpTolerance(0.05) {}
+		double SegmentSeconds;
+		size_t WindowSegments;
+		size_t MinSegments; // for a fitted drift, the last one or the nominal rate is used before
+		double RejectDeviations;
+		double JumpTolerance; // seconds
+	};
+
+	// host time of any counter in O(1), a plain value to copy between threads
+	struct Fit {
+		Fit() : Counter(0), Time(0.), Period(0.), Error(0.), Points(0), Rejected(0) {}
+		uint32_t Counter; // reference counter, of the latest point
+		double Time;      // host seconds of Counter, of the steady_clock epoch (see seconds)
+		double Period;    // host seconds per sample
+		double Error;     // largest distance of the fitted points from the line, seconds
+		size_t Points;    // lowest points of the segments in the fit, 0 before any data
+		size_t Rejected;  // of the window, as late
+
+		bool valid() const { return Period > 0.; }
+		// counters within 2^31 samples of Counter
+		double time(uint32_t counter) const { return Time + double(int32_t(counter - Counter)) * Period; }
+		// deviation of the device clock from the nominal rate, parts per million
+		double driftPpm(double rate) const { return (1. / (Period * rate) - 1.) * 1e6; }
+	};
+
+	explicit ClockSync(double rate, const Settings& settings = Settings());
+
+	// a block with lastCounter in its last row returned at arrival;
+	// returns true if the fit changed
+	bool add(uint32_t lastCounter, std::chrono::steady_clock::time_point arrival);
+	// the points are dropped (the device was restarted), the drift of the last fit is kept
+	void reset();
+
+	const Fit& fit() const { return current; }
+	double rate() const { return nominalRate; }
+
+	static double seconds(std::chrono::steady_clock::time_point time) {
+		return std::chrono::duration<double>(time.time_since_epoch()).count();
+	}
+
+private:
+	struct Point {
+		double Counter; // samples since the base
+		double Time;    // seconds since the base
+	};
+
+	void closeSegment();
+	void refit();
+
+	const double nominalRate;
+	const Settings sets;
+	Fit current;
+	double period; // of the last fit with a drift, nominal before
+	bool started;
+	uint32_t baseCounter;
+	double baseTime;
+	uint32_t lastRaw;
+	int64_t unwrapped; // counter of the last point since the base
+	double segmentStart;
+	bool segmentUsed;
+	Point lowest; // of the segment, by the distance from the line
+	double lowestResidual;
+	double highestResidual;
+	std::vector<Point> window; // ring of the segment points
+	size_t windowNext;
+	size_t windowCount;
+	std::vector<double> residuals; // fit scratch
+	std::vector<double> deviations;
+	std::vector<char> accepted;
+};
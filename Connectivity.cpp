@@ -0,0 +1,319 @@
+#include "Connectivity.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define CONNECTIVITY_WIDTH 8
+#elif defined(__SSE4_1__) || defined(__AVX__)
+	#include <smmintrin.h>
+	#define CONNECTIVITY_WIDTH 4
+#else
+	#define CONNECTIVITY_WIDTH 1
+#endif
+
+namespace {
+
+const double Pi = 3.14159265358979323846;
+// of the demodulated band, see Connectivity.h; a 4th order one let the alpha rhythm into
+// the beta band: up to 0.98 coherence of channels sharing only a 10 Hz sine
+const size_t LowPassOrder = 12;
+// rows of a tile stay in L1 cache while every pair of channel groups walks them
+const size_t TileRows = 64;
+
+size_t hopLength(const Connectivity::Settings& settings, Nb2Rate rate) {
+	if (!(settings.PublishSeconds > 0.f) || !(settings.WindowSeconds >= settings.PublishSeconds)) {
+		throw std::runtime_error("Invalid connectivity window or publish interval");
+	}
+	return std::max<size_t>(1, size_t(std::lround(settings.PublishSeconds * 125.f * float(1 << rate))));
+}
+
+size_t windowBlocks(const Connectivity::Settings& settings) {
+	return size_t(std::lround(settings.WindowSeconds / settings.PublishSeconds));
+}
+
+} // namespace
+
+SlidingCovariance::SlidingCovariance(size_t width, size_t hopSize, size_t windowBlocks) :
+	dimension(width),
+	paddedWidth((width + CONNECTIVITY_WIDTH - 1) / CONNECTIVITY_WIDTH * CONNECTIVITY_WIDTH),
+	hopSize(std::max<size_t>(1, hopSize)), windowBlocks(std::max<size_t>(1, windowBlocks)),
+	reference(width), blockFirst(paddedWidth), tile(TileRows * paddedWidth),
+	blockCross(paddedWidth * paddedWidth), blockSum(paddedWidth),
+	ringCross(this->windowBlocks * width * width), ringSum(this->windowBlocks * width),
+	totalCross(width * width), totalSum(width) {
+	reset();
+}
+
+void SlidingCovariance::reset() {
+	started = false;
+	filled = 0;
+	tileRows = 0;
+	std::fill(tile.begin(), tile.end(), 0.f);
+	std::fill(blockCross.begin(), blockCross.end(), 0.);
+	std::fill(blockSum.begin(), blockSum.end(), 0.);
+	std::fill(totalCross.begin(), totalCross.end(), 0.);
+	std::fill(totalSum.begin(), totalSum.end(), 0.);
+	ringNext = 0;
+	blocks = 0;
+	windowCount = 0;
+}
+
+size_t SlidingCovariance::push(const float* rows, size_t sampleCount, size_t rowStride) {
+	const size_t count = std::min(sampleCount, hopSize - filled);
+	if (count == 0) {
+		return 0;
+	}
+	if (!started) {
+		std::copy(rows, rows + dimension, reference.begin());
+		started = true;
+	}
+	if (filled == 0) {
+		std::copy(rows, rows + dimension, blockFirst.begin());
+	}
+	for (size_t i = 0; i < count; ++i) {
+		const float* row = rows + i * rowStride;
+		float* d = &tile[tileRows * paddedWidth];
+		for (size_t ch = 0; ch < dimension; ++ch) {
+			d[ch] = row[ch] - blockFirst[ch];
+		}
+		if (++tileRows == TileRows) {
+			flushTile();
+		}
+	}
+	filled += count;
+	if (filled == hopSize) {
+		flushTile();
+		finishBlock();
+	}
+	return count;
+}
+
+// rank-k update of the block sums by the rows of the tile: four channels i and a group of
+// channels g are walked over all rows with four accumulators in registers, which share the
+// load of the group and are independent additions; only the groups at or after the one of i
+// are computed, the upper triangle and a few values below the diagonal which are not used
+void SlidingCovariance::flushTile() {
+	const size_t count = tileRows;
+	if (count == 0) {
+		return;
+	}
+	tileRows = 0;
+	const float* rows = tile.data();
+#if CONNECTIVITY_WIDTH == 8
+	for (size_t i = 0; i < paddedWidth; i += 4) {
+		for (size_t g = i / 8 * 8; g < paddedWidth; g += 8) {
+			__m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+			for (size_t r = 0; r < count; ++r) {
+				const float* row = rows + r * paddedWidth;
+				const __m256 v = _mm256_loadu_ps(row + g);
+				a0 = _mm256_add_ps(a0, _mm256_mul_ps(_mm256_broadcast_ss(row + i), v));
+				a1 = _mm256_add_ps(a1, _mm256_mul_ps(_mm256_broadcast_ss(row + i + 1), v));
+				a2 = _mm256_add_ps(a2, _mm256_mul_ps(_mm256_broadcast_ss(row + i + 2), v));
+				a3 = _mm256_add_ps(a3, _mm256_mul_ps(_mm256_broadcast_ss(row + i + 3), v));
+			}
+			const __m256 acc[4] = { a0, a1, a2, a3 };
+			for (size_t k = 0; k < 4; ++k) {
+				double* cross = &blockCross[(i + k) * paddedWidth + g];
+				_mm256_storeu_pd(cross, _mm256_add_pd(_mm256_loadu_pd(cross), _mm256_cvtps_pd(_mm256_castps256_ps128(acc[k]))));
+				_mm256_storeu_pd(cross + 4, _mm256_add_pd(_mm256_loadu_pd(cross + 4), _mm256_cvtps_pd(_mm256_extractf128_ps(acc[k], 1))));
+			}
+		}
+	}
+#elif CONNECTIVITY_WIDTH == 4
+	for (size_t i = 0; i < paddedWidth; i += 4) {
+		for (size_t g = i; g < paddedWidth; g += 4) {
+			__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+			for (size_t r = 0; r < count; ++r) {
+				const float* row = rows + r * paddedWidth;
+				const __m128 v = _mm_loadu_ps(row + g);
+				a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_set1_ps(row[i]), v));
+				a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_set1_ps(row[i + 1]), v));
+				a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_set1_ps(row[i + 2]), v));
+				a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_set1_ps(row[i + 3]), v));
+			}
+			const __m128 acc[4] = { a0, a1, a2, a3 };
+			for (size_t k = 0; k < 4; ++k) {
+				double* cross = &blockCross[(i + k) * paddedWidth + g];
+				_mm_storeu_pd(cross, _mm_add_pd(_mm_loadu_pd(cross), _mm_cvtps_pd(acc[k])));
+				_mm_storeu_pd(cross + 2, _mm_add_pd(_mm_loadu_pd(cross + 2), _mm_cvtps_pd(_mm_movehl_ps(acc[k], acc[k]))));
+			}
+		}
+	}
+#else
+	for (size_t i = 0; i < dimension; ++i) {
+		for (size_t g = i; g < dimension; ++g) {
+			float acc = 0.f;
+			for (size_t r = 0; r < count; ++r) {
+				acc += rows[r * paddedWidth + i] * rows[r * paddedWidth + g];
+			}
+			blockCross[i * paddedWidth + g] += acc;
+		}
+	}
+#endif
+	for (size_t r = 0; r < count; ++r) {
+		const float* row = rows + r * paddedWidth;
+		for (size_t ch = 0; ch < dimension; ++ch) {
+			blockSum[ch] += row[ch];
+		}
+	}
+}
+
+// sums of the block about the reference: with x = first + d and r = first - reference,
+// sum (x - reference)(x - reference)' = sum dd' + (sum d)r' + r(sum d)' + n rr'
+void SlidingCovariance::finishBlock() {
+	const size_t slot = ringNext;
+	ringNext = (ringNext + 1) % windowBlocks;
+	double* cross = &ringCross[slot * dimension * dimension];
+	double* sum = &ringSum[slot * dimension];
+	const bool full = blocks >= windowBlocks;
+	if (full) {
+		for (size_t k = 0; k < dimension * dimension; ++k) totalCross[k] -= cross[k];
+		for (size_t k = 0; k < dimension; ++k) totalSum[k] -= sum[k];
+	}
+	const double n = double(hopSize);
+	for (size_t i = 0; i < dimension; ++i) {
+		const double ri = double(blockFirst[i]) - reference[i];
+		for (size_t j = i; j < dimension; ++j) {
+			const double rj = double(blockFirst[j]) - reference[j];
+			cross[i * dimension + j] = blockCross[i * paddedWidth + j] + blockSum[i] * rj + ri * blockSum[j] + n * ri * rj;
+		}
+		sum[i] = blockSum[i] + n * ri;
+	}
+	std::fill(blockCross.begin(), blockCross.end(), 0.);
+	std::fill(blockSum.begin(), blockSum.end(), 0.);
+	filled = 0;
+	++blocks;
+	windowCount = std::min(blocks, uint64_t(windowBlocks)) * hopSize;
+
+	if (full && ringNext == 0) {
+		// once per window the totals are the sum of the kept blocks again
+		std::fill(totalCross.begin(), totalCross.end(), 0.);
+		std::fill(totalSum.begin(), totalSum.end(), 0.);
+		for (size_t b = 0; b < windowBlocks; ++b) {
+			for (size_t k = 0; k < dimension * dimension; ++k) totalCross[k] += ringCross[b * dimension * dimension + k];
+			for (size_t k = 0; k < dimension; ++k) totalSum[k] += ringSum[b * dimension + k];
+		}
+	}
+	else {
+		for (size_t k = 0; k < dimension * dimension; ++k) totalCross[k] += cross[k];
+		for (size_t k = 0; k < dimension; ++k) totalSum[k] += sum[k];
+	}
+}
+
+void SlidingCovariance::covariance(double* out) const {
+	const double n = double(windowCount);
+	for (size_t i = 0; i < dimension; ++i) {
+		for (size_t j = i; j < dimension; ++j) {
+			const double c = n > 0. ? (totalCross[i * dimension + j] - totalSum[i] * totalSum[j] / n) / n : 0.;
+			out[i * dimension + j] = c;
+			out[j * dimension + i] = c;
+		}
+	}
+}
+
+Connectivity::Connectivity(size_t channelsCount, Nb2Rate rate, const Settings& settings) :
+	channelsCount(channelsCount),
+	bandsCount(std::min<size_t>(settings.BandsCount, MaxBands)),
+	signals(channelsCount, hopLength(settings, rate), windowBlocks(settings)),
+	covariances(channelsCount * channelsCount), correlations(channelsCount * channelsCount),
+	coherences(bandsCount * channelsCount * channelsCount),
+	published(0) {
+	const double fs = 125. * double(1 << rate);
+	for (size_t b = 0; b < bandsCount; ++b) {
+		const double low = settings.Edges[b], high = settings.Edges[b + 1];
+		if (!(high > low) || high >= 0.45 * fs) {
+			throw std::runtime_error("Invalid connectivity band edges");
+		}
+		Band band;
+		band.Phase = 0.;
+		band.Step = 2. * Pi * 0.5 * (low + high) / fs;
+		FilterSettings lowPass;
+		lowPass.LowPass = float(0.5 * (high - low));
+		lowPass.LowPassOrder = LowPassOrder;
+		band.LowPass.reset(new FilterBank(lowPass, 2 * channelsCount, rate));
+		band.Covariance.reset(new SlidingCovariance(2 * channelsCount, hopLength(settings, rate), windowBlocks(settings)));
+		bandStates.push_back(std::move(band));
+	}
+	demodulated.resize(bandsCount ? hopLength(settings, rate) * 2 * channelsCount : 0);
+	scratch.resize(4 * channelsCount * channelsCount);
+	reset();
+}
+
+void Connectivity::reset() {
+	signals.reset();
+	for (Band& band : bandStates) {
+		band.Phase = 0.;
+		band.LowPass->reset();
+		band.Covariance->reset();
+	}
+	std::fill(covariances.begin(), covariances.end(), 0.);
+	std::fill(correlations.begin(), correlations.end(), 0.);
+	std::fill(coherences.begin(), coherences.end(), 0.);
+	published = 0;
+}
+
+size_t Connectivity::push(const float* rows, size_t sampleCount, size_t rowStride, const Emit& emit) {
+	size_t publications = 0;
+	for (size_t i = 0; i < sampleCount;) {
+		// up to the end of the current block, which is the same for all bands
+		const float* in = rows + i * rowStride;
+		const size_t count = signals.push(in, sampleCount - i, rowStride);
+		for (Band& band : bandStates) {
+			const size_t stride = 2 * channelsCount;
+			for (size_t n = 0; n < count; ++n) {
+				const float c = float(std::cos(band.Phase)), s = float(std::sin(band.Phase));
+				band.Phase += band.Step;
+				const float* x = in + n * rowStride;
+				float* z = &demodulated[n * stride];
+				for (size_t ch = 0; ch < channelsCount; ++ch) {
+					z[ch] = x[ch] * c;
+					z[channelsCount + ch] = -x[ch] * s;
+				}
+			}
+			band.Phase = std::fmod(band.Phase, 2. * Pi);
+			band.LowPass->process(demodulated.data(), count, stride);
+			band.Covariance->push(demodulated.data(), count, stride);
+		}
+		i += count;
+		if (signals.blockFill() == 0) {
+			publish();
+			++publications;
+			if (emit) {
+				emit(*this);
+			}
+		}
+	}
+	return publications;
+}
+
+void Connectivity::publish() {
+	const size_t N = channelsCount;
+	signals.covariance(covariances.data());
+	for (size_t i = 0; i < N; ++i) {
+		for (size_t j = 0; j < N; ++j) {
+			const double d = covariances[i * N + i] * covariances[j * N + j];
+			correlations[i * N + j] = d > 0. ? covariances[i * N + j] / std::sqrt(d) : 0.;
+		}
+	}
+	// of the complex signals z = a + ib of channels i and j, with a the first N values of the
+	// rows and b the others: sum zi zj* = sum(ai aj + bi bj) + i sum(bi aj - ai bj)
+	const size_t M = 2 * N;
+	for (size_t b = 0; b < bandsCount; ++b) {
+		bandStates[b].Covariance->covariance(scratch.data());
+		const double* C = scratch.data();
+		double* coherence = &coherences[b * N * N];
+		for (size_t i = 0; i < N; ++i) {
+			const double pi = C[i * M + i] + C[(N + i) * M + N + i];
+			for (size_t j = 0; j < N; ++j) {
+				const double pj = C[j * M + j] + C[(N + j) * M + N + j];
+				const double re = C[i * M + j] + C[(N + i) * M + N + j];
+				const double im = C[(N + i) * M + j] - C[i * M + N + j];
+				const double d = pi * pj;
+				coherence[i * N + j] = d > 0. ? std::min(1., (re * re + im * im) / d) : 0.;
+			}
+		}
+	}
+	++published;
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include "IirFilter.h"
+#include <nb2mcs/nb2mcs.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// sliding window covariance of a vector of signals: rows go into blocks of hopSize rows, a
+// block is accumulated as the cross products of the deviations from its first row (a rank-k
+// update of tiles of 64 rows by AVX2, SSE4.1 or scalar code, float within a tile, double over
+// the block) and turned into sums about a fixed reference; the window sums add the new block
+// and subtract the one which leaves, so every row is multiplied out once whatever the window
+// length is, and they are summed again from the kept blocks once per window against rounding
+class SlidingCovariance {
+public:
+	SlidingCovariance(size_t width, size_t hopSize, size_t windowBlocks);
+
+	// up to the end of the current block: rows of width values, rowStride apart; returns the
+	// rows taken, the block is finished when blockFill() becomes 0
+	size_t push(const float* rows, size_t sampleCount, size_t rowStride);
+	void reset();
+
+	size_t width() const { return dimension; }
+	size_t blockFill() const { return filled; }
+	// rows in the window, up to hopSize * windowBlocks
+	uint64_t count() const { return windowCount; }
+	// full width x width covariance matrix of the window, row-major
+	void covariance(double* out) const;
+
+private:
+	void flushTile();
+	void finishBlock();
+
+	const size_t dimension;
+	const size_t paddedWidth; // multiple of SIMD width, padding lanes are 0
+	const size_t hopSize;
+	const size_t windowBlocks;
+	bool started;
+	std::vector<double> reference; // fixed per reset, keeps the sums small
+	// current block
+	size_t filled;
+	size_t tileRows;
+	std::vector<float> blockFirst; // [paddedWidth]
+	std::vector<float> tile;       // [TileRows][paddedWidth] deviations from blockFirst
+	std::vector<double> blockCross; // [paddedWidth][paddedWidth], upper triangle by SIMD groups
+	std::vector<double> blockSum;   // [paddedWidth]
+	// kept blocks about the reference and their running total
+	std::vector<double> ringCross; // [windowBlocks][width][width]
+	std::vector<double> ringSum;   // [windowBlocks][width]
+	std::vector<double> totalCross;
+	std::vector<double> totalSum;
+	size_t ringNext;
+	uint64_t blocks;
+	uint64_t windowCount;
+};
+
+// covariance, correlation and band-limited coherence between all channels over a sliding
+// window, published every PublishSeconds. Coherence of a band is taken by complex
+// demodulation: every channel is shifted down by the band center and low-pass filtered to
+// half the band width, the coherence of two channels is |sum zi zj*|^2 / (sum |zi|^2 sum |zj|^2)
+// of these complex signals over the window; the real and imaginary parts of all channels are
+// one row of 2 * channels values, so it is a SlidingCovariance of its own.
+// The band skirt is a 12th order Butterworth: -3 dB at the band edges, -40 dB at 1.47 half
+// widths from the center (4 Hz outside the 13-30 Hz beta band, a 10 Hz rhythm 3.5 Hz outside
+// it is -31 dB); coherence of a window of T seconds has a floor of about 1 / (T * band width)
+// for independent channels
+class Connectivity {
+public:
+	enum { MaxBands = 8 };
+
+	struct Settings {
+		Settings() : WindowSeconds(4.f), PublishSeconds(0.5f), BandsCount(4), Edges{ 1.f, 4.f, 8.f, 13.f, 30.f } {}
+		float WindowSeconds;  // rounded to whole publish intervals
+		float PublishSeconds;
+		size_t BandsCount;    // bands between consecutive edges, 0 for covariance only
+		float Edges[MaxBands + 1]; // Hz, delta, theta, alpha and beta by default
+	};
+
+	typedef std::function<void(const Connectivity&)> Emit;
+
+	Connectivity(size_t channelsCount, Nb2Rate rate, const Settings& settings = Settings());
+
+	// sampleCount rows of channelsCount values (uV), rowStride apart, e.g. from
+	// SampleConverter::convertRows; emit is called after every publication, returns their number
+	size_t push(const float* rows, size_t sampleCount, size_t rowStride, const Emit& emit = nullptr);
+	void reset();
+
+	size_t channels() const { return channelsCount; }
+	size_t bands() const { return bandsCount; }
+	bool ready() const { return published > 0; }
+	// of the last publication, uV^2
+	double covariance(size_t i, size_t j) const { return covariances[i * channelsCount + j]; }
+	double correlation(size_t i, size_t j) const { return correlations[i * channelsCount + j]; }
+	double coherence(size_t band, size_t i, size_t j) const { return coherences[(band * channelsCount + i) * channelsCount + j]; }
+	// row-major channels x channels matrices
+	const double* covarianceMatrix() const { return covariances.data(); }
+	const double* correlationMatrix() const { return correlations.data(); }
+	const double* coherenceMatrix(size_t band) const { return &coherences[band * channelsCount * channelsCount]; }
+
+private:
+	struct Band {
+		double Step;   // phase step of the demodulation, radians per sample
+		double Phase;
+		std::unique_ptr<FilterBank> LowPass;
+		std::unique_ptr<SlidingCovariance> Covariance;
+	};
+
+	void publish();
+
+	const size_t channelsCount;
+	const size_t bandsCount;
+	SlidingCovariance signals; // of the channels
+	std::vector<Band> bandStates;
+	std::vector<float> demodulated; // [rows][2 * channels], re then im
+	std::vector<double> scratch;
+	std::vector<double> covariances;
+	std::vector<double> correlations;
+	std::vector<double> coherences;
+	uint64_t published;
+};
@@ -0,0 +1,86 @@
+#include "Decimator.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+const double Pi = 3.14159265358979323846;
+const double PassFraction = 0.8; // cutoff of the output Nyquist frequency
+const size_t Lanes = 8;
+}
+
+Decimator::Decimator(size_t channelsCount, size_t factor) :
+	channelsCount(channelsCount), decimation(factor), taps(factor * TapsPerPhase + 1),
+	history(channelsCount * (taps.size() - 1)) {
+	if (factor < 1) {
+		throw std::runtime_error("Decimation factor must be 1 or more");
+	}
+	// Blackman windowed sinc, unity gain at DC
+	const double cutoff = PassFraction * 0.5 / double(factor); // cycles per input sample
+	const double middle = double(taps.size() - 1) / 2.;
+	double sum = 0.;
+	for (size_t i = 0; i < taps.size(); ++i) {
+		const double m = double(i) - middle;
+		const double sinc = m == 0. ? 2. * cutoff : std::sin(2. * Pi * cutoff * m) / (Pi * m);
+		const double x = taps.size() > 1 ? double(i) / double(taps.size() - 1) : 0.5;
+		const double window = 0.42 - 0.5 * std::cos(2. * Pi * x) + 0.08 * std::cos(4. * Pi * x);
+		taps[i] = float(sinc * window);
+		sum += sinc * window;
+	}
+	for (float& tap : taps) {
+		tap = float(tap / sum);
+	}
+	reset();
+}
+
+void Decimator::reset() {
+	phase = 0;
+	started = false;
+}
+
+size_t Decimator::process(const float* data, size_t sampleCount, size_t planeStride, float* out, size_t outStride) {
+	if (sampleCount == 0) {
+		return 0;
+	}
+	const size_t length = taps.size() - 1;
+	if (!started) {
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			std::fill(&history[ch * length], &history[ch * length] + length, data[ch * planeStride]);
+		}
+		started = true;
+	}
+	work.resize(length + sampleCount);
+	size_t produced = 0;
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		float* h = &history[ch * length];
+		std::copy(h, h + length, work.begin());
+		std::copy(data + ch * planeStride, data + ch * planeStride + sampleCount, work.begin() + std::ptrdiff_t(length));
+		float* y = out + ch * outStride;
+		produced = 0;
+		// output for the new sample t uses work[t .. t + length], the newest is work[length + t]
+		for (size_t t = phase; t < sampleCount; t += decimation) {
+			const float* x = &work[t];
+			// independent partial sums, so the products are computed by SIMD instructions
+			float acc[Lanes] = {};
+			size_t j = 0;
+			for (; j + Lanes <= length + 1; j += Lanes) {
+				for (size_t k = 0; k < Lanes; ++k) {
+					acc[k] += taps[j + k] * x[j + k];
+				}
+			}
+			float sum = 0.f;
+			for (; j <= length; ++j) {
+				sum += taps[j] * x[j];
+			}
+			for (size_t k = 0; k < Lanes; ++k) {
+				sum += acc[k];
+			}
+			y[produced++] = sum;
+		}
+		std::copy(work.end() - std::ptrdiff_t(length), work.end(), h);
+	}
+	// index of the next output in the next block
+	const size_t last = phase + (produced ? (produced - 1) * decimation : 0);
+	phase = produced ? last + decimation - sampleCount : phase - sampleCount;
+	return produced;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// anti-aliased decimation by an integer factor for display rate streams, e.g. 1000 Hz to 125 Hz
+// by 8: a windowed-sinc low-pass FIR of factor * TapsPerPhase taps with the cutoff at 80% of
+// the output Nyquist frequency is evaluated only at the kept samples, which is the polyphase
+// form of filtering then dropping factor - 1 of every factor samples; the history of the last
+// taps is kept between blocks, so blocks of any size give the same output
+class Decimator {
+public:
+	enum { TapsPerPhase = 16 };
+
+	Decimator(size_t channelsCount, size_t factor);
+
+	// sampleCount values of every channel, channel ch at data + ch * planeStride, into the
+	// decimated values of channel ch at out + ch * outStride; returns their number, at most
+	// sampleCount / factor + 1
+	size_t process(const float* data, size_t sampleCount, size_t planeStride, float* out, size_t outStride);
+	// the next sample is taken as the steady state
+	void reset();
+
+	size_t channels() const { return channelsCount; }
+	size_t factor() const { return decimation; }
+	// output samples delay, in input samples
+	size_t delay() const { return (taps.size() - 1) / 2; }
+
+private:
+	const size_t channelsCount;
+	const size_t decimation;
+	std::vector<float> taps;    // symmetric, odd length
+	std::vector<float> history; // [channel][taps - 1], the last samples
+	std::vector<float> work;    // history and the block of one channel
+	size_t phase; // new samples to take before the next output
+	bool started;
+};
@@ -0,0 +1,263 @@
+#include "DeviceConnection.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+const uint32_t CacheMagic = 0x43324E42; // "BN2C"
+const uint32_t CacheVersion = 1;
+
+// the profiles are written as they are in memory, a file of another build is not used
+struct CacheHeader {
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t ProfileSize;
+	uint32_t LastSerial;
+	uint32_t Count;
+};
+
+std::FILE* openFile(const std::string& path, const char* mode) {
+	std::FILE* file = nullptr;
+#ifdef _WIN32
+	if (fopen_s(&file, path.c_str(), mode) != 0) file = nullptr;
+#else
+	file = std::fopen(path.c_str(), mode);
+#endif
+	return file;
+}
+
+} // namespace
+
+DeviceCache::DeviceCache(const std::string& path) : path(path), last(0) {
+	if (path.empty()) {
+		return;
+	}
+	std::FILE* file = openFile(path, "rb");
+	if (!file) {
+		return;
+	}
+	CacheHeader header;
+	if (std::fread(&header, sizeof(header), 1, file) == 1 && header.Magic == CacheMagic
+		&& header.Version == CacheVersion && header.ProfileSize == sizeof(DeviceProfile) && header.Count <= 1024) {
+		profiles.resize(header.Count);
+		if (header.Count && std::fread(profiles.data(), sizeof(DeviceProfile), header.Count, file) != header.Count) {
+			profiles.clear();
+		}
+		else {
+			last = header.LastSerial;
+		}
+	}
+	std::fclose(file);
+}
+
+const DeviceProfile* DeviceCache::find(uint32_t serial) const {
+	for (const DeviceProfile& profile : profiles) {
+		if (profile.SerialNumber == serial) {
+			return &profile;
+		}
+	}
+	return nullptr;
+}
+
+void DeviceCache::store(const DeviceProfile& profile) {
+	bool changed = last != profile.SerialNumber;
+	last = profile.SerialNumber;
+	auto known = std::find_if(profiles.begin(), profiles.end(),
+		[&profile](const DeviceProfile& p) { return p.SerialNumber == profile.SerialNumber; });
+	if (known == profiles.end()) {
+		profiles.push_back(profile);
+		changed = true;
+	}
+	else if (std::memcmp(&*known, &profile, sizeof(profile)) != 0) {
+		*known = profile;
+		changed = true;
+	}
+	if (changed) {
+		save();
+	}
+}
+
+// from reopen() on the acquisition thread, connect() is not running then
+void DeviceCache::remove(uint32_t serial) {
+	const auto known = std::find_if(profiles.begin(), profiles.end(),
+		[serial](const DeviceProfile& p) { return p.SerialNumber == serial; });
+	if (known != profiles.end()) {
+		profiles.erase(known);
+		save();
+	}
+}
+
+// failures are ignored, the cache only saves time
+void DeviceCache::save() const {
+	if (path.empty()) {
+		return;
+	}
+	std::FILE* file = openFile(path, "wb");
+	if (!file) {
+		return;
+	}
+	const CacheHeader header = { CacheMagic, CacheVersion, uint32_t(sizeof(DeviceProfile)), last, uint32_t(profiles.size()) };
+	std::fwrite(&header, sizeof(header), 1, file);
+	std::fwrite(profiles.data(), sizeof(DeviceProfile), profiles.size(), file);
+	std::fclose(file);
+}
+
+DeviceConnection::DeviceConnection(DeviceCache& cache, const Settings& settings) :
+	cache(cache), sets(settings), current(), fromCache(false), changed(false), discovery(0), connecting(0) {
+	std::memset(&current, 0, sizeof(current));
+}
+
+// devices are not found immediately (up to a few seconds) and the count may vary from call to
+// call: the first polls are frequent, so a device found at once costs milliseconds, not 500
+uint32_t DeviceConnection::waitForDevices(std::chrono::milliseconds firstPoll, std::chrono::milliseconds maxPoll) {
+	std::chrono::milliseconds interval = firstPoll;
+	for (;;) {
+		const uint32_t count = nb2GetCount();
+		if (count > 0) {
+			return count;
+		}
+		std::this_thread::sleep_for(interval);
+		interval = std::min(maxPoll, interval * 2);
+	}
+}
+
+int DeviceConnection::find(uint32_t serial) const {
+	const uint32_t count = nb2GetCount();
+	int first = ErrFail;
+	for (uint32_t i = 0; i < count; ++i) {
+		const int id = nb2GetId(i);
+		if (id < 0) {
+			continue;
+		}
+		if (first < 0) {
+			first = id;
+		}
+		if (serial && nb2GetSerialNumber(id) == int(serial)) {
+			return id;
+		}
+	}
+	return serial ? int(ErrFail) : first;
+}
+
+Nb2Status DeviceConnection::connect() {
+	started = std::chrono::steady_clock::now();
+	waitForDevices(sets.FirstPoll, sets.MaxPoll);
+	discovery = std::chrono::steady_clock::now() - started;
+	// the last used device if it is there, otherwise the first one
+	int id = cache.lastSerial() ? find(cache.lastSerial()) : int(ErrFail);
+	if (id < 0) {
+		id = find(0);
+	}
+	Nb2Status status = id < 0 ? Nb2Status(id, "nb2GetId") : open(id);
+	if (status) {
+		status = loadProfile();
+	}
+	if (status) {
+		status = opened.start();
+	}
+	connecting = std::chrono::steady_clock::now() - started;
+	return status;
+}
+
+// the profile is not touched, the same device with the same settings has it; a device with
+// other firmware or calibration keeps running, only the next start queries it again
+int DeviceConnection::reopen() {
+	opened.close(); // errors of a dropped device do not matter
+	const int id = find(current.SerialNumber);
+	if (id < 0) {
+		return id;
+	}
+	Nb2Status status = open(id);
+	if (status) {
+		const Result<bool> same = sameDevice(current);
+		status = same.status();
+		if (same && !same.valueOr(true)) {
+			cache.remove(current.SerialNumber);
+			changed.store(true);
+		}
+	}
+	if (status) {
+		status = opened.start();
+	}
+	return status.ok() ? opened.id() : status.code();
+}
+
+Nb2Status DeviceConnection::open(int id) {
+	Result<Nb2Device> device = Nb2Device::open(id);
+	if (!device) {
+		return device.status();
+	}
+	opened = std::move(device).value();
+
+	// the device does not keep its settings over a reconnect, they are always set
+	t_nb2DataSettings dataSettings = sets.DataSettings;
+	int ret = nb2SetDataSettings(id, &dataSettings);
+	if (ret < 0) return Nb2Status(ret, "nb2SetDataSettings");
+	t_nb2EventSettings eventSettings = sets.EventSettings;
+	ret = nb2SetEventSettings(id, &eventSettings);
+	if (ret < 0) return Nb2Status(ret, "nb2SetEventSettings");
+	t_nb2Mode mode;
+	mode.Mode = sets.Mode;
+	ret = nb2SetMode(id, &mode);
+	if (ret < 0) return Nb2Status(ret, "nb2SetMode");
+	return Nb2Status();
+}
+
+// the profile of a known device is not queried again, the property only if it was read
+// with other data settings
+Nb2Status DeviceConnection::loadProfile() {
+	const int id = opened.id();
+	const int serial = nb2GetSerialNumber(id);
+	if (serial < 0) {
+		return Nb2Status(serial, "nb2GetSerialNumber");
+	}
+	const DeviceProfile* known = cache.find(uint32_t(serial));
+	if (known) {
+		const Result<bool> same = sameDevice(*known);
+		if (!same) return same.status();
+		if (!same.valueOr(false)) known = nullptr; // queried again and replaced
+	}
+	fromCache = known != nullptr;
+	if (known) {
+		current = *known;
+	}
+	else {
+		std::memset(&current, 0, sizeof(current));
+		current.SerialNumber = uint32_t(serial);
+		int ret = nb2GetVersion(id, &current.Version);
+		if (ret < 0) return Nb2Status(ret, "nb2GetVersion");
+		ret = nb2GetInformation(id, &current.Information);
+		if (ret < 0) return Nb2Status(ret, "nb2GetInformation");
+		ret = nb2GetPossibility(id, &current.Possibility);
+		if (ret < 0) return Nb2Status(ret, "nb2GetPossibility");
+		ret = nb2GetCalibrated(id, &current.Calibrated);
+		if (ret < 0) return Nb2Status(ret, "nb2GetCalibrated");
+		if (current.Calibrated) {
+			ret = nb2GetCalibration(id, &current.Calibration);
+			if (ret < 0) return Nb2Status(ret, "nb2GetCalibration");
+		}
+	}
+	if (!known || known->DataRate != sets.DataSettings.DataRate || known->InputRange != sets.DataSettings.InputRange) {
+		const int ret = nb2GetProperty(id, &current.Property);
+		if (ret < 0) return Nb2Status(ret, "nb2GetProperty");
+		current.DataRate = sets.DataSettings.DataRate;
+		current.InputRange = sets.DataSettings.InputRange;
+	}
+	cache.store(current);
+	return Nb2Status();
+}
+
+// the dll version changes with an update of the host and the firmware one with an update of
+// the device, both may change what it reports; a calibration sets the calibrated state
+Result<bool> DeviceConnection::sameDevice(const DeviceProfile& profile) const {
+	const int id = opened.id();
+	t_nb2Version version;
+	int ret = nb2GetVersion(id, &version);
+	if (ret < 0) return Nb2Status(ret, "nb2GetVersion");
+	bool calibrated = false;
+	ret = nb2GetCalibrated(id, &calibrated);
+	if (ret < 0) return Nb2Status(ret, "nb2GetCalibrated");
+	return version.Dll == profile.Version.Dll && version.Firmware == profile.Version.Firmware && calibrated == profile.Calibrated;
+}
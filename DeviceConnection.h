@@ -0,0 +1,114 @@
+#pragma once
+#include "Nb2Device.h"
+#include <nb2mcs/nb2mcs.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// what the host has to know about a device besides its data, queried once per device; it holds
+// while the versions and the calibrated state of the device are the same, these are checked
+// at every open
+struct DeviceProfile {
+	uint32_t SerialNumber;
+	t_nb2Version Version;
+	t_nb2Information Information;
+	t_nb2Possibility Possibility;
+	bool Calibrated;
+	t_nb2Calibration Calibration; // of both input ranges, if Calibrated
+	uint8_t DataRate;   // of the data settings Property was read with
+	uint8_t InputRange;
+	t_nb2Property Property;
+};
+
+// profiles of the devices used before and the serial number of the last one, kept in a file
+// so the next start opens the same device and does not query what does not change
+class DeviceCache {
+public:
+	// an empty path keeps the profiles in memory only, a missing or foreign file is an empty cache
+	explicit DeviceCache(const std::string& path = std::string());
+
+	const DeviceProfile* find(uint32_t serial) const;
+	// the profile becomes the last used one, the file is written if anything changed
+	void store(const DeviceProfile& profile);
+	// the profile of a device that is not what it was, the file is written if there was one
+	void remove(uint32_t serial);
+	uint32_t lastSerial() const { return last; }
+
+private:
+	void save() const;
+
+	const std::string path;
+	uint32_t last;
+	std::vector<DeviceProfile> profiles;
+};
+
+// one device from discovery to close: nb2GetCount is polled from FirstPoll with the interval
+// doubled up to MaxPoll, the last used device is taken if it is among the found ones, the
+// profile comes from the cache when it is there, then the device is configured and started.
+// After a link drop reopen() finds the same device by serial number, configures and starts it again
+class DeviceConnection {
+public:
+	struct Settings {
+		Settings() : Mode(Nb2Mode::Data), FirstPoll(10), MaxPoll(500) {
+			DataSettings.DataRate = Hz125;
+			DataSettings.InputRange = Mv150;
+			DataSettings.EnabledChannels = 0x001FFFFF;
+			EventSettings.ActivityThreshold = 1; // accelerometer sensitivity, from 0 to 2
+			EventSettings.EnabledEvents = 0x003F; // all event types
+		}
+		t_nb2DataSettings DataSettings;
+		t_nb2EventSettings EventSettings;
+		uint8_t Mode; // Nb2Mode
+		std::chrono::milliseconds FirstPoll; // discovery poll interval
+		std::chrono::milliseconds MaxPoll;
+	};
+
+	DeviceConnection(DeviceCache& cache, const Settings& settings = Settings());
+
+	// waits for a device as long as it takes, opens, configures and starts it
+	Nb2Status connect();
+	// after a link drop, from the acquisition thread while nothing else uses the device:
+	// one attempt to close, find, open, configure and start it again; returns its new id or
+	// an nb2 error code, ErrFail if it is not found now. The profile is left as connect() made
+	// it, so other threads may keep reading profile(); if the versions or the calibrated state
+	// of the device changed meanwhile, its cache entry is removed and profileChanged() is set
+	int reopen();
+
+	// polls nb2GetCount with backoff until there are devices, returns their number
+	static uint32_t waitForDevices(std::chrono::milliseconds firstPoll, std::chrono::milliseconds maxPoll);
+
+	Nb2Device& device() { return opened; }
+	int id() const { return opened.id(); }
+	// written by connect() only
+	const DeviceProfile& profile() const { return current; }
+	// the profile came from the cache, only the property was queried if the data settings differ
+	bool cached() const { return fromCache; }
+	// a reopened device is not the one of profile(), a new connect() queries it again
+	bool profileChanged() const { return changed.load(); }
+	std::chrono::steady_clock::time_point connectStart() const { return started; }
+	// of the last connect: nb2GetCount polls and from the start to nb2Start returned
+	std::chrono::nanoseconds discoveryTime() const { return discovery; }
+	std::chrono::nanoseconds connectTime() const { return connecting; }
+
+private:
+	// id of the found device with the serial number, or of the first one for serial 0
+	int find(uint32_t serial) const;
+	// opens and configures the device, not started
+	Nb2Status open(int id);
+	// current of the opened device from the cache or queried, stored in the cache
+	Nb2Status loadProfile();
+	// the opened device has the versions and the calibrated state of the profile
+	Result<bool> sameDevice(const DeviceProfile& profile) const;
+
+	DeviceCache& cache;
+	const Settings sets;
+	Nb2Device opened;
+	DeviceProfile current;
+	bool fromCache;
+	std::atomic<bool> changed;
+	std::chrono::steady_clock::time_point started;
+	std::chrono::nanoseconds discovery;
+	std::chrono::nanoseconds connecting;
+};
@@ -0,0 +1,275 @@
+#include "EegCodec.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const uint32_t Magic = 0x315A424E; // "NBZ1"
+const size_t HeaderSize = 20;
+const size_t Padding = 8; // zero bytes after the data, the decoder reads 8 bytes at once
+const uint8_t LinearFlag = 0x80;
+const uint8_t WidthMask = 0x3F;
+
+void put32(std::vector<uint8_t>& out, uint32_t value) {
+	for (int i = 0; i < 4; ++i) out.push_back(uint8_t(value >> (8 * i)));
+}
+
+void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+	while (value >= 0x80) {
+		out.push_back(uint8_t(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(uint8_t(value));
+}
+
+uint32_t get32(const uint8_t* p) {
+	return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint64_t getVarint(const uint8_t*& p, const uint8_t* end) {
+	uint64_t value = 0;
+	for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+		const uint8_t byte = *p++;
+		value |= uint64_t(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) return value;
+	}
+	throw std::runtime_error("Corrupt EEG block: bad varint");
+}
+
+uint64_t zigzag(int64_t value) {
+	return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+	return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+unsigned bitWidth(uint64_t value) {
+	unsigned width = 0;
+	while (value) {
+		++width;
+		value >>= 1;
+	}
+	return width;
+}
+
+} // namespace
+
+size_t EegCodec::encode(const int32_t* data, size_t sampleCount, size_t sampleSize, std::vector<uint8_t>& out) {
+	if (sampleSize == 0 || sampleSize > 0xFFFF || sampleCount > 0xFFFFFFFFu) {
+		throw std::runtime_error("EEG block is too large");
+	}
+	const size_t start = out.size();
+	const size_t counter = sampleSize - 1;
+	put32(out, Magic);
+	put32(out, 0); // block size, written at the end
+	put32(out, uint32_t(sampleCount));
+	out.push_back(uint8_t(sampleSize));
+	out.push_back(uint8_t(sampleSize >> 8));
+	out.push_back(0);
+	out.push_back(0);
+	put32(out, sampleCount ? uint32_t(data[counter]) : 0);
+
+	// counter: rows where it is not the previous one plus 1
+	size_t exceptions = 0;
+	for (size_t i = 1; i < sampleCount; ++i) {
+		exceptions += uint32_t(data[i * sampleSize + counter]) != uint32_t(data[(i - 1) * sampleSize + counter]) + 1;
+	}
+	putVarint(out, exceptions);
+	for (size_t i = 1, last = 0; i < sampleCount; ++i) {
+		const uint32_t value = uint32_t(data[i * sampleSize + counter]);
+		if (value != uint32_t(data[(i - 1) * sampleSize + counter]) + 1) {
+			putVarint(out, i - last);
+			put32(out, value);
+			last = i;
+		}
+	}
+
+	delta.resize(GroupSize);
+	linear.resize(GroupSize);
+	for (size_t w = 0; w < counter && sampleCount; ++w) {
+		put32(out, uint32_t(data[w]));
+		for (size_t group = 1; group < sampleCount; group += GroupSize) {
+			const size_t count = std::min<size_t>(GroupSize, sampleCount - group);
+			uint64_t deltaMax = 0, linearMax = 0;
+			for (size_t j = 0; j < count; ++j) {
+				const size_t i = group + j;
+				const int64_t x = data[i * sampleSize + w];
+				const int64_t x1 = data[(i - 1) * sampleSize + w];
+				const int64_t x2 = i > 1 ? data[(i - 2) * sampleSize + w] : x1;
+				delta[j] = zigzag(x - x1);
+				linear[j] = zigzag(x - 2 * x1 + x2);
+				deltaMax |= delta[j];
+				linearMax |= linear[j];
+			}
+			const unsigned deltaWidth = bitWidth(deltaMax), linearWidth = bitWidth(linearMax);
+			const bool useLinear = linearWidth < deltaWidth;
+			const unsigned width = useLinear ? linearWidth : deltaWidth;
+			const std::vector<uint64_t>& residuals = useLinear ? linear : delta;
+			out.push_back(uint8_t(width | (useLinear ? LinearFlag : 0)));
+
+			// LSB first, every group starts at a byte boundary
+			uint64_t bits = 0;
+			unsigned used = 0;
+			for (size_t j = 0; j < count && width; ++j) {
+				bits |= residuals[j] << used;
+				used += width;
+				while (used >= 8) {
+					out.push_back(uint8_t(bits));
+					bits >>= 8;
+					used -= 8;
+				}
+			}
+			if (used) {
+				out.push_back(uint8_t(bits));
+			}
+		}
+	}
+	out.insert(out.end(), Padding, 0);
+
+	const size_t bytes = out.size() - start;
+	for (int i = 0; i < 4; ++i) out[start + 4 + i] = uint8_t(uint32_t(bytes) >> (8 * i));
+	return bytes;
+}
+
+bool EegCodec::peek(const uint8_t* block, size_t size, BlockInfo& info) {
+	if (size < HeaderSize || get32(block) != Magic) {
+		return false;
+	}
+	info.Bytes = get32(block + 4);
+	info.SampleCount = get32(block + 8);
+	info.SampleSize = uint32_t(block[12]) | uint32_t(block[13]) << 8;
+	return info.Bytes <= size && info.Bytes >= HeaderSize + Padding && info.SampleSize > 0;
+}
+
+size_t EegCodec::decode(const uint8_t* block, size_t size, int32_t* data, size_t sampleSize, size_t maxSamples) {
+	BlockInfo info;
+	if (!peek(block, size, info)) {
+		throw std::runtime_error("Corrupt EEG block: bad header");
+	}
+	if (info.SampleSize != sampleSize) {
+		throw std::runtime_error("EEG block sample size " + std::to_string(info.SampleSize)
+			+ " does not match " + std::to_string(sampleSize));
+	}
+	if (info.SampleCount > maxSamples) {
+		throw std::runtime_error("EEG block does not fit into the buffer");
+	}
+	const size_t sampleCount = info.SampleCount;
+	const size_t counter = sampleSize - 1;
+	const uint8_t* p = block + HeaderSize;
+	const uint8_t* end = block + info.Bytes - Padding;
+
+	// counter column
+	uint64_t exceptions = getVarint(p, end);
+	size_t next = sampleCount;
+	if (exceptions) {
+		next = size_t(getVarint(p, end));
+	}
+	uint32_t value = get32(block + 16);
+	for (size_t i = 0; i < sampleCount; ++i, ++value) {
+		if (i == next && i > 0) {
+			if (p + 4 > end) throw std::runtime_error("Corrupt EEG block: counter");
+			value = get32(p);
+			p += 4;
+			next = --exceptions ? next + size_t(getVarint(p, end)) : sampleCount;
+		}
+		data[i * sampleSize + counter] = int32_t(value);
+	}
+
+	for (size_t w = 0; w < counter && sampleCount; ++w) {
+		if (p + 4 > end) throw std::runtime_error("Corrupt EEG block: column");
+		int64_t x1 = int32_t(get32(p)), x2 = x1;
+		p += 4;
+		data[w] = int32_t(x1);
+		int32_t* row = data + sampleSize + w;
+		for (size_t group = 1; group < sampleCount; group += GroupSize) {
+			const size_t count = std::min<size_t>(GroupSize, sampleCount - group);
+			if (p >= end) throw std::runtime_error("Corrupt EEG block: group");
+			const uint8_t header = *p++;
+			const unsigned width = header & WidthMask;
+			const size_t bytes = (width * count + 7) / 8;
+			if (width > 35 || p + bytes > end) throw std::runtime_error("Corrupt EEG block: group");
+			const uint64_t mask = (uint64_t(1) << width) - 1;
+			size_t bit = 0;
+			if (header & LinearFlag) {
+				for (size_t j = 0; j < count; ++j, bit += width, row += sampleSize) {
+					uint64_t bits;
+					std::memcpy(&bits, p + (bit >> 3), sizeof(bits)); // little-endian hosts
+					const int64_t x = 2 * x1 - x2 + unzigzag((bits >> (bit & 7)) & mask);
+					*row = int32_t(x);
+					x2 = x1;
+					x1 = x;
+				}
+			}
+			else {
+				for (size_t j = 0; j < count; ++j, bit += width, row += sampleSize) {
+					uint64_t bits;
+					std::memcpy(&bits, p + (bit >> 3), sizeof(bits));
+					const int64_t x = x1 + unzigzag((bits >> (bit & 7)) & mask);
+					*row = int32_t(x);
+					x2 = x1;
+					x1 = x;
+				}
+			}
+			p += bytes;
+		}
+	}
+	return info.Bytes;
+}
+
+EegArchiveWriter::EegArchiveWriter(const std::string& path, size_t sampleSize, size_t blockSamples) :
+	sampleSize(sampleSize), blockSamples(std::max<size_t>(1, blockSamples)),
+	file(path, std::ios::binary | std::ios::trunc),
+	pending(this->blockSamples * sampleSize), pendingSamples(0), raw(0), encoded(0) {
+	if (!file) {
+		throw std::runtime_error("Cannot create file: " + path);
+	}
+}
+
+EegArchiveWriter::~EegArchiveWriter() {
+	try {
+		close();
+	}
+	catch (const std::exception&) {
+	}
+}
+
+void EegArchiveWriter::write(const int32_t* data, size_t sampleCount) {
+	while (sampleCount) {
+		const size_t count = std::min(sampleCount, blockSamples - pendingSamples);
+		std::memcpy(&pending[pendingSamples * sampleSize], data, count * sampleSize * sizeof(int32_t));
+		pendingSamples += count;
+		data += count * sampleSize;
+		sampleCount -= count;
+		if (pendingSamples == blockSamples) {
+			flush();
+		}
+	}
+}
+
+void EegArchiveWriter::close() {
+	if (!file.is_open()) {
+		return;
+	}
+	flush();
+	file.close();
+	if (file.fail()) {
+		throw std::runtime_error("EEG archive write error");
+	}
+}
+
+void EegArchiveWriter::flush() {
+	if (!pendingSamples) {
+		return;
+	}
+	block.clear();
+	codec.encode(pending.data(), pendingSamples, sampleSize, block);
+	file.write(reinterpret_cast<const char*>(block.data()), std::streamsize(block.size()));
+	if (!file) {
+		throw std::runtime_error("EEG archive write error");
+	}
+	raw += pendingSamples * sampleSize * sizeof(int32_t);
+	encoded += block.size();
+	pendingSamples = 0;
+}
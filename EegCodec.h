@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// lossless codec of blocks of nb2GetData sample rows for files and transport between processes;
+// a block is self-contained: header, counter column as implied increments with a list of
+// exceptions (gaps, resets), every other column as residuals of the previous value (delta)
+// or of the linear extrapolation of the two previous values, chosen for each group of
+// 32 samples, zigzag coded and bit-packed with the width of the largest residual of the group
+class EegCodec {
+public:
+	enum { GroupSize = 32 };
+
+	struct BlockInfo {
+		uint32_t SampleCount;
+		uint32_t SampleSize;
+		size_t Bytes; // whole block
+	};
+
+	// appends the block of sampleCount rows of sampleSize words (counter last) to out, returns its size
+	size_t encode(const int32_t* data, size_t sampleCount, size_t sampleSize, std::vector<uint8_t>& out);
+	// block header of the data, false if there is not a whole block
+	static bool peek(const uint8_t* block, size_t size, BlockInfo& info);
+	// decodes one block into rows of sampleSize words, returns the bytes of the block; throws
+	// std::runtime_error if the data is not a valid block, its rows are not of sampleSize words
+	// or do not fit into maxSamples
+	size_t decode(const uint8_t* block, size_t size, int32_t* data, size_t sampleSize, size_t maxSamples);
+
+private:
+	std::vector<uint64_t> delta; // zigzag residuals of a group
+	std::vector<uint64_t> linear;
+};
+
+// archive file: the sequence of blocks of blockSamples rows each, the last one may be shorter;
+// rows are collected and encoded on the calling thread, a block is about 1/4 of the raw size
+class EegArchiveWriter {
+public:
+	EegArchiveWriter(const std::string& path, size_t sampleSize, size_t blockSamples);
+	~EegArchiveWriter();
+	EegArchiveWriter(const EegArchiveWriter&) = delete;
+	EegArchiveWriter& operator=(const EegArchiveWriter&) = delete;
+
+	// sample rows of sampleSize words, counter is the last word
+	void write(const int32_t* data, size_t sampleCount);
+	// encodes the incomplete block and closes the file
+	void close();
+
+	uint64_t rawBytes() const { return raw; }
+	uint64_t encodedBytes() const { return encoded; }
+
+private:
+	void flush();
+
+	const size_t sampleSize;
+	const size_t blockSamples;
+	EegCodec codec;
+	std::ofstream file;
+	std::vector<int32_t> pending;
+	size_t pendingSamples;
+	std::vector<uint8_t> block;
+	uint64_t raw;
+	uint64_t encoded;
+};
@@ -0,0 +1,155 @@
+#include "EnvelopePyramid.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// whole entries of level 1, so that an entry is contiguous in the ring
+size_t ringSize(size_t samples, size_t factor) {
+	return factor < 2 ? 0 : std::max(samples + factor - 1, 2 * factor) / factor * factor;
+}
+
+}
+
+EnvelopePyramid::EnvelopePyramid(size_t channelsCount, size_t factor, size_t recentSamples) :
+	channelsCount(channelsCount), levelFactor(factor), recentCapacity(ringSize(recentSamples, factor)),
+	samples(channelsCount), count(0), levelsCount(0) {
+	if (factor < 2) {
+		throw std::runtime_error("Envelope factor must be 2 or more");
+	}
+	for (auto& channel : samples) {
+		channel.resize(recentCapacity);
+	}
+	for (Level& level : pyramid) {
+		level.Min.resize(channelsCount);
+		level.Max.resize(channelsCount);
+	}
+}
+
+void EnvelopePyramid::reset() {
+	count = 0;
+	for (Level& level : pyramid) {
+		for (auto& channel : level.Min) channel.clear();
+		for (auto& channel : level.Max) channel.clear();
+	}
+	levelsCount = 0;
+}
+
+// in parts that leave the samples of the last incomplete entry in the ring for rollUp
+void EnvelopePyramid::push(const float* data, size_t sampleCount, size_t planeStride) {
+	for (size_t done = 0; done < sampleCount;) {
+		const size_t part = std::min(sampleCount - done, recentCapacity - levelFactor);
+		const size_t start = count % recentCapacity;
+		const size_t first = std::min(part, recentCapacity - start);
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			const float* in = data + ch * planeStride + done;
+			std::copy(in, in + first, samples[ch].begin() + start);
+			std::copy(in + first, in + part, samples[ch].begin());
+		}
+		count += part;
+		done += part;
+		rollUp();
+	}
+}
+
+// adds the entries completed by the new samples, level by level
+void EnvelopePyramid::rollUp() {
+	const size_t factor = levelFactor;
+	for (size_t l = 0; l < MaxLevels; ++l) {
+		const size_t below = l == 0 ? size() : pyramid[l - 1].Min[0].size();
+		const size_t done = channelsCount ? pyramid[l].Min[0].size() : 0;
+		const size_t complete = below / factor;
+		if (complete == done) {
+			break;
+		}
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			std::vector<float>& mins = pyramid[l].Min[ch];
+			std::vector<float>& maxs = pyramid[l].Max[ch];
+			for (size_t e = done; e < complete; ++e) {
+				const float* lo = l == 0 ? recentAt(ch, e * factor) : pyramid[l - 1].Min[ch].data() + e * factor;
+				const float* hi = l == 0 ? lo : pyramid[l - 1].Max[ch].data() + e * factor;
+				float mn = lo[0], mx = hi[0];
+				for (size_t k = 1; k < factor; ++k) {
+					mn = std::min(mn, lo[k]);
+					mx = std::max(mx, hi[k]);
+				}
+				mins.push_back(mn);
+				maxs.push_back(mx);
+			}
+		}
+		levelsCount = std::max(levelsCount, l + 1);
+	}
+}
+
+bool EnvelopePyramid::envelope(size_t channel, size_t begin, size_t end, float& minimum, float& maximum) const {
+	end = std::min(end, size());
+	if (begin >= end) {
+		return false;
+	}
+	// edges older than the ring to the level 1 entries around them, these are complete
+	const size_t oldest = recent();
+	if (begin < oldest) {
+		begin -= begin % levelFactor;
+	}
+	if (end % levelFactor != 0 && end - end % levelFactor < oldest) {
+		end += levelFactor - end % levelFactor;
+	}
+	float mn = std::numeric_limits<float>::max(), mx = std::numeric_limits<float>::lowest();
+	const auto fold = [&mn, &mx](const float* mins, const float* maxs, size_t from, size_t to) {
+		for (size_t i = from; i < to; ++i) {
+			mn = std::min(mn, mins[i]);
+			mx = std::max(mx, maxs[i]);
+		}
+	};
+	// samples from the ring, in two parts when the range wraps
+	const auto foldRecent = [this, channel, &fold](size_t from, size_t to) {
+		if (from >= to) {
+			return;
+		}
+		const size_t start = from % recentCapacity;
+		const size_t first = std::min(to - from, recentCapacity - start);
+		const float* ring = samples[channel].data();
+		fold(ring, ring, start, start + first);
+		fold(ring, ring, 0, to - from - first);
+	};
+	// lo and hi are in entries of the current level, samples at level 0
+	size_t lo = begin, hi = end;
+	for (size_t l = 0; lo < hi; ++l) {
+		const float* mins = l == 0 ? nullptr : pyramid[l - 1].Min[channel].data();
+		const float* maxs = l == 0 ? nullptr : pyramid[l - 1].Max[channel].data();
+		const size_t upLo = (lo + levelFactor - 1) / levelFactor;
+		const size_t upHi = l < levelsCount ? std::min(hi / levelFactor, pyramid[l].Min[channel].size()) : 0;
+		if (upLo >= upHi) {
+			if (l == 0) foldRecent(lo, hi); else fold(mins, maxs, lo, hi);
+			break;
+		}
+		// edges at this level, the middle from the level above
+		if (l == 0) {
+			foldRecent(lo, upLo * levelFactor);
+			foldRecent(upHi * levelFactor, hi);
+		} else {
+			fold(mins, maxs, lo, upLo * levelFactor);
+			fold(mins, maxs, upHi * levelFactor, hi);
+		}
+		lo = upLo;
+		hi = upHi;
+	}
+	minimum = mn;
+	maximum = mx;
+	return true;
+}
+
+size_t EnvelopePyramid::render(size_t channel, size_t begin, size_t end, size_t pixels, float* minimum, float* maximum) const {
+	end = std::min(end, size());
+	if (begin >= end) {
+		return 0;
+	}
+	const size_t length = end - begin;
+	for (size_t p = 0; p < pixels; ++p) {
+		const size_t from = begin + size_t(uint64_t(length) * p / pixels);
+		const size_t to = std::max(from + 1, begin + size_t(uint64_t(length) * (p + 1) / pixels));
+		envelope(channel, from, to, minimum[p], maximum[p]);
+	}
+	return pixels;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// min/max envelope pyramid of a whole session for drawing it at any zoom: only the recent
+// samples of every channel are kept in a ring, level 1 has the min and max of every Factor
+// samples, level 2 of every Factor level 1 entries and so on; an append rolls up only the
+// entries it completes, so it is O(1) amortized per sample. The envelope of any sample range
+// is folded from the coarsest entries inside it and finer ones at its edges only, at most
+// 2 * Factor entries per level, so a row of pixels costs about pixels * Factor * levels
+// whatever the range is. An edge older than the ring is widened to its level 1 entry, so
+// older data is drawn at a resolution of Factor samples (the recording has the samples)
+class EnvelopePyramid {
+public:
+	enum { MaxLevels = 8 };
+
+	// recentSamples is rounded up to a multiple of factor, at least 2 * factor
+	EnvelopePyramid(size_t channelsCount, size_t factor = 16, size_t recentSamples = 1 << 16);
+
+	// sampleCount values of every channel, channel ch at data + ch * planeStride
+	void push(const float* data, size_t sampleCount, size_t planeStride);
+	void reset();
+
+	size_t channels() const { return channelsCount; }
+	size_t factor() const { return levelFactor; }
+	// samples pushed, positions of the queries are 0 to size() - 1
+	size_t size() const { return count; }
+	// first position that still has its samples, the ranges before it are widened to Factor samples
+	size_t recent() const { return count > recentCapacity ? count - recentCapacity : 0; }
+	// levels above the samples that have entries
+	size_t levels() const { return levelsCount; }
+	// min and max of the samples from begin to end - 1 of a channel, exact from recent() on,
+	// false for an empty range
+	bool envelope(size_t channel, size_t begin, size_t end, float& minimum, float& maximum) const;
+	// envelope of pixels equal parts of the samples from begin to end - 1, a part shorter than
+	// one sample gets its nearest sample; returns the number of pixels written
+	size_t render(size_t channel, size_t begin, size_t end, size_t pixels, float* minimum, float* maximum) const;
+
+private:
+	struct Level {
+		std::vector<std::vector<float>> Min; // [channel][entry]
+		std::vector<std::vector<float>> Max;
+	};
+
+	void rollUp();
+	const float* recentAt(size_t channel, size_t position) const {
+		return samples[channel].data() + position % recentCapacity;
+	}
+
+	const size_t channelsCount;
+	const size_t levelFactor;
+	const size_t recentCapacity;
+	std::vector<std::vector<float>> samples; // [channel][sample % recentCapacity]
+	size_t count;
+	Level pyramid[MaxLevels];
+	size_t levelsCount;
+};
@@ -0,0 +1,136 @@
+#include "EpochAverager.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+size_t powerOfTwo(size_t value) {
+	size_t result = 1;
+	while (result < value) result *= 2;
+	return result;
+}
+
+} // namespace
+
+EpochAverager::EpochAverager(size_t channelsCount, float rate, const Settings& settings) :
+	channelsCount(channelsCount),
+	preLength(size_t(std::lround(settings.PreSeconds * rate))),
+	epochLength(preLength + std::max<size_t>(1, size_t(std::lround(settings.PostSeconds * rate)))),
+	historyLength(powerOfTwo(std::max(epochLength, size_t(settings.HistorySeconds * rate)))),
+	baseline(settings.Baseline && preLength > 0),
+	history(channelsCount * historyLength),
+	slotCounters(historyLength),
+	last(channelsCount * epochLength),
+	means(TypesCount * channelsCount * epochLength) {
+	reset();
+}
+
+void EpochAverager::reset() {
+	newest = 0;
+	started = false;
+	for (size_t slot = 0; slot < historyLength; ++slot) {
+		slotCounters[slot] = uint32_t(slot + 1); // no sample, does not match the slot
+	}
+	pending.clear();
+	std::fill(means.begin(), means.end(), 0.f);
+	std::fill(counts, counts + TypesCount, 0);
+	expiredCount = 0;
+	incompleteCount = 0;
+	rejectedCount = 0;
+}
+
+size_t EpochAverager::push(const float* data, const uint32_t* counters, size_t sampleCount, size_t planeStride, const Emit& emit) {
+	const size_t mask = historyLength - 1;
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		float* samples = &history[ch * historyLength];
+		const float* in = data + ch * planeStride;
+		for (size_t n = 0; n < sampleCount; ++n) {
+			samples[counters[n] & mask] = in[n];
+		}
+	}
+	for (size_t n = 0; n < sampleCount; ++n) {
+		slotCounters[counters[n] & mask] = counters[n];
+	}
+	if (sampleCount) {
+		newest = counters[sampleCount - 1];
+		started = true;
+	}
+	return complete(emit);
+}
+
+size_t EpochAverager::addEvent(const t_nb2Event& event, const Emit& emit) {
+	if (event.Type >= TypesCount) {
+		return 0;
+	}
+	pending.push_back(event);
+	return complete(emit);
+}
+
+// cuts the epochs whose last sample has come, counters are compared modulo 2^32
+size_t EpochAverager::complete(const Emit& emit) {
+	if (!started) {
+		return 0;
+	}
+	size_t completed = 0;
+	for (size_t i = 0; i < pending.size();) {
+		const t_nb2Event event = pending[i];
+		const uint32_t start = event.Counter - uint32_t(preLength);
+		const uint32_t end = start + uint32_t(epochLength) - 1;
+		const int32_t ahead = int32_t(end - newest);
+		if (ahead > 0 && uint32_t(ahead) <= historyLength) {
+			++i; // waits for the post-stimulus samples
+			continue;
+		}
+		pending.erase(pending.begin() + std::ptrdiff_t(i));
+		if (ahead > 0 || newest - start >= historyLength) {
+			++expiredCount; // overwritten, or a counter from before a reset
+			continue;
+		}
+		if (badChannels && badChannels(start, epochLength)) {
+			++rejectedCount;
+			continue;
+		}
+		if (!cut(start)) {
+			++incompleteCount;
+			continue;
+		}
+
+		// running mean: m += (x - m) / n
+		const uint64_t n = ++counts[event.Type];
+		const float weight = 1.f / float(n);
+		float* mean = &means[event.Type * channelsCount * epochLength];
+		for (size_t k = 0; k < channelsCount * epochLength; ++k) {
+			mean[k] += (last[k] - mean[k]) * weight;
+		}
+		++completed;
+		if (emit) {
+			emit(*this, event);
+		}
+	}
+	return completed;
+}
+
+// copies the epoch into last, false if any of its samples is missing
+bool EpochAverager::cut(uint32_t start) {
+	const size_t mask = historyLength - 1;
+	for (size_t k = 0; k < epochLength; ++k) {
+		if (slotCounters[(start + k) & mask] != start + uint32_t(k)) {
+			return false;
+		}
+	}
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		const float* samples = &history[ch * historyLength];
+		float* out = &last[ch * epochLength];
+		const size_t first = start & mask;
+		const size_t count = std::min(epochLength, historyLength - first);
+		std::copy(samples + first, samples + first + count, out);
+		std::copy(samples, samples + (epochLength - count), out + count);
+		if (baseline) {
+			double sum = 0.;
+			for (size_t k = 0; k < preLength; ++k) sum += out[k];
+			const float mean = float(sum / double(preLength));
+			for (size_t k = 0; k < epochLength; ++k) out[k] -= mean;
+		}
+	}
+	return true;
+}
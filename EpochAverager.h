@@ -0,0 +1,77 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// event-locked epochs and running ERP averages: the last HistorySeconds of every channel are
+// kept in a ring indexed by the sample counter, an event cuts the epoch from PreSeconds before
+// its counter to PostSeconds after it, at once or, while the post-stimulus samples have not come,
+// as soon as they do; a complete epoch is baseline corrected by its pre-stimulus mean and added
+// to the running mean of its event type, so an average over any number of trials is updated in
+// one pass over the new epoch and old data is never read again
+class EpochAverager {
+public:
+	enum { TypesCount = EvCharge + 1 };
+
+	struct Settings {
+		Settings() : PreSeconds(0.2f), PostSeconds(0.8f), HistorySeconds(10.f), Baseline(true) {}
+		float PreSeconds;     // before the event sample
+		float PostSeconds;    // from the event sample on
+		float HistorySeconds; // how late an event may come after its samples
+		bool Baseline;        // subtract the pre-stimulus mean of every channel
+	};
+
+	typedef std::function<void(const EpochAverager&, const t_nb2Event&)> Emit;
+	// bad channels of the samples from firstCounter on, e.g. ArtifactDetector::flags
+	typedef std::function<uint32_t(uint32_t firstCounter, size_t sampleCount)> Mask;
+
+	EpochAverager(size_t channelsCount, float rate, const Settings& settings = Settings());
+
+	// sampleCount values of every channel, channel ch at data + ch * planeStride (microvolts), and
+	// their counters; emit is called after every epoch completed, returns the number of them
+	size_t push(const float* data, const uint32_t* counters, size_t sampleCount, size_t planeStride, const Emit& emit = nullptr);
+	// events of other types than Nb2EventType are ignored
+	size_t addEvent(const t_nb2Event& event, const Emit& emit = nullptr);
+	void reset();
+	// epochs with any bad channel are rejected, not averaged
+	void setMask(const Mask& mask) { badChannels = mask; }
+
+	size_t channels() const { return channelsCount; }
+	size_t epochSize() const { return epochLength; }
+	// samples before the event sample in an epoch
+	size_t preSamples() const { return preLength; }
+	// the last epoch cut, epochSize() values of a channel
+	const float* epoch(size_t channel) const { return &last[channel * epochLength]; }
+	// trials and their average of an event type, epochSize() values of a channel
+	uint64_t trials(size_t type) const { return counts[type]; }
+	const float* average(size_t type, size_t channel) const { return &means[(type * channelsCount + channel) * epochLength]; }
+	// events whose samples had left the history, or had gaps
+	uint64_t expired() const { return expiredCount; }
+	uint64_t incomplete() const { return incompleteCount; }
+	// epochs rejected by the mask
+	uint64_t rejected() const { return rejectedCount; }
+
+private:
+	size_t complete(const Emit& emit);
+	bool cut(uint32_t start);
+
+	const size_t channelsCount;
+	const size_t preLength;
+	const size_t epochLength;
+	const size_t historyLength; // power of two
+	const bool baseline;
+	std::vector<float> history;      // [channel][historyLength], slot of counter & (historyLength - 1)
+	std::vector<uint32_t> slotCounters; // counter of the sample in every slot
+	uint32_t newest;
+	bool started;
+	std::vector<t_nb2Event> pending; // events waiting for their samples
+	Mask badChannels;
+	std::vector<float> last;  // [channel][epochLength]
+	std::vector<float> means; // [type][channel][epochLength]
+	uint64_t counts[TypesCount];
+	uint64_t expiredCount;
+	uint64_t incompleteCount;
+	uint64_t rejectedCount;
+};
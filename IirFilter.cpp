@@ -0,0 +1,138 @@
+#include "IirFilter.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+const double Pi = 3.14159265358979323846;
+const size_t SimdWidth = 8; // channels are padded to a whole number of AVX registers
+const double NotchQ = 30.;
+
+enum BiquadType { LowPass, HighPass, Notch };
+
+// RBJ audio EQ cookbook sections, bilinear transform with prewarping
+template <typename Biquad>
+Biquad design(BiquadType type, double frequency, double rate, double q) {
+	const double w0 = 2. * Pi * frequency / rate;
+	const double cosw = std::cos(w0);
+	const double alpha = std::sin(w0) / (2. * q);
+	double b0, b1, b2;
+	switch (type) {
+		case LowPass: b0 = (1. - cosw) / 2.; b1 = 1. - cosw; b2 = b0; break;
+		case HighPass: b0 = (1. + cosw) / 2.; b1 = -(1. + cosw); b2 = b0; break;
+		default: b0 = 1.; b1 = -2. * cosw; b2 = 1.; break;
+	}
+	const double a0 = 1. + alpha;
+	Biquad biquad = { b0 / a0, b1 / a0, b2 / a0, -2. * cosw / a0, (1. - alpha) / a0 };
+	return biquad;
+}
+
+} // namespace
+
+FilterBank::FilterBank(const FilterSettings& settings, size_t channelsCount, Nb2Rate rate) :
+	active(nullptr), channelsCount(channelsCount),
+	paddedCount((channelsCount + SimdWidth - 1) / SimdWidth * SimdWidth),
+	row(paddedCount), initialized(false) {
+	if (settings.LowPassOrder == 0 || settings.LowPassOrder % 2 != 0) {
+		throw std::runtime_error("Invalid low-pass order");
+	}
+	for (int r = Hz125; r <= Hz1000; ++r) {
+		const double fs = 125. * (1 << r);
+		std::vector<Biquad>& sections = coefficients[r];
+		// frequencies too close to Nyquist are skipped for the low data rates
+		if (settings.HighPass > 0.f && settings.HighPass < 0.45 * fs) {
+			sections.push_back(design<Biquad>(HighPass, settings.HighPass, fs, 1. / std::sqrt(2.)));
+		}
+		if (settings.Notch > 0.f && settings.Notch < 0.45 * fs) {
+			sections.push_back(design<Biquad>(Notch, settings.Notch, fs, NotchQ));
+		}
+		if (settings.LowPass > 0.f && settings.LowPass < 0.45 * fs) {
+			// Butterworth of order n as n / 2 sections, the poles of section k at angle (2k + 1) pi / 2n
+			const size_t order = settings.LowPassOrder;
+			for (size_t k = 0; k < order / 2; ++k) {
+				sections.push_back(design<Biquad>(LowPass, settings.LowPass, fs, 1. / (2. * std::cos((2. * k + 1.) * Pi / (2. * order)))));
+			}
+		}
+	}
+	setRate(rate);
+}
+
+void FilterBank::setRate(Nb2Rate rate) {
+	active = &coefficients[rate];
+	z1.assign(active->size() * paddedCount, 0.);
+	z2.assign(active->size() * paddedCount, 0.);
+	reset();
+}
+
+void FilterBank::reset() {
+	initialized = false;
+}
+
+// state of the transposed direct form II sections for constant input equal to the current row
+void FilterBank::initialize() {
+	for (size_t s = 0; s < active->size(); ++s) {
+		const Biquad& c = (*active)[s];
+		const double gain = (c.B0 + c.B1 + c.B2) / (1. + c.A1 + c.A2);
+		for (size_t ch = 0; ch < paddedCount; ++ch) {
+			const double x = row[ch];
+			const double y = gain * x;
+			z2[s * paddedCount + ch] = c.B2 * x - c.A2 * y;
+			z1[s * paddedCount + ch] = c.B1 * x - c.A1 * y + z2[s * paddedCount + ch];
+			row[ch] = y;
+		}
+	}
+	initialized = true;
+}
+
+void FilterBank::filterRow() {
+	double* __restrict x = row.data();
+	for (size_t s = 0; s < active->size(); ++s) {
+		const Biquad c = (*active)[s];
+		double* __restrict s1 = &z1[s * paddedCount];
+		double* __restrict s2 = &z2[s * paddedCount];
+		for (size_t ch = 0; ch < paddedCount; ++ch) {
+			const double in = x[ch];
+			const double y = c.B0 * in + s1[ch];
+			s1[ch] = c.B1 * in - c.A1 * y + s2[ch];
+			s2[ch] = c.B2 * in - c.A2 * y;
+			x[ch] = y;
+		}
+	}
+}
+
+void FilterBank::process(float* data, size_t sampleCount, size_t sampleSize) {
+	for (size_t i = 0; i < sampleCount; ++i) {
+		float* values = data + i * sampleSize;
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			row[ch] = values[ch];
+		}
+		if (initialized) {
+			filterRow();
+		}
+		else {
+			initialize();
+		}
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			values[ch] = float(row[ch]);
+		}
+	}
+}
+
+void FilterBank::process(int32_t* data, size_t sampleCount, size_t sampleSize) {
+	for (size_t i = 0; i < sampleCount; ++i) {
+		int32_t* values = data + i * sampleSize;
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			row[ch] = double(values[ch]);
+		}
+		if (initialized) {
+			filterRow();
+		}
+		else {
+			initialize();
+		}
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			values[ch] = int32_t(std::lrint(row[ch]));
+		}
+	}
+}
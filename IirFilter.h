@@ -0,0 +1,55 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// streaming filter settings, frequencies in Hz, 0 - filter is off
+struct FilterSettings {
+	FilterSettings() : HighPass(0.f), LowPass(0.f), Notch(0.f), LowPassOrder(4) {}
+	float HighPass; // 2nd order Butterworth high-pass, removes DC offset and drift
+	float LowPass;  // Butterworth low-pass of LowPassOrder
+	float Notch;    // mains frequency, 50 or 60, Q = 30
+	size_t LowPassOrder; // even, one biquad section per 2
+	bool enabled() const { return HighPass > 0.f || LowPass > 0.f || Notch > 0.f; }
+};
+
+// cascade of biquad sections applied to all channels of sample rows;
+// coefficients are precomputed for every Nb2Rate at construction, state is kept
+// between blocks and laid out stage by stage with the channels of a stage contiguous,
+// so every section is computed for all channels at once by SIMD instructions;
+// coefficients and state are double: a high-pass pole next to 1 with float state
+// leaves percents of a DC offset of raw ADC codes in the output at 1000 Hz
+class FilterBank {
+public:
+	FilterBank(const FilterSettings& settings, size_t channelsCount, Nb2Rate rate = Hz125);
+
+	// selects coefficients of the data rate, restarts filtering
+	void setRate(Nb2Rate rate);
+	// the next sample is taken as the steady state, so DC offset does not ring
+	void reset();
+
+	// in place, the first channelsCount values of sampleCount rows of sampleSize values
+	void process(float* data, size_t sampleCount, size_t sampleSize);
+	// in place, values in ADC bits, the trailing words of the rows are not changed
+	void process(int32_t* data, size_t sampleCount, size_t sampleSize);
+
+	size_t stages() const { return active->size(); }
+
+private:
+	struct Biquad {
+		double B0, B1, B2, A1, A2;
+	};
+
+	void initialize();
+	void filterRow();
+
+	std::vector<Biquad> coefficients[Hz1000 + 1];
+	const std::vector<Biquad>* active;
+	size_t channelsCount;
+	size_t paddedCount;
+	std::vector<double> z1; // [stage][paddedCount]
+	std::vector<double> z2;
+	std::vector<double> row; // current sample of all channels
+	bool initialized;
+};
@@ -0,0 +1,272 @@
+#include "MappedRecording.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#define NOMINMAX // std::min and std::max
+	#include <windows.h>
+#else
+	#include <cerrno>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace {
+
+int64_t nowNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// ns from the first row to the row index of a chunk
+int64_t rowTime(float rate, uint64_t index) {
+	return int64_t(std::llround(double(index) * 1e9 / double(rate)));
+}
+
+} // namespace
+
+RecordingWriter::RecordingWriter(const std::string& path, const Header& source, float chunkSeconds) :
+	header(), sampleSize(source.ChannelsCount + 2), offset(RecordingHeader::Bytes), chunk(),
+	started(false), lastCounter(0), counterBase(0) {
+	header.Magic = RecordingHeader::MagicValue;
+	header.Version = RecordingHeader::VersionValue;
+	header.SampleSize = uint32_t(sampleSize);
+	header.ChannelsCount = source.ChannelsCount;
+	header.EnabledChannels = source.EnabledChannels;
+	header.ChunkSamples = uint32_t(std::max(1.f, std::round(source.Property.Rate * chunkSeconds)));
+	header.Information = source.Information;
+	header.Property = source.Property;
+	rows.reserve(header.ChunkSamples * sampleSize);
+
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("Cannot create file: " + path);
+	}
+	// the header is complete only after close, chunks are found by their headers until then
+	std::vector<char> page(RecordingHeader::Bytes);
+	std::memcpy(page.data(), &header, sizeof(header));
+	file.write(page.data(), std::streamsize(page.size()));
+}
+
+RecordingWriter::~RecordingWriter() {
+	try {
+		close();
+	}
+	catch (...) {
+	}
+}
+
+void RecordingWriter::write(const int32_t* data, size_t sampleCount) {
+	if (!file.is_open() || sampleCount == 0) {
+		return;
+	}
+	const int64_t blockTime = nowNanoseconds() - rowTime(header.Property.Rate, sampleCount - 1);
+	for (size_t i = 0; i < sampleCount; ++i) {
+		const int32_t* row = data + i * sampleSize;
+		const uint32_t counter = uint32_t(row[sampleSize - 1]);
+		if (started && counter <= lastCounter) {
+			counterBase += uint64_t(lastCounter) + 1; // counter reset or wrap, continue the time line
+		}
+		const bool consecutive = started && counter == lastCounter + 1;
+		lastCounter = counter;
+		started = true;
+		if (!rows.empty() && !consecutive) {
+			flush();
+		}
+		if (rows.empty()) {
+			chunk.FirstCounter = counter;
+			chunk.FirstSample = counterBase + counter;
+			chunk.Time = blockTime + rowTime(header.Property.Rate, i);
+			if (header.ChunkCount == 0) {
+				header.StartTime = chunk.Time;
+			}
+		}
+		rows.insert(rows.end(), row, row + sampleSize);
+		if (rows.size() == header.ChunkSamples * sampleSize) {
+			flush();
+		}
+	}
+}
+
+void RecordingWriter::write(const t_nb2Event* data, size_t count) {
+	events.insert(events.end(), data, data + count);
+}
+
+void RecordingWriter::flush() {
+	if (rows.empty()) {
+		return;
+	}
+	chunk.Magic = RecordingChunk::MagicValue;
+	chunk.SampleCount = uint32_t(rows.size() / sampleSize);
+	file.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+	file.write(reinterpret_cast<const char*>(rows.data()), std::streamsize(rows.size() * sizeof(int32_t)));
+
+	RecordingIndexEntry entry;
+	entry.FirstSample = chunk.FirstSample;
+	entry.Time = chunk.Time;
+	entry.Offset = offset;
+	entry.SampleCount = chunk.SampleCount;
+	entry.FirstCounter = chunk.FirstCounter;
+	index.push_back(entry);
+
+	offset += sizeof(chunk) + rows.size() * sizeof(int32_t);
+	header.SampleCount += chunk.SampleCount;
+	++header.ChunkCount;
+	rows.clear();
+}
+
+void RecordingWriter::close() {
+	if (!file.is_open()) {
+		return;
+	}
+	flush();
+	file.write(reinterpret_cast<const char*>(events.data()), std::streamsize(events.size() * sizeof(t_nb2Event)));
+	header.EventOffset = offset;
+	header.EventCount = events.size();
+	offset += events.size() * sizeof(t_nb2Event);
+	const size_t padding = size_t((8 - offset % 8) % 8); // index entries are 8-byte aligned in the mapping
+	file.write("\0\0\0\0\0\0\0", std::streamsize(padding));
+	header.IndexOffset = offset + padding;
+	file.write(reinterpret_cast<const char*>(index.data()), std::streamsize(index.size() * sizeof(RecordingIndexEntry)));
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.close();
+	if (!file) {
+		throw std::runtime_error("Recording file write error");
+	}
+}
+
+MappedFile::MappedFile(const std::string& path) : address(nullptr), length(0) {
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+		uint64_t(size.QuadPart) > SIZE_MAX) {
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		throw std::runtime_error("Cannot open file: " + path);
+	}
+	handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (handle) {
+		address = static_cast<const uint8_t*>(MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (!address) {
+		if (handle) CloseHandle(handle);
+		CloseHandle(file);
+		throw std::runtime_error("Cannot map file: " + path);
+	}
+	length = size_t(size.QuadPart);
+#else
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	struct stat st = {};
+	void* mapping = MAP_FAILED;
+	if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size == 0 ||
+		(mapping = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		const std::string error = fd >= 0 && st.st_size == 0 ? "empty file" : std::strerror(errno);
+		if (fd >= 0) ::close(fd);
+		throw std::runtime_error("Cannot map file " + path + ": " + error);
+	}
+	address = static_cast<const uint8_t*>(mapping);
+	length = size_t(st.st_size);
+	::close(fd);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	UnmapViewOfFile(address);
+	CloseHandle(handle);
+	CloseHandle(file);
+#else
+	::munmap(const_cast<uint8_t*>(address), length);
+#endif
+}
+
+RecordingReader::RecordingReader(const std::string& path) :
+	file(path), fileHeader(reinterpret_cast<const RecordingHeader*>(file.data())),
+	entries(nullptr), count(0), sampleCount(0), eventData(nullptr), eventsCount(0) {
+	if (file.size() < RecordingHeader::Bytes || fileHeader->Magic != RecordingHeader::MagicValue ||
+		fileHeader->Version != RecordingHeader::VersionValue || fileHeader->SampleSize < 3) {
+		throw std::runtime_error("Not a recording file: " + path);
+	}
+	const uint64_t size = file.size();
+	const uint64_t rowBytes = uint64_t(fileHeader->SampleSize) * sizeof(int32_t);
+	const RecordingHeader& h = *fileHeader;
+	if (h.IndexOffset && h.IndexOffset <= size && h.ChunkCount <= (size - h.IndexOffset) / sizeof(RecordingIndexEntry) &&
+		h.EventOffset <= size && h.EventCount <= (size - h.EventOffset) / sizeof(t_nb2Event)) {
+		entries = reinterpret_cast<const RecordingIndexEntry*>(file.data() + h.IndexOffset);
+		count = size_t(h.ChunkCount);
+		sampleCount = h.SampleCount;
+		eventData = reinterpret_cast<const t_nb2Event*>(file.data() + h.EventOffset);
+		eventsCount = size_t(h.EventCount);
+	}
+	else {
+		for (uint64_t offset = RecordingHeader::Bytes; size - offset >= sizeof(RecordingChunk);) {
+			RecordingChunk chunk; // chunks are 4-byte aligned only
+			std::memcpy(&chunk, file.data() + offset, sizeof(chunk));
+			const uint64_t bytes = sizeof(RecordingChunk) + chunk.SampleCount * rowBytes;
+			if (chunk.Magic != RecordingChunk::MagicValue || chunk.SampleCount == 0 || bytes > size - offset) {
+				break;
+			}
+			RecordingIndexEntry entry;
+			entry.FirstSample = chunk.FirstSample;
+			entry.Time = chunk.Time;
+			entry.Offset = offset;
+			entry.SampleCount = chunk.SampleCount;
+			entry.FirstCounter = chunk.FirstCounter;
+			rebuilt.push_back(entry);
+			sampleCount += chunk.SampleCount;
+			offset += bytes;
+		}
+		entries = rebuilt.data();
+		count = rebuilt.size();
+	}
+	// chunks of an index which does not fit the file are not used
+	for (size_t i = 0; i < count; ++i) {
+		if (entries[i].Offset > size || entries[i].SampleCount * rowBytes + sizeof(RecordingChunk) > size - entries[i].Offset) {
+			throw std::runtime_error("Damaged recording file index: " + path);
+		}
+	}
+}
+
+RecordingReader::Chunk RecordingReader::chunk(size_t index) const {
+	const RecordingIndexEntry& entry = entries[index];
+	Chunk chunk;
+	chunk.Rows = reinterpret_cast<const int32_t*>(file.data() + entry.Offset + sizeof(RecordingChunk));
+	chunk.SampleCount = entry.SampleCount;
+	chunk.FirstSample = entry.FirstSample;
+	chunk.FirstCounter = entry.FirstCounter;
+	chunk.Time = entry.Time;
+	return chunk;
+}
+
+size_t RecordingReader::findSample(uint64_t sample) const {
+	// the first chunk which ends after the sample
+	const RecordingIndexEntry* found = std::upper_bound(entries, entries + count, sample,
+		[](uint64_t value, const RecordingIndexEntry& entry) { return value < entry.FirstSample + entry.SampleCount; });
+	return size_t(found - entries);
+}
+
+size_t RecordingReader::findTime(int64_t time) const {
+	const float rate = fileHeader->Property.Rate;
+	const RecordingIndexEntry* found = std::upper_bound(entries, entries + count, time,
+		[rate](int64_t value, const RecordingIndexEntry& entry) {
+			return value < entry.Time + rowTime(rate, entry.SampleCount - 1);
+		});
+	return size_t(found - entries);
+}
+
+uint64_t RecordingReader::sampleAt(int64_t time) const {
+	if (count == 0) {
+		return 0;
+	}
+	const size_t index = std::min(findTime(time), count - 1);
+	const RecordingIndexEntry& entry = entries[index];
+	const double rows = std::round(double(time - entry.Time) * 1e-9 * double(fileHeader->Property.Rate));
+	return entry.FirstSample + uint64_t(std::min(std::max(rows, 0.), double(entry.SampleCount - 1)));
+}
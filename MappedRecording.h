@@ -0,0 +1,173 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// recording file for random access: fixed header, chunks of raw nb2GetData sample rows,
+// then the events and the index, one entry per chunk, written by close. Rows are stored as
+// acquired, so a reader maps the file and uses the rows in place. Sample counters are
+// extended to 64 bits over counter resets as in BdfWriter, without a reset they are the
+// device counters; a chunk holds consecutive counters only, a gap starts a new chunk
+struct RecordingHeader {
+	enum { MagicValue = 0x52324E42, VersionValue = 1, Bytes = 4096 }; // "BN2R", chunks start at Bytes
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t SampleSize;      // words of a row, counter is the last word
+	uint32_t ChannelsCount;
+	uint32_t EnabledChannels; // bit ch for channel ch
+	uint32_t ChunkSamples;    // rows of a full chunk
+	t_nb2Information Information;
+	t_nb2Property Property;
+	int64_t StartTime;        // host wall clock of the first row, ns since 1970
+	uint64_t SampleCount;     // rows of all chunks
+	uint64_t ChunkCount;
+	uint64_t IndexOffset;     // bytes from the start of the file, 0 if the file was not closed
+	uint64_t EventOffset;
+	uint64_t EventCount;
+};
+
+struct RecordingChunk {
+	enum { MagicValue = 0x4B4E4843 }; // "CHNK", SampleCount rows follow
+	uint32_t Magic;
+	uint32_t SampleCount;
+	uint32_t FirstCounter;    // device counter of the first row
+	uint32_t Reserved;
+	uint64_t FirstSample;     // extended counter of the first row
+	int64_t Time;             // host wall clock of the first row, ns since 1970
+};
+
+struct RecordingIndexEntry {
+	uint64_t FirstSample;
+	int64_t Time;
+	uint64_t Offset;          // of the chunk header
+	uint32_t SampleCount;
+	uint32_t FirstCounter;
+};
+
+// rows are collected into a chunk and written on the calling thread when it is full,
+// a chunk of 1 second is a sparse enough index for seeking and small enough to read
+class RecordingWriter {
+public:
+	struct Header {
+		t_nb2Information Information;
+		t_nb2Property Property;
+		uint32_t ChannelsCount;
+		uint32_t EnabledChannels;
+	};
+
+	RecordingWriter(const std::string& path, const Header& header, float chunkSeconds = 1.f);
+	~RecordingWriter();
+	RecordingWriter(const RecordingWriter&) = delete;
+	RecordingWriter& operator=(const RecordingWriter&) = delete;
+
+	// sample rows of ChannelsCount + 2 words, counter is the last word; the last row is taken
+	// as acquired now, the time of the others from the rate
+	void write(const int32_t* data, size_t sampleCount);
+	void write(const t_nb2Event* events, size_t count);
+	// writes the last chunk, the events, the index and the header
+	void close();
+
+	uint64_t samplesWritten() const { return header.SampleCount; }
+	uint64_t chunksWritten() const { return header.ChunkCount; }
+
+private:
+	void flush();
+
+	RecordingHeader header;
+	const size_t sampleSize;
+	std::ofstream file;
+	uint64_t offset; // of the next chunk
+	RecordingChunk chunk;
+	std::vector<int32_t> rows;
+	bool started;
+	uint32_t lastCounter;
+	uint64_t counterBase;
+	std::vector<RecordingIndexEntry> index;
+	std::vector<t_nb2Event> events;
+};
+
+// read-only mapping of a whole file: mmap, or a Windows file mapping; pages are read
+// on first access, so mapping a file of any size is instant (64-bit builds)
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data() const { return address; }
+	size_t size() const { return length; }
+
+private:
+	const uint8_t* address;
+	size_t length;
+#ifdef _WIN32
+	void* file;
+	void* handle;
+#endif
+};
+
+// random access to a recording file in place: the index and the rows are used from the
+// mapping, nothing is copied; the index of a file which was not closed is rebuilt from the
+// chunk headers, which reads one page per chunk, and ends at the first incomplete chunk
+class RecordingReader {
+public:
+	struct Chunk {
+		const int32_t* Rows; // SampleCount rows of sampleSize() words
+		size_t SampleCount;
+		uint64_t FirstSample;
+		uint32_t FirstCounter;
+		int64_t Time;
+	};
+
+	explicit RecordingReader(const std::string& path);
+
+	const RecordingHeader& header() const { return *fileHeader; }
+	size_t sampleSize() const { return fileHeader->SampleSize; }
+	size_t channels() const { return fileHeader->ChannelsCount; }
+	uint64_t samples() const { return sampleCount; }
+	size_t chunks() const { return count; }
+	Chunk chunk(size_t index) const;
+	// chunk with the extended counter or, if it is in a gap, the next one; chunks() if after the end
+	size_t findSample(uint64_t sample) const;
+	// chunk with the row acquired at the time or the next one, chunks() if after the end;
+	// the host clock is assumed not to step back during the recording
+	size_t findTime(int64_t time) const;
+	// extended counter of the row acquired at the time, from the rate within the chunk, or of the
+	// next recorded row if the time is in a gap
+	uint64_t sampleAt(int64_t time) const;
+	// extended counters of the first row and after the last one
+	uint64_t firstSample() const { return count ? entries[0].FirstSample : 0; }
+	uint64_t endSample() const { return count ? entries[count - 1].FirstSample + entries[count - 1].SampleCount : 0; }
+	// recorded rows with extended counters from first to first + sampleCount - 1 in place, chunk by chunk:
+	// visit(const int32_t* rows, size_t count, uint64_t firstSample)
+	template<typename Visit>
+	void visit(uint64_t first, uint64_t sampleCount, Visit visit) const {
+		for (size_t i = findSample(first); i < count; ++i) {
+			const RecordingIndexEntry& entry = entries[i];
+			if (entry.FirstSample >= first + sampleCount) {
+				break;
+			}
+			const uint64_t from = std::max(first, entry.FirstSample);
+			const uint64_t to = std::min(first + sampleCount, entry.FirstSample + entry.SampleCount);
+			visit(chunk(i).Rows + (from - entry.FirstSample) * sampleSize(), size_t(to - from), from);
+		}
+	}
+
+	const t_nb2Event* events() const { return eventData; }
+	size_t eventCount() const { return eventsCount; }
+
+private:
+	MappedFile file;
+	const RecordingHeader* fileHeader;
+	const RecordingIndexEntry* entries;
+	std::vector<RecordingIndexEntry> rebuilt; // index of a file which was not closed
+	size_t count;
+	uint64_t sampleCount;
+	const t_nb2Event* eventData;
+	size_t eventsCount;
+};
@@ -0,0 +1,411 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#include <intrin.h>
+	#include <windows.h>
+#else
+	#include <cerrno>
+	#include <cstring>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+#endif
+
+namespace {
+
+const char* EventTypeNames[] = { "button", "activity", "free_fall", "orientation", "start", "charge", "unknown" };
+const double Quantiles[] = { 0.5, 0.9, 0.99, 0.999, 1. };
+const std::chrono::milliseconds SocketPoll(100); // stop latency of the socket server
+
+unsigned highestBit(uint64_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return unsigned(index);
+#else
+	return 63u - unsigned(__builtin_clzll(value));
+#endif
+}
+
+void family(std::ostringstream& out, const char* name, const char* type, const char* help) {
+	out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+}
+
+std::string label(uint32_t serial) {
+	return "serial=\"" + std::to_string(serial) + '"';
+}
+
+// quantiles over the interval, sum and count since start, values multiplied by scale
+void summary(std::ostringstream& out, const char* name, const std::string& labels,
+	const Histogram::Snapshot& total, const Histogram::Snapshot& interval, double scale) {
+	for (double q : Quantiles) {
+		out << name << '{' << labels << ",quantile=\"" << q << "\"} " << double(interval.quantile(q)) * scale << '\n';
+	}
+	out << name << "_sum{" << labels << "} " << double(total.Sum) * scale << '\n';
+	out << name << "_count{" << labels << "} " << total.Count << '\n';
+}
+
+} // namespace
+
+Histogram::Histogram() : count(0), sum(0) {
+	for (auto& bucket : counts) {
+		bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+size_t Histogram::bucketOf(uint64_t value) {
+	if (value < (1u << SubBits)) {
+		return size_t(value);
+	}
+	const unsigned shift = highestBit(value) - SubBits;
+	return (size_t(shift + 1) << SubBits) + size_t((value >> shift) - (1u << SubBits));
+}
+
+// the largest value of the bucket
+uint64_t Histogram::upperBound(size_t bucket) {
+	if (bucket < (1u << SubBits)) {
+		return bucket;
+	}
+	const unsigned shift = unsigned(bucket >> SubBits) - 1;
+	const uint64_t lower = uint64_t((1u << SubBits) + (bucket & ((1u << SubBits) - 1))) << shift;
+	return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void Histogram::record(uint64_t value) {
+	counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+}
+
+// buckets are read one by one, a snapshot taken during recording may be off by the values in flight
+Histogram::Snapshot Histogram::snapshot() const {
+	Snapshot snapshot;
+	snapshot.Counts.resize(BucketsCount);
+	for (size_t i = 0; i < BucketsCount; ++i) {
+		snapshot.Counts[i] = counts[i].load(std::memory_order_relaxed);
+		snapshot.Count += snapshot.Counts[i];
+	}
+	snapshot.Sum = sum.load(std::memory_order_relaxed);
+	return snapshot;
+}
+
+Histogram::Snapshot Histogram::Snapshot::since(const Snapshot& previous) const {
+	Snapshot delta;
+	delta.Counts.resize(Counts.size());
+	for (size_t i = 0; i < Counts.size(); ++i) {
+		delta.Counts[i] = Counts[i] - (i < previous.Counts.size() ? previous.Counts[i] : 0);
+		delta.Count += delta.Counts[i];
+	}
+	delta.Sum = Sum - previous.Sum;
+	return delta;
+}
+
+uint64_t Histogram::Snapshot::quantile(double q) const {
+	if (Count == 0) {
+		return 0;
+	}
+	const uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(q * double(Count))));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < Counts.size(); ++i) {
+		seen += Counts[i];
+		if (seen >= rank) {
+			return upperBound(i);
+		}
+	}
+	return upperBound(Counts.size() - 1);
+}
+
+DeviceMetrics::DeviceMetrics(uint32_t serial) :
+	Serial(serial), RingCapacity(0), Polls(0), Samples(0), LostSamples(0), OverflowSamples(0), OverflowEvents(0),
+	Reconnects(0), GapSamples(0), DiscoveryNanoseconds(0), StartupNanoseconds(0), ReconnectNanoseconds(0),
+	LastReconnectNanoseconds(0), ClockErrorNanoseconds(0), ClockDriftPpm(0.),
+	status(), errors(), hasStatus(false), hasErrors(false) {
+	for (auto& events : Events) {
+		events.store(0, std::memory_order_relaxed);
+	}
+}
+
+void DeviceMetrics::setDataStatus(const t_nb2DataStatus& value) {
+	std::lock_guard<std::mutex> lock(mutex);
+	status = value;
+	hasStatus = true;
+}
+
+void DeviceMetrics::setErrorsStats(const t_nb2ErrorsStats& value) {
+	std::lock_guard<std::mutex> lock(mutex);
+	errors = value;
+	hasErrors = true;
+}
+
+bool DeviceMetrics::dataStatus(t_nb2DataStatus& value) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	value = status;
+	return hasStatus;
+}
+
+bool DeviceMetrics::errorsStats(t_nb2ErrorsStats& value) const {
+	std::lock_guard<std::mutex> lock(mutex);
+	value = errors;
+	return hasErrors;
+}
+
+MetricsExporter::MetricsExporter(const std::string& target, std::chrono::milliseconds interval) :
+	path(target.compare(0, 5, "unix:") == 0 ? target.substr(5) : target),
+	socket(target.compare(0, 5, "unix:") == 0),
+	interval(interval), stopping(false), listener(-1) {
+	if (socket) {
+#ifdef _WIN32
+		throw std::runtime_error("Metrics socket is not supported on Windows: " + target);
+#else
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+			throw std::runtime_error("Bad metrics socket path: " + path);
+		}
+		std::strcpy(address.sun_path, path.c_str());
+		listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		::unlink(path.c_str()); // socket left by a previous run
+		if (listener < 0 || ::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+			::listen(listener, 8) != 0) {
+			const std::string error = std::strerror(errno);
+			if (listener >= 0) ::close(listener);
+			throw std::runtime_error("Cannot listen on metrics socket " + path + ": " + error);
+		}
+#endif
+	}
+	thread = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	thread.join();
+#ifndef _WIN32
+	if (listener >= 0) {
+		::close(listener);
+		::unlink(path.c_str());
+	}
+#endif
+}
+
+void MetricsExporter::add(const std::shared_ptr<DeviceMetrics>& metrics) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Device device;
+	device.Metrics = metrics;
+	device.Samples = metrics->Samples.load();
+	device.Time = std::chrono::steady_clock::now();
+	devices.push_back(std::move(device));
+}
+
+std::string MetricsExporter::format() {
+	struct Interval {
+		Histogram::Snapshot PollNanoseconds[2], PollBytes[2], RingSamples[2]; // since start, over the interval
+		double SamplesPerSecond;
+	};
+	std::vector<std::shared_ptr<DeviceMetrics>> metrics;
+	std::vector<Interval> intervals;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto now = std::chrono::steady_clock::now();
+		for (Device& device : devices) {
+			const DeviceMetrics& m = *device.Metrics;
+			Interval i;
+			i.PollNanoseconds[0] = m.PollNanoseconds.snapshot();
+			i.PollNanoseconds[1] = i.PollNanoseconds[0].since(device.PollNanoseconds);
+			i.PollBytes[0] = m.PollBytes.snapshot();
+			i.PollBytes[1] = i.PollBytes[0].since(device.PollBytes);
+			i.RingSamples[0] = m.RingSamples.snapshot();
+			i.RingSamples[1] = i.RingSamples[0].since(device.RingSamples);
+			const uint64_t samples = m.Samples.load();
+			const double seconds = std::chrono::duration<double>(now - device.Time).count();
+			i.SamplesPerSecond = seconds > 0 ? double(samples - device.Samples) / seconds : 0.;
+
+			device.PollNanoseconds = i.PollNanoseconds[0];
+			device.PollBytes = i.PollBytes[0];
+			device.RingSamples = i.RingSamples[0];
+			device.Samples = samples;
+			device.Time = now;
+			metrics.push_back(device.Metrics);
+			intervals.push_back(std::move(i));
+		}
+	}
+
+	std::ostringstream out;
+	out.precision(9);
+	struct Counter {
+		const char* Name;
+		const char* Help;
+		std::atomic<uint64_t> DeviceMetrics::* Value;
+	};
+	const Counter counters[] = {
+		{ "nb2_polls_total", "nb2GetData and nb2GetEvent polls of the acquisition thread.", &DeviceMetrics::Polls },
+		{ "nb2_samples_total", "Samples acquired by nb2GetData.", &DeviceMetrics::Samples },
+		{ "nb2_lost_samples_total", "Samples missing in the counter sequence.", &DeviceMetrics::LostSamples },
+		{ "nb2_overflow_samples_total", "Samples dropped because the data ring was full.", &DeviceMetrics::OverflowSamples },
+		{ "nb2_overflow_events_total", "Events dropped because the event ring was full.", &DeviceMetrics::OverflowEvents },
+		{ "nb2_ring_capacity_samples", "Capacity of the data ring.", &DeviceMetrics::RingCapacity },
+		{ "nb2_reconnects_total", "Reopens of the device after a link drop.", &DeviceMetrics::Reconnects },
+		{ "nb2_gap_samples_total", "Samples missed while the device was reconnected.", &DeviceMetrics::GapSamples },
+	};
+	for (const Counter& counter : counters) {
+		const bool gauge = counter.Value == &DeviceMetrics::RingCapacity;
+		family(out, counter.Name, gauge ? "gauge" : "counter", counter.Help);
+		for (const auto& m : metrics) {
+			out << counter.Name << '{' << label(m->Serial) << "} " << ((*m).*counter.Value).load() << '\n';
+		}
+	}
+	const Counter durations[] = {
+		{ "nb2_discovery_seconds", "Time until nb2GetCount found a device.", &DeviceMetrics::DiscoveryNanoseconds },
+		{ "nb2_startup_seconds", "Time from the device search to the first sample.", &DeviceMetrics::StartupNanoseconds },
+		{ "nb2_last_reconnect_seconds", "Time from the link drop to the data of the last reconnect.", &DeviceMetrics::LastReconnectNanoseconds },
+		{ "nb2_reconnect_seconds_total", "Time spent reconnecting.", &DeviceMetrics::ReconnectNanoseconds },
+		{ "nb2_clock_error_seconds", "Error bound of the sample counter to host time fit.", &DeviceMetrics::ClockErrorNanoseconds },
+	};
+	for (const Counter& duration : durations) {
+		const bool gauge = duration.Value != &DeviceMetrics::ReconnectNanoseconds;
+		family(out, duration.Name, gauge ? "gauge" : "counter", duration.Help);
+		for (const auto& m : metrics) {
+			out << duration.Name << '{' << label(m->Serial) << "} " << double(((*m).*duration.Value).load()) * 1e-9 << '\n';
+		}
+	}
+	family(out, "nb2_clock_drift_ppm", "gauge", "Device clock deviation from the nominal data rate.");
+	for (const auto& m : metrics) {
+		out << "nb2_clock_drift_ppm{" << label(m->Serial) << "} " << m->ClockDriftPpm.load() << '\n';
+	}
+	family(out, "nb2_events_total", "counter", "Device events by type.");
+	for (const auto& m : metrics) {
+		for (size_t type = 0; type < DeviceMetrics::EventTypesCount; ++type) {
+			out << "nb2_events_total{" << label(m->Serial) << ",type=\"" << EventTypeNames[type] << "\"} "
+				<< m->Events[type].load() << '\n';
+		}
+	}
+	family(out, "nb2_samples_per_second", "gauge", "Acquired samples per second over the export interval.");
+	for (size_t i = 0; i < metrics.size(); ++i) {
+		out << "nb2_samples_per_second{" << label(metrics[i]->Serial) << "} " << intervals[i].SamplesPerSecond << '\n';
+	}
+	family(out, "nb2_poll_duration_seconds", "summary", "Duration of a poll, quantiles over the export interval.");
+	for (size_t i = 0; i < metrics.size(); ++i) {
+		summary(out, "nb2_poll_duration_seconds", label(metrics[i]->Serial), intervals[i].PollNanoseconds[0], intervals[i].PollNanoseconds[1], 1e-9);
+	}
+	family(out, "nb2_poll_bytes", "summary", "Bytes returned by one nb2GetData call, quantiles over the export interval.");
+	for (size_t i = 0; i < metrics.size(); ++i) {
+		summary(out, "nb2_poll_bytes", label(metrics[i]->Serial), intervals[i].PollBytes[0], intervals[i].PollBytes[1], 1.);
+	}
+	family(out, "nb2_ring_occupancy_samples", "summary", "Data ring occupancy after a poll, quantiles over the export interval.");
+	for (size_t i = 0; i < metrics.size(); ++i) {
+		summary(out, "nb2_ring_occupancy_samples", label(metrics[i]->Serial), intervals[i].RingSamples[0], intervals[i].RingSamples[1], 1.);
+	}
+
+	// device reports
+	struct Status {
+		const char* Name;
+		const char* Help;
+		float t_nb2DataStatus::* Value;
+	};
+	const Status statuses[] = {
+		{ "nb2_data_rate_sps", "Data rate reported by the device.", &t_nb2DataStatus::Rate },
+		{ "nb2_data_speed_kbytes_per_second", "Data speed reported by the device.", &t_nb2DataStatus::Speed },
+		{ "nb2_data_compression_ratio_percent", "Compression ratio reported by the device.", &t_nb2DataStatus::Ratio },
+		{ "nb2_ble_utilization_percent", "BLE utilization reported by the device.", &t_nb2DataStatus::Utilization },
+	};
+	for (const Status& status : statuses) {
+		family(out, status.Name, "gauge", status.Help);
+		for (const auto& m : metrics) {
+			t_nb2DataStatus value;
+			if (m->dataStatus(value)) {
+				out << status.Name << '{' << label(m->Serial) << "} " << value.*status.Value << '\n';
+			}
+		}
+	}
+	family(out, "nb2_device_errors", "gauge", "Error counters of the device usage statistics.");
+	for (const auto& m : metrics) {
+		t_nb2ErrorsStats errors;
+		if (m->errorsStats(errors)) {
+			const std::pair<const char*, uint8_t> sources[] = {
+				{ "acc", errors.ACC }, { "adc", errors.ADC }, { "cell", errors.CELL }, { "rw", errors.RW }, { "sys", errors.SYS } };
+			for (const auto& source : sources) {
+				out << "nb2_device_errors{" << label(m->Serial) << ",source=\"" << source.first << "\"} " << int(source.second) << '\n';
+			}
+		}
+	}
+	return out.str();
+}
+
+void MetricsExporter::publish(const std::string& text) {
+	const std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		file.write(text.data(), std::streamsize(text.size()));
+		if (!file) {
+			return; // the next interval tries again
+		}
+	}
+#ifdef _WIN32
+	MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	std::rename(temporary.c_str(), path.c_str());
+#endif
+}
+
+// answers every connection with the current metrics until the exporter stops
+void MetricsExporter::serve() {
+#ifndef _WIN32
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (stopping) return;
+		}
+		pollfd listen = { listener, POLLIN, 0 };
+		if (::poll(&listen, 1, int(SocketPoll.count())) <= 0) {
+			continue;
+		}
+		const int client = ::accept(listener, nullptr, nullptr);
+		if (client < 0) {
+			continue;
+		}
+		// the request is not parsed, any request gets the metrics
+		pollfd request = { client, POLLIN, 0 };
+		char buffer[1024];
+		if (::poll(&request, 1, int(SocketPoll.count())) > 0) {
+			(void)::recv(client, buffer, sizeof(buffer), 0);
+		}
+		const std::string text = format();
+		const std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+			std::to_string(text.size()) + "\r\n\r\n" + text;
+		size_t sent = 0;
+		while (sent < response.size()) {
+			const ssize_t n = ::send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if (n <= 0) break;
+			sent += size_t(n);
+		}
+		::close(client);
+	}
+#endif
+}
+
+void MetricsExporter::run() {
+	if (socket) {
+		serve();
+		return;
+	}
+	auto next = std::chrono::steady_clock::now();
+	for (;;) {
+		publish(format());
+		next += interval;
+		std::unique_lock<std::mutex> lock(mutex);
+		if (wake.wait_until(lock, next, [this] { return stopping; })) {
+			break;
+		}
+	}
+	publish(format()); // final values of the counters
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// log-linear histogram of non-negative integer values (HDR style): values below 2^SubBits
+// are exact, every higher power of two is split into 2^SubBits buckets, so the relative error
+// of a quantile is below 1/2^SubBits; recording is a few relaxed atomic operations, any
+// thread may record while another one takes a snapshot
+class Histogram {
+public:
+	enum { SubBits = 4, BucketsCount = (64 - SubBits + 1) << SubBits };
+
+	struct Snapshot {
+		std::vector<uint64_t> Counts;
+		uint64_t Count = 0;
+		uint64_t Sum = 0;
+		// values recorded after the previous snapshot
+		Snapshot since(const Snapshot& previous) const;
+		// upper bound of the bucket of the q-th quantile, 0 if empty
+		uint64_t quantile(double q) const;
+	};
+
+	Histogram();
+	Histogram(const Histogram&) = delete;
+	Histogram& operator=(const Histogram&) = delete;
+
+	void record(uint64_t value);
+	Snapshot snapshot() const;
+
+	static size_t bucketOf(uint64_t value);
+	static uint64_t upperBound(size_t bucket);
+
+private:
+	std::atomic<uint64_t> counts[BucketsCount];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;
+};
+
+// acquisition health of one device: written by the acquisition and processing threads
+// on the hot path with relaxed atomics, read by MetricsExporter
+struct DeviceMetrics {
+	enum { EventTypesCount = EvCharge + 2 }; // the last one counts unknown types
+
+	explicit DeviceMetrics(uint32_t serial);
+
+	// rarely updated device reports, copied under a lock
+	void setDataStatus(const t_nb2DataStatus& status);
+	void setErrorsStats(const t_nb2ErrorsStats& errors);
+	bool dataStatus(t_nb2DataStatus& status) const;
+	bool errorsStats(t_nb2ErrorsStats& errors) const;
+
+	const uint32_t Serial;
+	Histogram PollNanoseconds;  // nb2GetData and nb2GetEvent call duration
+	Histogram PollBytes;        // bytes returned by one nb2GetData call
+	Histogram RingSamples;      // data ring occupancy after a poll
+	std::atomic<uint64_t> RingCapacity;
+	std::atomic<uint64_t> Polls;
+	std::atomic<uint64_t> Samples;
+	std::atomic<uint64_t> LostSamples;     // counter gaps found by the consumer
+	std::atomic<uint64_t> OverflowSamples; // ring full, dropped by the acquisition thread
+	std::atomic<uint64_t> OverflowEvents;
+	std::atomic<uint64_t> Reconnects;      // device reopened after a link drop
+	std::atomic<uint64_t> GapSamples;      // samples missed while the device was away
+	// connection timings: nb2GetCount polls until a device was found, search start to the first
+	// sample, and the reconnects, all of them and the last one
+	std::atomic<uint64_t> DiscoveryNanoseconds;
+	std::atomic<uint64_t> StartupNanoseconds;
+	std::atomic<uint64_t> ReconnectNanoseconds;
+	std::atomic<uint64_t> LastReconnectNanoseconds;
+	// device to host clock fit of ClockSync
+	std::atomic<uint64_t> ClockErrorNanoseconds;
+	std::atomic<double> ClockDriftPpm;
+	std::atomic<uint64_t> Events[EventTypesCount];
+
+private:
+	mutable std::mutex mutex;
+	t_nb2DataStatus status;
+	t_nb2ErrorsStats errors;
+	bool hasStatus;
+	bool hasErrors;
+};
+
+// export of device metrics in Prometheus text format: every interval into a file, written
+// to <file>.tmp and renamed so a collector never reads a partial file, or for the
+// unix:<path> target on request of a Unix domain socket client as an HTTP response
+// (curl --unix-socket <path> http://localhost/metrics); quantiles of the histograms
+// are over the time since the previous export, counters and sums since start
+class MetricsExporter {
+public:
+	explicit MetricsExporter(const std::string& target, std::chrono::milliseconds interval = std::chrono::milliseconds(5000));
+	~MetricsExporter();
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	void add(const std::shared_ptr<DeviceMetrics>& metrics);
+
+private:
+	struct Device {
+		std::shared_ptr<DeviceMetrics> Metrics;
+		Histogram::Snapshot PollNanoseconds;
+		Histogram::Snapshot PollBytes;
+		Histogram::Snapshot RingSamples;
+		uint64_t Samples = 0;
+		std::chrono::steady_clock::time_point Time;
+	};
+
+	// metrics text, starts the next interval of the quantiles
+	std::string format();
+	void run();
+	void publish(const std::string& text);
+	void serve();
+
+	const std::string path;
+	const bool socket;
+	const std::chrono::milliseconds interval;
+	std::vector<Device> devices;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+	int listener;
+	std::thread thread;
+};
@@ -0,0 +1,290 @@
+#include "Montage.h"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define MONTAGE_WIDTH 8
+#elif defined(__SSE4_1__) || defined(__AVX__)
+	#include <smmintrin.h>
+	#define MONTAGE_WIDTH 4
+#else
+	#define MONTAGE_WIDTH 1
+#endif
+
+namespace {
+
+std::string channelLabel(size_t channel) {
+	return "ch" + std::to_string(channel + 1);
+}
+
+// 1-based channel number of a definition into an index
+size_t channelNumber(const std::string& text) {
+	size_t end = 0;
+	unsigned long number = 0;
+	// digits only: std::stoul skips blanks, takes a sign and throws its own messages
+	if (!text.empty() && std::isdigit((unsigned char)text[0])) {
+		try {
+			number = std::stoul(text, &end);
+		}
+		catch (const std::out_of_range&) {
+			number = 0;
+		}
+	}
+	if (end != text.size() || number == 0) {
+		throw std::runtime_error("Bad montage channel: " + text);
+	}
+	return size_t(number - 1);
+}
+
+float weightValue(const std::string& text) {
+	size_t end = 0;
+	float weight = 0.f;
+	try {
+		weight = std::stof(text, &end);
+	}
+	catch (const std::exception&) {
+		end = 0;
+	}
+	if (text.empty() || end != text.size()) {
+		throw std::runtime_error("Bad montage weight: " + text);
+	}
+	return weight;
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+	std::vector<std::string> parts;
+	std::istringstream values(text);
+	std::string value;
+	while (std::getline(values, value, separator)) {
+		parts.push_back(value);
+	}
+	return parts;
+}
+
+} // namespace
+
+Montage::Montage(size_t channelsCount, uint32_t enabledChannels) :
+	channelsCount(channelsCount),
+	enabledChannels(channelsCount >= 32 ? enabledChannels : enabledChannels & ((uint32_t(1) << channelsCount) - 1)),
+	meanWeights(channelsCount), meanUsed(false) {
+	if (channelsCount > MaxChannels) {
+		throw std::runtime_error("Too many channels for the montage");
+	}
+	size_t enabledCount = 0;
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		enabledCount += (this->enabledChannels >> ch) & 1;
+	}
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		meanWeights[ch] = ((this->enabledChannels >> ch) & 1) ? 1.f / float(enabledCount) : 0.f;
+	}
+	pack();
+}
+
+void Montage::checkEnabled(size_t channel) const {
+	if (channel >= channelsCount || !((enabledChannels >> channel) & 1)) {
+		throw std::runtime_error("Montage channel " + std::to_string(channel + 1) + " is not enabled");
+	}
+}
+
+void Montage::clear() {
+	derivations.clear();
+	pack();
+}
+
+void Montage::append(const Derivation& derivation) {
+	derivations.push_back(derivation);
+	pack();
+}
+
+void Montage::addReference() {
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		if ((enabledChannels >> ch) & 1) {
+			append(Derivation{ channelLabel(ch), { { uint32_t(ch), 1.f } }, 0.f });
+		}
+	}
+}
+
+void Montage::addCommonAverage() {
+	if (enabledChannels == 0) {
+		throw std::runtime_error("No enabled channels for the common average");
+	}
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		if ((enabledChannels >> ch) & 1) {
+			append(Derivation{ channelLabel(ch) + "-avg", { { uint32_t(ch), 1.f } }, -1.f });
+		}
+	}
+}
+
+void Montage::addBipolar(const std::vector<size_t>& chain) {
+	if (chain.size() < 2) {
+		throw std::runtime_error("Bipolar chain of less than 2 channels");
+	}
+	for (size_t channel : chain) {
+		checkEnabled(channel);
+	}
+	for (size_t k = 0; k + 1 < chain.size(); ++k) {
+		append(Derivation{ channelLabel(chain[k]) + "-" + channelLabel(chain[k + 1]),
+			{ { uint32_t(chain[k]), 1.f }, { uint32_t(chain[k + 1]), -1.f } }, 0.f });
+	}
+}
+
+void Montage::addLaplacian(size_t channel, const std::vector<size_t>& neighbours) {
+	checkEnabled(channel);
+	std::vector<uint32_t> used;
+	for (size_t neighbour : neighbours) {
+		if (neighbour < channelsCount && ((enabledChannels >> neighbour) & 1) && neighbour != channel
+			&& std::find(used.begin(), used.end(), uint32_t(neighbour)) == used.end()) {
+			used.push_back(uint32_t(neighbour));
+		}
+	}
+	if (used.empty()) {
+		throw std::runtime_error("No enabled neighbours for the Laplacian of " + channelLabel(channel));
+	}
+	Derivation derivation{ channelLabel(channel) + "-lap", { { uint32_t(channel), 1.f } }, 0.f };
+	for (uint32_t neighbour : used) {
+		derivation.Weights.emplace_back(neighbour, -1.f / float(used.size()));
+	}
+	append(derivation);
+}
+
+void Montage::addWeights(const std::vector<std::pair<size_t, float>>& weights, const std::string& label) {
+	Derivation derivation{ label.empty() ? "w" + std::to_string(derivations.size() + 1) : label, {}, 0.f };
+	for (const std::pair<size_t, float>& weight : weights) {
+		checkEnabled(weight.first);
+		// repeated channels are summed, so a channel has one weight
+		auto same = std::find_if(derivation.Weights.begin(), derivation.Weights.end(),
+			[&weight](const std::pair<uint32_t, float>& w) { return w.first == weight.first; });
+		if (same != derivation.Weights.end()) same->second += weight.second;
+		else derivation.Weights.emplace_back(uint32_t(weight.first), weight.second);
+	}
+	append(derivation);
+}
+
+void Montage::add(const std::string& definitions) {
+	for (const std::string& definition : split(definitions, ';')) {
+		if (definition.empty()) {
+			continue;
+		}
+		if (definition == "ref") {
+			addReference();
+		}
+		else if (definition == "avg") {
+			addCommonAverage();
+		}
+		else if (definition.find('*') != std::string::npos) {
+			std::vector<std::pair<size_t, float>> weights;
+			for (const std::string& term : split(definition, ',')) {
+				const size_t star = term.find('*');
+				if (star == std::string::npos) {
+					throw std::runtime_error("Bad montage weight: " + term);
+				}
+				weights.emplace_back(channelNumber(term.substr(0, star)), weightValue(term.substr(star + 1)));
+			}
+			addWeights(weights, definition);
+		}
+		else if (definition.find(':') != std::string::npos) {
+			const size_t colon = definition.find(':');
+			std::vector<size_t> neighbours;
+			for (const std::string& neighbour : split(definition.substr(colon + 1), ',')) {
+				neighbours.push_back(channelNumber(neighbour));
+			}
+			addLaplacian(channelNumber(definition.substr(0, colon)), neighbours);
+		}
+		else {
+			std::vector<size_t> chain;
+			for (const std::string& channel : split(definition, '-')) {
+				chain.push_back(channelNumber(channel));
+			}
+			addBipolar(chain);
+		}
+	}
+}
+
+// the derivations by groups of lanes, weight by weight: a weight of a group is its k-th
+// weight of every derived channel of the group, or 0 at channel 0 for the shorter ones
+void Montage::pack() {
+	const size_t lanes = MONTAGE_WIDTH;
+	const size_t groups = (derivations.size() + lanes - 1) / lanes;
+	groupStart.assign(1, 0);
+	columns.clear();
+	weights.clear();
+	meanCoefficients.assign(groups * lanes, 0.f);
+	meanUsed = false;
+	for (size_t g = 0; g < groups; ++g) {
+		size_t longest = 0;
+		for (size_t lane = 0; lane < lanes && g * lanes + lane < derivations.size(); ++lane) {
+			longest = std::max(longest, derivations[g * lanes + lane].Weights.size());
+		}
+		for (size_t k = 0; k < longest; ++k) {
+			for (size_t lane = 0; lane < lanes; ++lane) {
+				const size_t index = g * lanes + lane;
+				const bool used = index < derivations.size() && k < derivations[index].Weights.size();
+				columns.push_back(used ? int32_t(derivations[index].Weights[k].first) : 0);
+				weights.push_back(used ? derivations[index].Weights[k].second : 0.f);
+			}
+		}
+		groupStart.push_back(weights.size());
+		for (size_t lane = 0; lane < lanes && g * lanes + lane < derivations.size(); ++lane) {
+			meanCoefficients[g * lanes + lane] = derivations[g * lanes + lane].Mean;
+			meanUsed = meanUsed || derivations[g * lanes + lane].Mean != 0.f;
+		}
+	}
+}
+
+void Montage::apply(const float* rows, size_t sampleCount, size_t rowStride, float* out, size_t outStride) const {
+	const size_t groups = groupStart.size() - 1;
+	for (size_t i = 0; i < sampleCount; ++i) {
+		const float* x = rows + i * rowStride;
+		float* y = out + i * outStride;
+		float mean = 0.f;
+		if (meanUsed) {
+			for (size_t ch = 0; ch < channelsCount; ++ch) {
+				mean += meanWeights[ch] * x[ch];
+			}
+		}
+		for (size_t g = 0; g < groups; ++g) {
+			const size_t first = g * MONTAGE_WIDTH;
+			const int32_t* c = &columns[groupStart[g]];
+			const float* w = &weights[groupStart[g]];
+			const size_t count = groupStart[g + 1] - groupStart[g];
+#if MONTAGE_WIDTH == 8
+			__m256 acc = _mm256_mul_ps(_mm256_loadu_ps(&meanCoefficients[first]), _mm256_set1_ps(mean));
+			for (size_t k = 0; k < count; k += 8) {
+				const __m256 v = _mm256_i32gather_ps(x, _mm256_loadu_si256((const __m256i*)(c + k)), 4);
+				acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(w + k), v));
+			}
+			// the last group is stored with a mask, so it never writes past the derived channels
+			const int lanes = int(std::min<size_t>(8, derived() - first));
+			if (lanes == 8) {
+				_mm256_storeu_ps(y + first, acc);
+			}
+			else {
+				_mm256_maskstore_ps(y + first, _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)), acc);
+			}
+#elif MONTAGE_WIDTH == 4
+			__m128 acc = _mm_mul_ps(_mm_loadu_ps(&meanCoefficients[first]), _mm_set1_ps(mean));
+			for (size_t k = 0; k < count; k += 4) {
+				const __m128 v = _mm_setr_ps(x[c[k]], x[c[k + 1]], x[c[k + 2]], x[c[k + 3]]);
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(w + k), v));
+			}
+			if (first + 4 <= derived()) {
+				_mm_storeu_ps(y + first, acc);
+			}
+			else {
+				float values[4];
+				_mm_storeu_ps(values, acc);
+				std::copy(values, values + (derived() - first), y + first);
+			}
+#else
+			float acc = meanCoefficients[first] * mean;
+			for (size_t k = 0; k < count; ++k) {
+				acc += w[k] * x[c[k]];
+			}
+			y[first] = acc;
+#endif
+		}
+	}
+}
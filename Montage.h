@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// derived channels (common average, bipolar, Laplacian and custom weighted sums) of sample rows
+// in microvolts, all computed in one pass: the derivations are a sparse matrix plus a multiple
+// of the mean of the enabled channels, so the common average of N channels costs N and not
+// N * N; the sparse part is packed by groups of as many derived channels as a SIMD register
+// holds, a group has the number of weights of its longest derivation, and every weight of a
+// group is one gather of the channel values for all its derived channels (AVX2, SSE4.1 with
+// scalar loads, or scalar code). Channels not in EnabledChannels are never used: the average
+// is of the enabled ones, Laplacian neighbours which are off are left out, other derivations
+// with them are rejected
+class Montage {
+public:
+	enum { MaxChannels = 32 };
+
+	// channelsCount values of a row, enabledChannels bit ch for channel ch as in t_nb2DataSettings
+	Montage(size_t channelsCount, uint32_t enabledChannels = 0xFFFFFFFF);
+
+	// derived channels are appended in the order of the calls, channels are 0-based indices
+	void addReference(); // every enabled channel against the hardware reference, as acquired
+	void addCommonAverage(); // every enabled channel minus the average of the enabled channels
+	void addBipolar(const std::vector<size_t>& chain); // chain[k] - chain[k + 1]
+	void addLaplacian(size_t channel, const std::vector<size_t>& neighbours); // minus their average
+	void addWeights(const std::vector<std::pair<size_t, float>>& weights, const std::string& label = std::string());
+	// definitions separated by ';' with channels numbered from 1: "ref", "avg", "1-2-3" for
+	// the bipolar chain, "5:1,2,3,4" for the Laplacian of 5 and "1*0.5,2*0.5,3*-1" for weights
+	void add(const std::string& definitions);
+	void clear();
+
+	size_t channels() const { return channelsCount; }
+	size_t derived() const { return derivations.size(); }
+	const std::string& label(size_t index) const { return derivations[index].Label; }
+	// nonzero weights of the packed operator with padding, the mean counts as one
+	size_t operations() const { return weights.size() + (meanUsed ? channelsCount : 0); }
+
+	// sampleCount rows of channelsCount values, rowStride apart, into rows of derived() values,
+	// outStride apart
+	void apply(const float* rows, size_t sampleCount, size_t rowStride, float* out, size_t outStride) const;
+
+private:
+	struct Derivation {
+		std::string Label;
+		std::vector<std::pair<uint32_t, float>> Weights;
+		float Mean; // coefficient of the average of the enabled channels
+	};
+
+	void append(const Derivation& derivation);
+	void checkEnabled(size_t channel) const;
+	void pack();
+
+	const size_t channelsCount;
+	const uint32_t enabledChannels;
+	std::vector<float> meanWeights; // 1 / enabled count for the enabled channels
+	std::vector<Derivation> derivations;
+	// packed operator: group g has (groupStart[g + 1] - groupStart[g]) / lanes weights, a weight
+	// is lanes columns and values, one of every derived channel of the group; padding weights are 0
+	std::vector<size_t> groupStart;
+	std::vector<int32_t> columns;
+	std::vector<float> weights;
+	std::vector<float> meanCoefficients; // [groups * lanes]
+	bool meanUsed;
+};
@@ -0,0 +1,587 @@
+#include "Acquisition.h"
+#include "ArtifactDetector.h"
+#include "BandPower.h"
+#include "BatchProcessor.h"
+#include "ClockSync.h"
+#include "Connectivity.h"
+#include "Decimator.h"
+#include "EegCodec.h"
+#include "EnvelopePyramid.h"
+#include "IirFilter.h"
+#include "MappedRecording.h"
+#include "Montage.h"
+#include "Nb2Device.h"
+#include "Nb2Format.h"
+#include "SampleBlock.h"
+#include "SampleConverter.h"
+#include "SampleExport.h"
+#include "SignalStats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// benchmark of the sample processing kernels on synthetic 16 and 21 channel blocks of
+// 0.5 second at every Nb2Rate, shaped like nb2GetData output, and of the parsing and
+// formatting helpers; no device is used. Results are printed as a table and, with a file
+// name argument, written as JSON for comparison between releases. Regression checks of
+// the kernels run first, a failed one ends the program with an error.
+// With --polls the only check is that steady state polls of the acquisition worker on the
+// first found device (the simulator with NB2SIM_SPEED=0 or a real one) do not allocate
+
+// every allocation of the program is counted, only the differences are used
+static std::atomic<size_t> allocations(0);
+
+// an inlined delete would pair free with operator new for the GCC mismatch warning
+#if defined(__GNUC__)
+	#define NOT_INLINED __attribute__((noinline))
+#else
+	#define NOT_INLINED
+#endif
+
+void* operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+NOT_INLINED void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+NOT_INLINED void operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+namespace {
+
+const std::chrono::milliseconds MinRunTime(100);
+const int Runs = 3;
+volatile size_t sink; // results are stored, so the kernels are not optimized away
+
+struct BenchResult {
+	std::string Kernel;
+	size_t Channels; // 0 for the helpers
+	int Rate;
+	size_t Rows;     // rows per block
+	double Nanoseconds; // per sample row, or per call of the helpers
+	double GigabytesPerSecond; // of input rows, 0 for the helpers
+};
+
+int rateHz(Nb2Rate rate) {
+	return rate == Hz125 ? 125 : rate == Hz250 ? 250 : rate == Hz500 ? 500 : 1000;
+}
+
+void check(bool condition, const std::string& what) {
+	if (!condition) {
+		throw std::runtime_error("Check failed: " + what);
+	}
+}
+
+// DC offset, 10 Hz rhythm and noise in ADC bits, the counter in the last word
+std::vector<int32_t> syntheticRows(size_t channelsCount, size_t rows, int rate) {
+	const size_t sampleSize = channelsCount + 2;
+	std::vector<int32_t> data(rows * sampleSize);
+	uint32_t noise = 12345;
+	for (size_t i = 0; i < rows; ++i) {
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			noise = noise * 1664525u + 1013904223u;
+			const double wave = 2000. * std::sin(2. * 3.14159265358979 * 10. * double(i) / rate + double(ch));
+			data[i * sampleSize + ch] = int32_t(100000 * int(ch) - 1000000 + int(wave) + int(noise >> 24));
+		}
+		data[i * sampleSize + channelsCount] = 0;
+		data[i * sampleSize + channelsCount + 1] = int32_t(i + (i > rows / 2 ? 3 : 0)); // one gap
+	}
+	return data;
+}
+
+// the best of Runs of nanoseconds per item, every run repeats the call for MinRunTime
+double nanosecondsPer(size_t items, const std::function<void()>& call) {
+	double best = std::numeric_limits<double>::max();
+	for (int run = 0; run < Runs; ++run) {
+		size_t calls = 0;
+		const auto start = std::chrono::steady_clock::now();
+		auto now = start;
+		do {
+			for (int i = 0; i < 16; ++i) call();
+			calls += 16;
+			now = std::chrono::steady_clock::now();
+		} while (now - start < MinRunTime);
+		const double ns = std::chrono::duration<double, std::nano>(now - start).count();
+		best = std::min(best, ns / double(calls * items));
+	}
+	return best;
+}
+
+class Suite {
+public:
+	// kernel over one block of rows
+	void block(const std::string& kernel, size_t channelsCount, int rate, size_t rows, const std::function<void()>& call) {
+		const double ns = nanosecondsPer(rows, call);
+		add(BenchResult{ kernel, channelsCount, rate, rows, ns, double((channelsCount + 2) * sizeof(int32_t)) / ns });
+	}
+	// long job of rows, the best of Runs single calls
+	void job(const std::string& kernel, size_t channelsCount, int rate, size_t rows, const std::function<void()>& call) {
+		double best = std::numeric_limits<double>::max();
+		for (int run = 0; run < Runs; ++run) {
+			const auto start = std::chrono::steady_clock::now();
+			call();
+			best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / double(rows));
+		}
+		add(BenchResult{ kernel, channelsCount, rate, rows, best, double((channelsCount + 2) * sizeof(int32_t)) / best });
+	}
+	// helper call
+	void call(const std::string& kernel, const std::function<void()>& call) {
+		add(BenchResult{ kernel, 0, 0, 0, nanosecondsPer(1, call), 0. });
+	}
+
+	void writeJson(const std::string& path) const {
+		std::ofstream file(path);
+		if (!file) {
+			throw std::runtime_error("Cannot create " + path);
+		}
+		file << "{\n  \"benchmark\": \"NB2Bench\",\n  \"results\": [";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const BenchResult& r = results[i];
+			file << (i ? ",\n" : "\n") << "    {\"kernel\": \"" << r.Kernel << "\", \"channels\": " << r.Channels
+				<< ", \"rate\": " << r.Rate << ", \"rows\": " << r.Rows << ", \"unit\": \""
+				<< (r.Rows ? "sample" : "call") << "\", \"ns\": " << std::setprecision(4) << r.Nanoseconds
+				<< ", \"gb_per_s\": " << r.GigabytesPerSecond << "}";
+		}
+		file << "\n  ]\n}\n";
+		if (!file) {
+			throw std::runtime_error("Cannot write " + path);
+		}
+	}
+
+private:
+	void add(const BenchResult& r) {
+		std::cout << std::left << std::setw(28) << r.Kernel << std::right << std::setw(4) << r.Channels
+			<< std::setw(6) << r.Rate << std::fixed << std::setprecision(2) << std::setw(12) << r.Nanoseconds
+			<< std::setw(10) << r.GigabytesPerSecond << std::endl;
+		results.push_back(r);
+	}
+
+	std::vector<BenchResult> results;
+};
+
+void benchBlocks(Suite& suite, size_t channelsCount, Nb2Rate dataRate) {
+	const int rate = rateHz(dataRate);
+	const size_t rows = size_t(rate / 2);
+	const size_t sampleSize = channelsCount + 2;
+	const std::vector<int32_t> data = syntheticRows(channelsCount, rows, rate);
+	const int32_t* in = data.data();
+
+	const std::unique_ptr<SampleBlockKernels> generic = SampleBlockKernels::create(channelsCount, true);
+	const std::unique_ptr<SampleBlockKernels> specialized = SampleBlockKernels::create(channelsCount);
+	std::vector<int32_t> minimum(channelsCount, std::numeric_limits<int32_t>::max());
+	std::vector<int32_t> maximum(channelsCount, std::numeric_limits<int32_t>::min());
+	std::vector<int32_t> planes(channelsCount * rows);
+	for (const SampleBlockKernels* kernels : { generic.get(), specialized.get() }) {
+		const std::string kind = kernels->specialized() ? " (specialized)" : " (generic)";
+		suite.block("lost samples" + kind, channelsCount, rate, rows, [&] {
+			size_t expected = 0;
+			sink += kernels->lostSamples(in, rows, expected);
+		});
+		suite.block("min/max" + kind, channelsCount, rate, rows, [&] { kernels->minMax(in, rows, minimum.data(), maximum.data()); });
+	}
+	suite.block("deinterleave", channelsCount, rate, rows, [&] { generic->deinterleave(in, rows, planes.data(), rows); });
+	sink += size_t(maximum[0] - minimum[0]) + size_t(planes[rows - 1]);
+
+	// peak-to-peak amplitude and the other statistics of the demo
+	SignalStats stats(channelsCount);
+	suite.block("signal stats", channelsCount, rate, rows, [&] {
+		stats.reset();
+		stats.accumulate(in, rows, sampleSize);
+		sink += size_t(stats.peakToPeak(0));
+	});
+
+	t_nb2Property property;
+	property.Rate = float(rate);
+	property.Range = 0.15f;
+	property.Resolution = 0.15f / 8388608.f;
+	ArtifactDetector artifacts(channelsCount, property);
+	suite.block("artifact detector", channelsCount, rate, rows, [&] { sink += artifacts.push(in, rows, sampleSize); });
+
+	const SampleConverter converter(channelsCount, 0.0286f);
+	std::vector<float> microvolts(channelsCount * rows);
+	std::vector<uint32_t> counters(rows);
+	suite.block("convert rows", channelsCount, rate, rows, [&] { converter.convertRows(in, rows, sampleSize, microvolts.data()); });
+	suite.block("convert planar", channelsCount, rate, rows, [&] {
+		converter.convertPlanar(in, rows, sampleSize, microvolts.data(), rows, counters.data());
+	});
+
+	FilterSettings filterSettings;
+	filterSettings.HighPass = 1.f;
+	filterSettings.LowPass = 40.f;
+	filterSettings.Notch = 50.f;
+	FilterBank filter(filterSettings, channelsCount, dataRate);
+	std::vector<float> rowsUv(channelsCount * rows);
+	converter.convertRows(in, rows, sampleSize, rowsUv.data());
+	suite.block("filter hp+lp+notch", channelsCount, rate, rows, [&] { filter.process(rowsUv.data(), rows, channelsCount); });
+
+	BandPower bands(channelsCount, dataRate);
+	converter.convertPlanar(in, rows, sampleSize, microvolts.data(), rows);
+	suite.block("band power", channelsCount, rate, rows, [&] { sink += bands.push(microvolts.data(), rows, rows); });
+
+	Connectivity::Settings covarianceOnly;
+	covarianceOnly.BandsCount = 0;
+	Connectivity covariance(channelsCount, dataRate, covarianceOnly);
+	suite.block("covariance", channelsCount, rate, rows, [&] { sink += covariance.push(rowsUv.data(), rows, channelsCount); });
+	Connectivity connectivity(channelsCount, dataRate);
+	suite.block("covariance+coherence", channelsCount, rate, rows, [&] { sink += connectivity.push(rowsUv.data(), rows, channelsCount); });
+
+	// common average of all channels and a bipolar chain through them, 2 * channelsCount - 1 derived channels
+	Montage montage(channelsCount);
+	montage.addCommonAverage();
+	std::vector<size_t> chain(channelsCount);
+	for (size_t ch = 0; ch < channelsCount; ++ch) chain[ch] = ch;
+	montage.addBipolar(chain);
+	std::vector<float> derived(montage.derived() * rows);
+	suite.block("montage avg+bipolar", channelsCount, rate, rows, [&] {
+		montage.apply(rowsUv.data(), rows, channelsCount, derived.data(), montage.derived());
+	});
+
+	EnvelopePyramid envelope(channelsCount);
+	suite.block("envelope push", channelsCount, rate, rows, [&] {
+		if (envelope.size() >= (size_t(1) << 20)) envelope.reset(); // the capacity is kept
+		envelope.push(microvolts.data(), rows, rows);
+	});
+	Decimator decimator(channelsCount, size_t(rate / 125));
+	std::vector<float> display(channelsCount * (rows / decimator.factor() + 1));
+	suite.block("decimate to 125 Hz", channelsCount, rate, rows, [&] {
+		sink += decimator.process(microvolts.data(), rows, rows, display.data(), rows / decimator.factor() + 1);
+	});
+
+	EegCodec codec;
+	std::vector<uint8_t> encoded;
+	suite.block("codec encode", channelsCount, rate, rows, [&] {
+		encoded.clear();
+		sink += codec.encode(in, rows, sampleSize, encoded);
+	});
+	std::vector<int32_t> decoded(data.size());
+	suite.block("codec decode", channelsCount, rate, rows, [&] {
+		sink += codec.decode(encoded.data(), encoded.size(), decoded.data(), sampleSize, rows);
+	});
+
+	// formatting and buffered writes to the null device, the held block is written by the next call
+#ifdef _WIN32
+	const char* const nullDevice = "NUL";
+#else
+	const char* const nullDevice = "/dev/null";
+#endif
+	SampleExporter csv(nullDevice, SampleExporter::Csv, converter, sampleSize, rows);
+	suite.block("export csv", channelsCount, rate, rows, [&] { csv.write(in, rows); });
+	SampleExporter binary(nullDevice, SampleExporter::Binary, converter, sampleSize, rows);
+	suite.block("export binary", channelsCount, rate, rows, [&] { binary.write(in, rows); });
+}
+
+// one hour of one channel at 1000 Hz drawn into a row of 1920 pixels
+void benchEnvelopeRender(Suite& suite) {
+	const size_t Samples = 3600 * 1000;
+	const size_t Pixels = 1920;
+	std::vector<float> signal(Samples);
+	for (size_t i = 0; i < Samples; ++i) {
+		signal[i] = float(50. * std::sin(2. * 3.14159265358979 * 10. * double(i) / 1000.) + double(i % 997) * 0.01);
+	}
+	EnvelopePyramid envelope(1);
+	envelope.push(signal.data(), Samples, Samples);
+	std::vector<float> minimum(Pixels), maximum(Pixels);
+	suite.call("envelope render 1 h 1920 px", [&] { sink += envelope.render(0, 0, Samples, Pixels, minimum.data(), maximum.data()); });
+	suite.call("envelope render 1 s 1920 px", [&] { sink += envelope.render(0, Samples / 2, Samples / 2 + 1000, Pixels, minimum.data(), maximum.data()); });
+}
+
+// the same 8 recording files of 20 s to 160 s (21 channels at 250 Hz, 20 s chunks, filtered)
+// on 1, 2, 4, ... threads up to the hardware threads, at least 4; the files are written to
+// the current directory and removed
+void benchBatch(Suite& suite) {
+	const size_t ChannelsCount = 21;
+	const int Rate = 250;
+	RecordingWriter::Header header = RecordingWriter::Header();
+	header.Property.Rate = float(Rate);
+	header.Property.Range = 0.15f;
+	header.Property.Resolution = header.Property.Range / 8388608.f;
+	header.ChannelsCount = ChannelsCount;
+	header.EnabledChannels = (1u << ChannelsCount) - 1;
+	std::vector<std::string> paths;
+	size_t rows = 0;
+	for (size_t file = 0; file < 8; ++file) {
+		paths.push_back("nb2bench." + std::to_string(file) + ".nbr");
+		const std::vector<int32_t> data = syntheticRows(ChannelsCount, (file + 1) * 20 * Rate, Rate);
+		RecordingWriter writer(paths.back(), header);
+		writer.write(data.data(), data.size() / (ChannelsCount + 2));
+		writer.close();
+		rows += data.size() / (ChannelsCount + 2);
+	}
+	const size_t hardware = std::max<size_t>(4, std::thread::hardware_concurrency());
+	for (size_t threads = 1; threads <= hardware; threads *= 2) {
+		BatchProcessor::Settings settings;
+		settings.Filter.HighPass = 0.5f;
+		settings.Filter.LowPass = 40.f;
+		settings.Filter.Notch = 50.f;
+		settings.ChunkSeconds = 20.f;
+		settings.ThreadsCount = threads;
+		BatchProcessor batch(settings);
+		suite.job("batch " + std::to_string(threads) + " threads", ChannelsCount, Rate, rows, [&] {
+			batch.run(paths, [](const BatchProcessor::FileSummary& file) {
+				check(file.Error.empty(), "batch " + file.Path + ": " + file.Error);
+				sink += size_t(file.Samples);
+			});
+		});
+	}
+	for (const std::string& path : paths) {
+		std::remove(path.c_str());
+	}
+}
+
+// a 40 ms block with up to 4 ms of delivery jitter per call, a fit every 25 calls
+void benchClockSync(Suite& suite) {
+	ClockSync sync(1000.);
+	uint32_t counter = 0;
+	std::chrono::steady_clock::time_point time;
+	uint32_t noise = 12345;
+	suite.call("clock sync add", [&] {
+		counter += 40;
+		time += std::chrono::milliseconds(40);
+		noise = noise * 1664525u + 1013904223u;
+		sink += sync.add(counter, time + std::chrono::microseconds(noise >> 20)) ? 1 : 0;
+	});
+}
+
+void benchHelpers(Suite& suite) {
+	const std::string channels = "1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21";
+	int bytes = 2100;
+	suite.call("itemCount", [&] { sink += size_t(itemCount(bytes, sizeof(int32_t))); bytes ^= 4; });
+	suite.call("enabledChannelsArg", [&] { sink += enabledChannelsArg(channels); });
+	suite.call("dataRateArg", [&] { sink += size_t(dataRateArg("1000")); });
+	suite.call("versionPrettyStringFirmware", [&] { sink += versionPrettyStringFirmware(0x0001000200000457ull).size(); });
+	suite.call("versionPrettyStringDll", [&] { sink += versionPrettyStringDll(0x0001000200030004ull).size(); });
+	t_nb2Date date;
+	date.Day = 2;
+	date.Month = 4;
+	date.Year = 2022;
+	suite.call("datePrettyString", [&] { sink += datePrettyString(date).size(); });
+	suite.call("modelPrettyString", [&] { sink += modelPrettyString(1902).size(); });
+	suite.call("eventTypePrettyString", [&] { sink += eventTypePrettyString(EvActivity).size(); });
+}
+
+// hp 0.5 + lp 70 + notch 50 at 1000 Hz on a 10 Hz sine on a 10 mV offset of raw ADC codes,
+// then a DC step: the passband amplitude is kept and the offsets are removed
+void checkFilterOffset() {
+	const int Rate = 1000;
+	const double Offset = 559000.;
+	const double Amplitude = 1117.;
+	FilterSettings settings;
+	settings.HighPass = 0.5f;
+	settings.LowPass = 70.f;
+	settings.Notch = 50.f;
+	FilterBank filter(settings, 1, Hz1000);
+	std::vector<int32_t> block(Rate);
+	for (int second = 0; second < 100; ++second) {
+		const double offset = second < 50 ? Offset : Offset - 200000.; // the step after 50 s
+		for (int i = 0; i < Rate; ++i) {
+			block[i] = int32_t(std::lrint(offset + Amplitude * std::sin(2. * 3.14159265358979 * 10. * i / Rate)));
+		}
+		filter.process(block.data(), Rate, 1);
+		if (second == 49 || second == 99) {
+			const auto range = std::minmax_element(block.begin(), block.end());
+			const double peakToPeak = double(*range.second - *range.first);
+			double mean = 0.;
+			for (const int32_t value : block) mean += value;
+			mean /= Rate;
+			const std::string when = second == 49 ? " at 1000 Hz" : " 50 s after a DC step";
+			check(std::fabs(peakToPeak - 2. * Amplitude) < 0.01 * 2. * Amplitude,
+				"filter p-p " + std::to_string(peakToPeak) + when);
+			check(std::fabs(mean) < 2., "filter offset " + std::to_string(mean) + when);
+		}
+	}
+}
+
+// two channels sharing only a 10 Hz sine (10 uV) in independent noise (about 6 uV rms):
+// coherent in the alpha band, the sine does not leak into the beta band
+void checkCoherenceLeak() {
+	for (const Nb2Rate rate : { Hz250, Hz1000 }) {
+		const int fs = rateHz(rate);
+		Connectivity connectivity(2, rate);
+		std::vector<float> rows(2 * 20 * fs);
+		uint32_t noise = 12345;
+		for (size_t i = 0; i < rows.size() / 2; ++i) {
+			const float wave = float(10. * std::sin(2. * 3.14159265358979 * 10. * double(i) / fs));
+			for (size_t ch = 0; ch < 2; ++ch) {
+				noise = noise * 1664525u + 1013904223u;
+				rows[2 * i + ch] = wave + float(noise >> 8) / float(1 << 24) * 20.f - 10.f;
+			}
+		}
+		connectivity.push(rows.data(), rows.size() / 2, 2);
+		const std::string when = " at " + std::to_string(fs) + " Hz";
+		check(connectivity.coherence(2, 0, 1) > 0.9, "alpha coherence " + std::to_string(connectivity.coherence(2, 0, 1)) + when);
+		check(connectivity.coherence(3, 0, 1) < 0.1, "beta coherence " + std::to_string(connectivity.coherence(3, 0, 1)) + when);
+	}
+}
+
+// random blocks of 1 to 24 channels and 1 to 200 rows, whole and partial groups, with values
+// of 1 to 32 bits, full scale alternations (the widest residuals, 33 bits), constant columns
+// and counter gaps and resets decode to the same rows; the blocks end at every byte of an
+// 8 byte word, the last residuals are read with the padding, and each is decoded from a
+// buffer of its exact size
+void checkCodecRoundTrip() {
+	EegCodec codec;
+	uint32_t random = 2024;
+	const auto next = [&random] { random = random * 1664525u + 1013904223u; return random ^ (random >> 15); };
+	bool endings[8] = {};
+	for (uint32_t round = 0; round < 400; ++round) {
+		const size_t channelsCount = 1 + next() % 24;
+		const size_t sampleSize = channelsCount + 2;
+		const size_t rows = 1 + next() % 200;
+		std::vector<int32_t> data(rows * sampleSize);
+		uint32_t counter = next();
+		for (size_t i = 0; i < rows; ++i) {
+			int32_t* row = data.data() + i * sampleSize;
+			for (size_t ch = 0; ch < channelsCount; ++ch) {
+				switch (round % 4) {
+				case 0: row[ch] = int32_t(next()) >> (round / 4 % 32); break;
+				case 1: row[ch] = (i + ch) % 2 ? std::numeric_limits<int32_t>::max() : std::numeric_limits<int32_t>::min(); break;
+				case 2: row[ch] = int32_t(next() % 2001) - 1000 + int32_t(ch) * 100000; break;
+				default: row[ch] = int32_t(ch) - 8; break;
+				}
+			}
+			row[channelsCount] = int32_t(next() % 4);
+			if (next() % 40 == 0) {
+				counter = next() % 2 ? 0 : counter + next() % 1000;
+			}
+			row[channelsCount + 1] = int32_t(counter++);
+		}
+		const std::string what = " of " + std::to_string(rows) + " rows of " + std::to_string(channelsCount) + " channels";
+		std::vector<uint8_t> encoded;
+		const size_t bytes = codec.encode(data.data(), rows, sampleSize, encoded);
+		const std::vector<uint8_t> block(encoded); // exact size
+		EegCodec::BlockInfo info;
+		check(bytes == block.size() && EegCodec::peek(block.data(), block.size(), info)
+			&& info.SampleCount == rows && info.SampleSize == sampleSize && info.Bytes == bytes, "codec block header" + what);
+		std::vector<int32_t> decoded(rows * sampleSize, -1);
+		check(codec.decode(block.data(), block.size(), decoded.data(), sampleSize, rows) == bytes, "codec block size" + what);
+		check(decoded == data, "codec round trip" + what);
+		endings[bytes % 8] = true;
+	}
+	check(std::all_of(std::begin(endings), std::end(endings), [](bool seen) { return seen; }), "codec block endings");
+}
+
+// the instantiations of a model give the same results as the run time one
+void checkSampleBlockKernels() {
+	for (const size_t channelsCount : { size_t(16), size_t(21) }) {
+		const size_t rows = 1000;
+		const std::vector<int32_t> data = syntheticRows(channelsCount, rows, 1000);
+		const std::unique_ptr<SampleBlockKernels> generic = SampleBlockKernels::create(channelsCount, true);
+		const std::unique_ptr<SampleBlockKernels> specialized = SampleBlockKernels::create(channelsCount);
+		std::vector<int32_t> minimum[2], maximum[2];
+		size_t lost[2];
+		const SampleBlockKernels* kernels[2] = { generic.get(), specialized.get() };
+		for (int k = 0; k < 2; ++k) {
+			minimum[k].assign(channelsCount, std::numeric_limits<int32_t>::max());
+			maximum[k].assign(channelsCount, std::numeric_limits<int32_t>::min());
+			size_t expected = 0;
+			lost[k] = kernels[k]->lostSamples(data.data(), rows, expected);
+			kernels[k]->minMax(data.data(), rows, minimum[k].data(), maximum[k].data());
+		}
+		const std::string what = " of " + std::to_string(channelsCount) + " channels";
+		check(lost[0] == lost[1], "lost samples" + what);
+		check(minimum[0] == minimum[1] && maximum[0] == maximum[1], "min/max" + what);
+	}
+}
+
+// the acquisition worker with metrics on the first found device, the rings are emptied as
+// the demo does; polls after the first 100 must not allocate
+void checkPollAllocations() {
+	const uint64_t WarmUpPolls = 100;
+	const uint64_t CheckedPolls = 1000;
+	Nb2Status(nb2ApiInit(), "nb2ApiInit").check();
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (nb2GetCount() == 0) {
+		check(std::chrono::steady_clock::now() < deadline, "poll allocations: no device found");
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	{
+		Nb2Device device = Nb2Device::openIndex(0).value();
+		const t_nb2Property prop = device.property().value();
+		const t_nb2Possibility poss = device.possibility().value();
+		const size_t sampleSize = poss.ChannelsCount + 2;
+		DeviceMetrics metrics(device.serialNumber().valueOr(0));
+		AcquisitionWorker worker(device.id(), sampleSize, prop.Rate, AcquisitionWorker::Settings(), &metrics);
+		std::vector<int32_t> data(size_t(prop.Rate) * sampleSize);
+		t_nb2Event events[100];
+		device.start().check();
+		worker.start();
+		size_t before = 0;
+		uint64_t firstPoll = 0;
+		while (worker.error() == 0 && (firstPoll == 0 || worker.polls() < firstPoll + CheckedPolls)) {
+			if (firstPoll == 0 && worker.polls() >= WarmUpPolls) {
+				firstPoll = worker.polls();
+				before = allocations.load();
+			}
+			worker.data().read(data.data(), data.size());
+			worker.events().read(events, 100);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		const size_t allocated = allocations.load() - before;
+		const uint64_t polls = worker.polls() - firstPoll;
+		worker.stop();
+		worker.status().check();
+		std::cout << "poll allocations: " << allocated << " in " << polls << " polls" << std::endl;
+		check(allocated == 0, "poll allocations: " + std::to_string(allocated) + " in " + std::to_string(polls) + " polls");
+	}
+	Nb2Status(nb2ApiDone(), "nb2ApiDone").check();
+}
+
+} // namespace
+
+// NB2Bench [--polls | results.json]
+int main(int argc, const char* argv[]) {
+	try {
+		if (argc > 1 && std::string(argv[1]) == "--polls") {
+			checkPollAllocations();
+			return 0;
+		}
+		checkFilterOffset();
+		checkSampleBlockKernels();
+		checkCodecRoundTrip();
+		checkCoherenceLeak();
+		std::cout << "NB2Bench - 0.5 second blocks, ns per sample row or per call (best of " << Runs
+			<< " runs), GB/s of input rows" << std::endl;
+		std::cout << "kernel                        ch  rate          ns      GB/s" << std::endl;
+		Suite suite;
+		for (const size_t channelsCount : { size_t(16), size_t(21) }) {
+			for (const Nb2Rate rate : { Hz125, Hz250, Hz500, Hz1000 }) {
+				benchBlocks(suite, channelsCount, rate);
+			}
+		}
+		benchEnvelopeRender(suite);
+		benchBatch(suite);
+		benchClockSync(suite);
+		benchHelpers(suite);
+		if (argc > 1) {
+			suite.writeJson(argv[1]);
+			std::cout << "Results written to " << argv[1] << std::endl;
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cerr << ex.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
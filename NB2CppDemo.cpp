@@ -1,19 +1,69 @@
 #include <nb2mcs/nb2mcs.h>
+#include "Acquisition.h"
+#include "ArtifactDetector.h"
+#include "BandPower.h"
+#include "BatchProcessor.h"
+#include "BdfWriter.h"
+#include "ClockSync.h"
+#include "Connectivity.h"
+#include "Decimator.h"
+#include "DeviceConnection.h"
+#include "EegCodec.h"
+#include "EnvelopePyramid.h"
+#include "EpochAverager.h"
+#include "IirFilter.h"
+#include "MappedRecording.h"
+#include "Metrics.h"
+#include "Montage.h"
+#include "Nb2Device.h"
+#include "Nb2Format.h"
+#include "SampleBlock.h"
+#include "SampleConverter.h"
+#include "SampleExport.h"
+#include "SharedBus.h"
+#include "StreamServer.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <future>
+#include <thread>
+#include <vector>
 
 // command line arguments processing
 // settings passed by command line arguments
 struct ProgramSettings {
-	enum ProgramMode { Eeg, Impedance, Status, Help, StartRecord, StopRecord };
+	enum ProgramMode { Eeg, Impedance, Status, Help, StartRecord, StopRecord, Record, Multi, Publish, Subscribe, Archive, Serve, StreamBench, Capture, Inspect, Batch, Export };
 	ProgramSettings() :
-		Mode(Eeg), DataRate(Hz125), InputRange(Mv150), EnabledChannels(0x001FFFFF) {}
+		Mode(Eeg), DataRate(Hz125), InputRange(Mv150), EnabledChannels(0x001FFFFF), Target("record.bdf"), Bands(false), Erp(false), Artifacts(false), Envelope(false), Connectivity(false), Clock(false), Clients(8), Threads(0), ExportFormat(SampleExporter::Csv) {}
 	ProgramMode Mode;
 	Nb2Rate DataRate;
 	Nb2Range InputRange;
 	uint32_t EnabledChannels;
+	std::string Target;
+	FilterSettings Filter;
+	std::string Metrics;
+	std::string Montage;
+	bool Bands;
+	bool Erp;
+	bool Artifacts;
+	bool Envelope;
+	bool Connectivity;
+	bool Clock;
+	size_t Clients;
+	size_t Threads;
+	SampleExporter::Format ExportFormat;
 };
 
 ProgramSettings::ProgramMode modeArg(const std::string& mode) {
@@ -22,47 +72,89 @@ ProgramSettings::ProgramMode modeArg(const std::string& mode) {
 	if (mode == "status") return ProgramSettings::ProgramMode::Status;
 	if (mode == "start-record") return ProgramSettings::ProgramMode::StartRecord;
 	if (mode == "stop-record") return ProgramSettings::ProgramMode::StopRecord;
+	if (mode == "record") return ProgramSettings::ProgramMode::Record;
+	if (mode == "multi") return ProgramSettings::ProgramMode::Multi;
+	if (mode == "publish") return ProgramSettings::ProgramMode::Publish;
+	if (mode == "subscribe") return ProgramSettings::ProgramMode::Subscribe;
+	if (mode == "archive") return ProgramSettings::ProgramMode::Archive;
+	if (mode == "serve") return ProgramSettings::ProgramMode::Serve;
+	if (mode == "stream-bench") return ProgramSettings::ProgramMode::StreamBench;
+	if (mode == "capture") return ProgramSettings::ProgramMode::Capture;
+	if (mode == "inspect") return ProgramSettings::ProgramMode::Inspect;
+	if (mode == "batch") return ProgramSettings::ProgramMode::Batch;
+	if (mode == "export") return ProgramSettings::ProgramMode::Export;
 	if (mode == "help" || mode == "--help" || mode == "-h")
 		return ProgramSettings::ProgramMode::Help;
-	throw std::exception(("Unknown program mode: " + mode).c_str());
+	throw std::runtime_error("Unknown program mode: " + mode);
 }
 
-Nb2Rate dataRateArg(const std::string& rate) {
-	if (rate == "125")  return Hz125;
-	if (rate == "250")  return Hz250;
-	if (rate == "500")  return Hz500;
-	if (rate == "1000") return Hz1000;
-	throw std::exception(("Unknown rate: " + rate).c_str());
+SampleExporter::Format exportFormatArg(const std::string& format) {
+	if (format == "csv") return SampleExporter::Csv;
+	if (format == "binary") return SampleExporter::Binary;
+	throw std::runtime_error("Unknown export format: " + format);
 }
 
-Nb2Range inputRangeArg(const std::string& range) {
-	if (range == "150") return Mv150;
-	if (range == "300") return Mv300;
-	throw std::exception(("Unknown range: " + range).c_str());
+FilterSettings filterArg(const std::string& filter) {
+	FilterSettings sets;
+	std::istringstream values(filter);
+	std::string value;
+	if (std::getline(values, value, ',') && !value.empty()) sets.HighPass = std::stof(value);
+	if (std::getline(values, value, ',') && !value.empty()) sets.LowPass = std::stof(value);
+	if (std::getline(values, value, ',') && !value.empty()) sets.Notch = std::stof(value);
+	if (sets.HighPass < 0 || sets.LowPass < 0 || sets.Notch < 0) throw std::runtime_error("Bad filter: " + filter);
+	return sets;
 }
 
-uint32_t enabledChannelsArg(const std::string& channels) {
-	uint32_t enabled = 0;
-	std::string::size_type offset = 0;
-	std::string::size_type pos = std::string(channels).find(',');
-	while (offset != std::string::npos) {
-		enabled |= 1 << (std::stoi(channels.substr(offset, pos - offset)) - 1);
-		offset = pos < std::string::npos ? pos + 1 : pos;
-		pos = std::string(channels).find(',', offset);
-	}
-	return enabled;
+// options start with -- and follow the positional arguments
+int positionalCount(int argc, const char* argv[]) {
+	int count = 1;
+	while (count < argc && std::strncmp(argv[count], "--", 2) != 0) ++count;
+	return count;
 }
 
 void showUsage() {
 	std::cout << "NB2CppDemo - demo program for working with the NB2 device" << std::endl;
 	std::cout << "Medical Computer Systems Ltd., 2022" << std::endl << std::endl;
 	std::cout << "Usage: " << std::endl;
-	std::cout << "NB2CppDemo.exe <mode> <data-rate> <input-range> <chs-enabled>" << std::endl;
-	std::cout << " <mode>         working mode: eeg (default), impedance, status, start-record, stop-record or help" << std::endl;
+	std::cout << "NB2CppDemo.exe <mode> <data-rate> <input-range> <chs-enabled> <target> [--filter=<hp>,<lp>,<notch>] [--metrics=<target>] [--bands]" << std::endl;
+	std::cout << "                   [--erp] [--artifacts] [--envelope] [--connectivity] [--montage=<derivations>] [--clock] [--clients=<n>] [--threads=<n>] [--format=<csv|binary>]" << std::endl;
+	std::cout << " <mode>         working mode: eeg (default), impedance, status, start-record, stop-record, record, multi," << std::endl;
+	std::cout << "               publish, subscribe, archive, serve, stream-bench, capture, inspect, batch, export or help" << std::endl;
 	std::cout << " <data-rate>    eeg sampling rate in herz: 125 (default), 250, 500 or 1000" << std::endl;
 	std::cout << " <input-range>  adc input range in mV: 150 (default) or 300" << std::endl;
 	std::cout << " <chs-enabled>  comma-separated numbers of channels that ase used for eeg/impedance asquisition;" << std::endl;
 	std::cout << "                all channels are enabled by default; space in enumeration are not allowed" << std::endl;
+	std::cout << " <target>       record mode: BDF+ file on the host, record.bdf by default;" << std::endl;
+	std::cout << "                multi mode: device settings file with '<serial> <data-rate> <input-range> <chs-enabled>' lines," << std::endl;
+	std::cout << "                devices.cfg by default, devices not listed use the command line settings;" << std::endl;
+	std::cout << "                publish and subscribe modes: shared memory sample bus name, nb2bus by default;" << std::endl;
+	std::cout << "                archive mode: losslessly compressed samples file on the host, record.nbz by default;" << std::endl;
+	std::cout << "                capture and inspect modes: memory-mapped recording file with a seek index, record.nbr by default;" << std::endl;
+	std::cout << "                batch mode: directory of the recording files, the current one by default;" << std::endl;
+	std::cout << "                export mode: file of every sample row and event, - (stdout, messages go to stderr) by default;" << std::endl;
+	std::cout << "                serve and stream-bench modes: TCP address <host>:<port> of the stream, 127.0.0.1:5555 by default" << std::endl;
+	std::cout << " --filter       high-pass, low-pass and notch frequencies in Hz of the eeg p-p and batch filter, e.g. 0.5,70,50;" << std::endl;
+	std::cout << "                empty or 0 value turns the filter off, no filtering by default; samples are recorded unfiltered" << std::endl;
+	std::cout << " --metrics      eeg, record, publish, archive, serve, capture and multi modes: acquisition metrics in Prometheus text format every 5 seconds" << std::endl;
+	std::cout << "                into a file or, for unix:<path>, to clients of a Unix domain socket" << std::endl;
+	std::cout << " --bands        eeg, record, publish, archive, serve and capture modes: delta, theta, alpha and beta power over 4 seconds in uV^2" << std::endl;
+	std::cout << " --erp          eeg, record, publish, archive, serve and capture modes: average of the epochs from -0.2 to 0.8 s" << std::endl;
+	std::cout << "                around every event, by event type, baseline corrected" << std::endl;
+	std::cout << " --artifacts    eeg, record, publish, archive, serve and capture modes: channels near the adc limit, disconnected, flat," << std::endl;
+	std::cout << "                with jumps or high-amplitude bursts in 0.25 s windows; with --erp such epochs are rejected" << std::endl;
+	std::cout << " --envelope     eeg, record, publish, archive, serve and capture modes: min/max envelope of the whole session in 8 columns" << std::endl;
+	std::cout << "                and the 125 Hz display stream of the filtered samples" << std::endl;
+	std::cout << " --connectivity eeg, record, publish, archive, serve and capture modes: correlation and alpha coherence of channel 1" << std::endl;
+	std::cout << "                with every channel over 4 seconds, updated every 0.5 s" << std::endl;
+	std::cout << " --montage      eeg, record, publish, archive, serve and capture modes: p-p of derived channels of the filtered samples," << std::endl;
+	std::cout << "                ';'-separated: ref, avg (common average), 1-2-3 (bipolar chain), 5:1,2,3,4 (Laplacian of 5)" << std::endl;
+	std::cout << "                or 1*0.5,2*0.5,3*-1 (weighted sum); only enabled channels are used" << std::endl;
+	std::cout << " --clock        eeg, record, publish, archive, serve and capture modes: host time of events and of the last sample" << std::endl;
+	std::cout << "                from the device to host clock fit, its drift and error bound" << std::endl;
+	std::cout << " --clients      stream-bench mode: connections reading the stream, 8 by default" << std::endl;
+	std::cout << " --threads      batch mode: processing threads, all cores by default" << std::endl;
+	std::cout << " --format       export mode: csv (default) lines of the counter, channels in uV and events, or binary records" << std::endl;
+	std::cout << "                of 32-bit little-endian counter, tag and float uV of the channels, see SampleExport.h" << std::endl;
 	std::cout << "All arguments are optional (see default values)." << std::endl << std::endl;
 }
 
@@ -75,10 +167,36 @@ void showPorgramSettings(int argc, const char* argv[]) {
 ProgramSettings processCommandLineArguments(int argc, const char* argv[]) {
 	try {
 		ProgramSettings sets;
+		for (int i = positionalCount(argc, argv); i < argc; ++i) {
+			const std::string option = argv[i];
+			if (option == "--help") sets.Mode = ProgramSettings::Help;
+			else if (option.compare(0, 9, "--filter=") == 0) sets.Filter = filterArg(option.substr(9));
+			else if (option.compare(0, 10, "--metrics=") == 0) sets.Metrics = option.substr(10);
+			else if (option.compare(0, 10, "--montage=") == 0) sets.Montage = option.substr(10);
+			else if (option == "--bands") sets.Bands = true;
+			else if (option == "--erp") sets.Erp = true;
+			else if (option == "--artifacts") sets.Artifacts = true;
+			else if (option == "--envelope") sets.Envelope = true;
+			else if (option == "--connectivity") sets.Connectivity = true;
+			else if (option == "--clock") sets.Clock = true;
+			else if (option.compare(0, 10, "--clients=") == 0) sets.Clients = std::max(1, std::stoi(option.substr(10)));
+			else if (option.compare(0, 10, "--threads=") == 0) sets.Threads = std::max(1, std::stoi(option.substr(10)));
+			else if (option.compare(0, 9, "--format=") == 0) sets.ExportFormat = exportFormatArg(option.substr(9));
+			else throw std::runtime_error("Unknown option: " + option);
+		}
+		argc = positionalCount(argc, argv);
 		if (argc > 1) sets.Mode = modeArg(argv[1]);
 		if (argc > 2) sets.DataRate = dataRateArg(argv[2]);
 		if (argc > 3) sets.InputRange = inputRangeArg(argv[3]);
 		if (argc > 4) sets.EnabledChannels = enabledChannelsArg(argv[4]);
+		if (argc > 5) sets.Target = argv[5];
+		else if (sets.Mode == ProgramSettings::Multi) sets.Target = "devices.cfg";
+		else if (sets.Mode == ProgramSettings::Publish || sets.Mode == ProgramSettings::Subscribe) sets.Target = "nb2bus";
+		else if (sets.Mode == ProgramSettings::Archive) sets.Target = "record.nbz";
+		else if (sets.Mode == ProgramSettings::Capture || sets.Mode == ProgramSettings::Inspect) sets.Target = "record.nbr";
+		else if (sets.Mode == ProgramSettings::Batch) sets.Target = ".";
+		else if (sets.Mode == ProgramSettings::Export) sets.Target = "-";
+		else if (sets.Mode == ProgramSettings::Serve || sets.Mode == ProgramSettings::StreamBench) sets.Target = "127.0.0.1:5555";
 		return sets;
 	}
 	catch (const std::exception& ex) {
@@ -89,118 +207,58 @@ ProgramSettings processCommandLineArguments(int argc, const char* argv[]) {
 }
 
 
-// return value check for all nb2 functions
+// return value check for all nb2 functions, nothing is allocated unless the call failed
 #define CHECK(x) check((#x), (x))
-int check(const std::string& function, int ret) {
+int check(const char* function, int ret) {
 	if(ret < 0) {
-		switch(ret) {
-			case Nb2Error::ErrId: throw std::exception(("Invalid device id: " + function).c_str());
-			case Nb2Error::ErrParam: throw std::exception(("Invalid function parameters :" + function).c_str());
-			case Nb2Error::ErrFail: throw std::exception(("Call function fail :" + function).c_str());
-			case Nb2Error::ErrObtained: throw std::exception(("Call function obtained :" + function).c_str());
-			case Nb2Error::ErrSupport: throw std::exception(("Call function unsupported :" + function).c_str());
-			case Nb2Error::ErrRecordExists: throw std::exception(("Call function when record exists :" + function).c_str());
-			default: throw std::exception(("Unidentified error " + std::to_string(ret) + ": " + function).c_str());
-		}
+		throw Nb2Exception(Nb2Status(ret, function));
 	}
 	return ret;
 }
 
-// nb2GetData and nb2GetEvents functions return the 
-// count of bytes copied to buffer or error code,
-// transform into the number of EEG or event samples
-int itemCount(int returnValue, size_t itemSize) {
-	if(returnValue > 0) {
-		if(returnValue % itemSize != 0) {
-			throw std::exception("Bad data/event size in bytes");
-		}
-		return int (returnValue / itemSize);
-	}
-	return returnValue;
-}
-
-// peak-to-peak amplitude of signal in Volts over a period of time
-float signalAmplitude(const t_nb2Property& prop, const int32_t* data, size_t sampleCount, size_t sampleSize, size_t channel) {
-	if(sampleCount == 0) {
-		return 0.f;
-	}
-	int min = std::numeric_limits<int>::max();
-	int max = std::numeric_limits<int>::min();
-	for (size_t i = 0; i < sampleCount; i++) {
-		const int value = data[i * sampleSize + channel];
-		if (max < value) {
-			max = value;
-		}
-		if (min > value) {
-			min = value;
-		}
-	}
-	return ((float)max - min) * prop.Resolution;
-}
-
-// number of lost samples per time period
-size_t lostSamples(const int32_t* data, size_t sampleCount, size_t sampleSize) {
-	static size_t expectedCounter = 0;
-	size_t lostSamples = 0;
-	for(size_t i = 0; i < sampleCount; i++) {
-		const uint32_t currentCounter = reinterpret_cast<const uint32_t*>(data)[i * sampleSize + sampleSize - 1];
-		if(currentCounter == 0) { // counter reset
-			expectedCounter = 0;
-		}
-		lostSamples += currentCounter - expectedCounter;
-		expectedCounter = currentCounter + 1;
-	}
-	return lostSamples;
+// Nb2Device and AcquisitionWorker results name their nb2 function themselves
+void check(const char*, const Nb2Status& status) {
+	status.check();
 }
 
 void searchDevice() {
 	std::cout << "Search devices ..." << std::endl;
-	int count = 0;
-	while(count == 0) {
-		// returns the number of devices, may vary from call to call,
-		// devices are not found immediately (up to a few seconds)
-		count = CHECK(nb2GetCount());
-		std::this_thread::sleep_for(std::chrono::milliseconds(500));
-	}
-}
-
-std::string versionPrettyStringFirmware(uint64_t version) {
-	return std::to_string((version >> 48) % 0x10000) + '.' +
-		std::to_string((version >> 32) % 0x10000) + '.' +
-		std::to_string(version % 0x100000000);
-}
-
-std::string versionPrettyStringDll(uint64_t version) {
-	return std::to_string((version >> 48) % 0x10000) + '.' +
-		std::to_string((version >> 32) % 0x10000) + '.' +
-		std::to_string((version >> 16) % 0x10000) + '.' +
-		std::to_string(version % 0x10000);
+	// nb2GetCount returns the number of devices, may vary from call to call,
+	// devices are not found immediately (up to a few seconds)
+	DeviceConnection::waitForDevices(std::chrono::milliseconds(10), std::chrono::milliseconds(500));
 }
 
-std::string datePrettyString(const t_nb2Date& date) {
-	return std::to_string(date.Day) + '.' + std::to_string(date.Month) + '.' + std::to_string(date.Year);
-}
-
-std::string modelPrettyString(unsigned int model) {
-	if(model == 1902) return "NB2-EEG21";
-	if(model == 1904) return "NB2-EEG21S";
-	if(model == 1900 || model == 1905) return "NB2-EEG16";
-	return std::to_string(model);
+// waits for the first device, then keeps searching while new devices appear
+uint32_t searchAllDevices(std::chrono::seconds settle) {
+	searchDevice();
+	uint32_t count = CHECK(nb2GetCount());
+	auto lastFound = std::chrono::steady_clock::now();
+	while(std::chrono::steady_clock::now() - lastFound < settle) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		const uint32_t current = CHECK(nb2GetCount());
+		if(current > count) {
+			count = current;
+			lastFound = std::chrono::steady_clock::now();
+		}
+	}
+	return count;
 }
 
-void showInfoAboutDevice(int id) {
-	// software versions
-	t_nb2Version version; CHECK(nb2GetVersion(id, &version));
+// software versions and device production info
+void showInfoAboutDevice(const t_nb2Version& version, const t_nb2Information& info) {
 	std::cout << "Version: firmware " << versionPrettyStringFirmware(version.Firmware)
 		<< " dll " << versionPrettyStringDll(version.Dll) << std::endl;
-
-	// device production info
-	t_nb2Information info; CHECK(nb2GetInformation(id, &info));
 	std::cout << "Model: " << modelPrettyString(info.Model) << std::endl;
 	std::cout << "Serial number: " << info.SerialNumber << std::endl;
 	std::cout << "Production date: " << datePrettyString(info.ProductionDate) << std::endl;
 }
 
+void showInfoAboutDevice(int id) {
+	t_nb2Version version; CHECK(nb2GetVersion(id, &version));
+	t_nb2Information info; CHECK(nb2GetInformation(id, &info));
+	showInfoAboutDevice(version, info);
+}
+
 void configureDevice(int id, const ProgramSettings& settings) {
 	// EEG acquisition settings
 	t_nb2DataSettings dsets;
@@ -217,58 +275,366 @@ void configureDevice(int id, const ProgramSettings& settings) {
 
 	// mode - EEG or impedance acquisition
 	t_nb2Mode mode;
-	mode.Mode = settings.Mode == Nb2Mode::Impedance ? Nb2Mode::Impedance : Nb2Mode::Data; 
+	mode.Mode = settings.Mode == ProgramSettings::Impedance ? Nb2Mode::Impedance : Nb2Mode::Data; 
 	CHECK(nb2SetMode(id, &mode));
 }
 
-std::string eventTypePrettyString(Nb2EventType etype) {
-	switch(etype) {
-		case EvButton: return "button_press";
-		case EvActivity: return "activity";
-		case EvFreeFall: return "free_fall";
-		case EvOrientation: return "orientation";
-		case EvStart: return "start";
-		case EvCharge: return "charge";
-		default: return "unknown_" + std::to_string(etype);
+// the same settings applied by DeviceConnection on every open
+DeviceConnection::Settings connectionSettings(const ProgramSettings& settings) {
+	DeviceConnection::Settings sets;
+	sets.DataSettings.DataRate = settings.DataRate;
+	sets.DataSettings.EnabledChannels = settings.EnabledChannels;
+	sets.DataSettings.InputRange = settings.InputRange;
+	sets.Mode = settings.Mode == ProgramSettings::Impedance ? Nb2Mode::Impedance : Nb2Mode::Data;
+	return sets;
+}
+
+// min and max of every channel through the kernels of the model, for the peak-to-peak amplitudes
+struct ChannelRange {
+	explicit ChannelRange(const SampleBlockKernels& kernels) :
+		Kernels(kernels), Minimum(kernels.channels()), Maximum(kernels.channels()), Count(0) {
+		reset();
+	}
+
+	void accumulate(const int32_t* data, size_t sampleCount) {
+		Kernels.minMax(data, sampleCount, Minimum.data(), Maximum.data());
+		Count += sampleCount;
+	}
+	void reset() {
+		std::fill(Minimum.begin(), Minimum.end(), std::numeric_limits<int32_t>::max());
+		std::fill(Maximum.begin(), Maximum.end(), std::numeric_limits<int32_t>::min());
+		Count = 0;
+	}
+	// ADC bits
+	int64_t peakToPeak(size_t channel) const { return Count ? int64_t(Maximum[channel]) - Minimum[channel] : 0; }
+
+	const SampleBlockKernels& Kernels;
+	std::vector<int32_t> Minimum;
+	std::vector<int32_t> Maximum;
+	uint64_t Count;
+};
+
+// envelope of the first channel over the whole session, as a review display would draw it
+void showEnvelope(const EnvelopePyramid& envelope, float rate, uint64_t displayed) {
+	const size_t Columns = 8;
+	float minimum[Columns], maximum[Columns];
+	const auto start = std::chrono::steady_clock::now();
+	envelope.render(0, 0, envelope.size(), Columns, minimum, maximum);
+	const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Envelope ch1 over " << std::fixed << std::setprecision(0) << envelope.size() / rate << " s (uV):";
+	for(size_t column = 0; column < Columns; ++column) {
+		std::cout << ' ' << std::setprecision(1) << minimum[column] << ".." << maximum[column];
+	}
+	std::cout << " in " << std::setprecision(1) << us << " us, " << envelope.levels() << " levels; display stream "
+		<< displayed << " samples at 125 Hz" << std::endl;
+}
+
+// channel numbers of every kind of artifact seen, e.g. "Artifacts: disconnect 3 jump 3,7"
+void showArtifacts(const ArtifactDetector::Window& flagged, uint64_t rejectedEpochs) {
+	const std::pair<const char*, uint32_t> kinds[] = { { "disconnect", flagged.Disconnect }, { "clipping", flagged.Clipping },
+		{ "flatline", flagged.Flatline }, { "jump", flagged.Jump }, { "burst", flagged.Burst } };
+	std::cout << "Artifacts:";
+	for(const auto& kind : kinds) {
+		if(!kind.second) continue;
+		std::cout << ' ' << kind.first << ' ';
+		const char* separator = "";
+		for(size_t channel = 0; channel < ArtifactDetector::MaxChannels; ++channel) {
+			if(kind.second & (1u << channel)) {
+				std::cout << separator << channel + 1;
+				separator = ",";
+			}
+		}
+	}
+	if(rejectedEpochs) {
+		std::cout << ", " << rejectedEpochs << " epochs rejected";
 	}
+	std::cout << std::endl;
 }
 
-void processDataAndEvents(int id) {
-	// nb2GetProperty gets info about physical characteristics of channels
-	t_nb2Property prop; CHECK(nb2GetProperty(id, &prop));
-	t_nb2Possibility poss; CHECK(nb2GetPossibility(id, &poss));
+// per channel scaling to uV from the device calibration of the input range;
+// nb2CalibrationDataEnable is not used, so the samples are not calibrated by the device
+SampleConverter createConverter(const DeviceProfile& profile, Nb2Range range) {
+	return SampleConverter(profile.Possibility.ChannelsCount, profile.Property.Resolution,
+		profile.Calibrated ? &profile.Calibration : nullptr, range);
+}
+
+// where acquired samples go besides the screen, every one is optional
+struct DataOutputs {
+	DataOutputs() : Bdf(nullptr), Bus(nullptr), Archive(nullptr), Stream(nullptr), Recording(nullptr), Export(nullptr) {}
+	BdfWriter* Bdf;
+	SharedBusWriter* Bus;
+	EegArchiveWriter* Archive;
+	StreamServer* Stream;
+	RecordingWriter* Recording;
+	SampleExporter* Export;
+};
+
+// a link drop is recovered: the worker reopens the device and continues its sample counters
+void processDataAndEvents(DeviceConnection& connection, const ProgramSettings& settings, const DataOutputs& outputs = DataOutputs()) {
+	// physical characteristics of channels, from nb2GetProperty and nb2GetPossibility
+	const t_nb2Property& prop = connection.profile().Property;
+	const t_nb2Possibility& poss = connection.profile().Possibility;
 	const size_t sampleSize = poss.ChannelsCount + 2;
 
-	std::vector<int32_t> data(2000u * sampleSize); // EEG data buffer, 2 second for maximal data rate
+	// optional export of the acquisition health
+	std::shared_ptr<DeviceMetrics> metrics;
+	std::unique_ptr<MetricsExporter> exporter;
+	if(!settings.Metrics.empty()) {
+		metrics = std::make_shared<DeviceMetrics>(connection.profile().SerialNumber);
+		metrics->DiscoveryNanoseconds = uint64_t(connection.discoveryTime().count());
+		exporter.reset(new MetricsExporter(settings.Metrics));
+		exporter->add(metrics);
+	}
+
+	Montage montage(poss.ChannelsCount, settings.EnabledChannels); // derivations are checked before the acquisition
+	montage.add(settings.Montage);
+
+	// acquisition thread polls the device every few milliseconds into lock-free rings
+	AcquisitionWorker worker(connection.id(), sampleSize, prop.Rate, AcquisitionWorker::Settings(), metrics.get());
+	worker.setReopen([&connection] { return connection.reopen(); });
+	worker.start();
+
+	std::vector<int32_t> data(size_t(prop.Rate / 2) * sampleSize); // EEG data buffer, 0.5 second
 	t_nb2Event events[100]; // event buffer for short time period
+	const std::unique_ptr<SampleBlockKernels> kernels = SampleBlockKernels::create(poss.ChannelsCount); // rows of this model
+	ChannelRange range(*kernels); // peak-to-peak amplitudes over one second
+	FilterBank filter(settings.Filter, poss.ChannelsCount, settings.DataRate);
+	const SampleConverter converter = createConverter(connection.profile(), settings.InputRange);
+	BandPower bands(poss.ChannelsCount, settings.DataRate);
+	EpochAverager epochs(poss.ChannelsCount, prop.Rate);
+	ArtifactDetector artifacts(poss.ChannelsCount, prop);
+	ArtifactDetector::Window flagged = ArtifactDetector::Window(); // flags of the windows in the second
+	const ArtifactDetector::Emit collectArtifacts = [&flagged](const ArtifactDetector&, const ArtifactDetector::Window& window) {
+		flagged.Clipping |= window.Clipping;
+		flagged.Disconnect |= window.Disconnect;
+		flagged.Flatline |= window.Flatline;
+		flagged.Jump |= window.Jump;
+		flagged.Burst |= window.Burst;
+	};
+	if(settings.Artifacts) {
+		epochs.setMask([&artifacts](uint32_t firstCounter, size_t sampleCount) { return artifacts.flags(firstCounter, sampleCount); });
+	}
+	const bool planarNeeded = settings.Bands || settings.Erp || settings.Envelope;
+	std::vector<float> planar(planarNeeded ? poss.ChannelsCount * data.size() / sampleSize : 0); // uV by channel
+	EnvelopePyramid envelope(poss.ChannelsCount);
+	Decimator decimator(poss.ChannelsCount, size_t(prop.Rate / 125)); // display stream at 125 Hz
+	const size_t displayPlane = data.size() / sampleSize / decimator.factor() + 1;
+	std::vector<float> display(settings.Envelope ? poss.ChannelsCount * displayPlane : 0);
+	uint64_t displayed = 0;
+	std::vector<uint32_t> counters(planarNeeded ? data.size() / sampleSize : 0);
+	Connectivity connectivity(poss.ChannelsCount, settings.DataRate);
+	std::vector<float> derived(montage.derived() * data.size() / sampleSize);
+	std::vector<float> derivedMin(montage.derived(), std::numeric_limits<float>::max());
+	std::vector<float> derivedMax(montage.derived(), std::numeric_limits<float>::lowest());
+	const bool rowsNeeded = settings.Connectivity || montage.derived() > 0;
+	std::vector<float> microvolts(rowsNeeded ? poss.ChannelsCount * data.size() / sampleSize : 0); // uV by row
+	// peak-to-peak of the average of the event type on every new trial
+	const EpochAverager::Emit showErp = [](const EpochAverager& averager, const t_nb2Event& event) {
+		std::cout << "ERP " << eventTypePrettyString(Nb2EventType(event.Type))
+			<< " trials " << averager.trials(event.Type) << " p-p (uV):";
+		for(size_t channel = 0; channel < averager.channels(); ++channel) {
+			const float* average = averager.average(event.Type, channel);
+			const auto range = std::minmax_element(average, average + averager.epochSize());
+			std::cout << ' ' << std::fixed << std::setprecision(1) << *range.second - *range.first;
+		}
+		std::cout << std::endl;
+	};
+	size_t lost = 0;
+	size_t expectedCounter = 0;
+	bool started = false;
+	uint64_t reconnects = 0;
+	uint32_t lastCounter = 0; // of the samples read
+	const double clockOrigin = ClockSync::seconds(connection.connectStart()); // host times are shown from the search start
 	std::cout.precision(3);
 
-	// EEG acquisition while user doesn't press q and enter, read data and events one time per second
+	// EEG processing while user doesn't press q and enter, read rings every 10 ms, show amplitudes one time per second
+	auto lastShow = std::chrono::steady_clock::now();
 	const std::future<void> future = std::async([] { while (std::cin.get() != 'q'); });
-	while(future.wait_for(std::chrono::seconds(1)) != std::future_status::ready) {
+	while(future.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready) {
+		CHECK(worker.status());
+
+		// EEG samples, whole rows only, all channels in one pass
+		const size_t sampleCount = worker.data().read(data.data(), data.size()) / sampleSize;
+		const size_t lostNow = kernels->lostSamples(data.data(), sampleCount, expectedCounter);
+		lost += lostNow;
+		if(sampleCount) {
+			lastCounter = uint32_t(data[sampleCount * sampleSize - 1]);
+		}
+		if(metrics) {
+			metrics->LostSamples += lostNow;
+		}
+		if(outputs.Bdf) {
+			outputs.Bdf->write(data.data(), sampleCount, sampleSize);
+		}
+		if(outputs.Bus) {
+			outputs.Bus->write(data.data(), sampleCount);
+		}
+		if(outputs.Archive) {
+			outputs.Archive->write(data.data(), sampleCount);
+		}
+		if(outputs.Stream) {
+			outputs.Stream->publish(data.data(), sampleCount);
+		}
+		if(outputs.Recording) {
+			outputs.Recording->write(data.data(), sampleCount);
+		}
+		if(outputs.Export) {
+			outputs.Export->write(data.data(), sampleCount);
+		}
+		if(settings.Artifacts) {
+			artifacts.push(data.data(), sampleCount, sampleSize, collectArtifacts); // on unfiltered samples
+		}
+		if(settings.Filter.enabled()) {
+			filter.process(data.data(), sampleCount, sampleSize);
+		}
+		range.accumulate(data.data(), sampleCount);
+		if(planarNeeded) {
+			const size_t planeSize = data.size() / sampleSize;
+			converter.convertPlanar(data.data(), sampleCount, sampleSize, planar.data(), planeSize, counters.data());
+			if(settings.Bands) {
+				bands.push(planar.data(), sampleCount, planeSize);
+			}
+			if(settings.Erp) {
+				epochs.push(planar.data(), counters.data(), sampleCount, planeSize, showErp);
+			}
+			if(settings.Envelope) {
+				envelope.push(planar.data(), sampleCount, planeSize);
+				displayed += decimator.process(planar.data(), sampleCount, planeSize, display.data(), displayPlane);
+			}
+		}
+		if(rowsNeeded) {
+			converter.convertRows(data.data(), sampleCount, sampleSize, microvolts.data());
+		}
+		if(settings.Connectivity) {
+			connectivity.push(microvolts.data(), sampleCount, poss.ChannelsCount);
+		}
+		if(montage.derived()) {
+			montage.apply(microvolts.data(), sampleCount, poss.ChannelsCount, derived.data(), montage.derived());
+			for(size_t i = 0; i < sampleCount * montage.derived(); ++i) {
+				const size_t channel = i % montage.derived();
+				derivedMin[channel] = std::min(derivedMin[channel], derived[i]);
+				derivedMax[channel] = std::max(derivedMax[channel], derived[i]);
+			}
+		}
+
+		// event processing
+		const size_t eventCount = worker.events().read(events, sizeof(events) / sizeof(*events));
+		const ClockSync::Fit clock = settings.Clock ? worker.clock() : ClockSync::Fit();
+		if(outputs.Bus) {
+			outputs.Bus->write(events, eventCount);
+		}
+		if(outputs.Stream) {
+			outputs.Stream->publish(events, eventCount);
+		}
+		if(outputs.Recording) {
+			outputs.Recording->write(events, eventCount);
+		}
+		if(outputs.Export) {
+			outputs.Export->write(events, eventCount);
+		}
+		for(size_t i = 0; i < eventCount; ++i) {
+			std::cout << "Event " << events[i].Number << " counter " << events[i].Counter
+				<< " type " << eventTypePrettyString(Nb2EventType(events[i].Type))
+				<< " value " << std::to_string(events[i].Value);
+			if(clock.valid()) {
+				std::cout << " at " << std::fixed << std::setprecision(3) << clock.time(events[i].Counter) - clockOrigin << " s";
+			}
+			std::cout << std::endl;
+			if(settings.Erp) {
+				epochs.addEvent(events[i], showErp);
+			}
+			if(outputs.Bdf) {
+				outputs.Bdf->annotate(events[i].Counter, eventTypePrettyString(Nb2EventType(events[i].Type))
+					+ ' ' + std::to_string(events[i].Value));
+			}
+		}
 
-		// EEG samples processing, pass buffer size in bytes
-		const size_t sampleCount = CHECK(itemCount(nb2GetData(id, data.data(), uint32_t(data.size() * sizeof(int32_t))), sampleSize));
+		if(std::chrono::steady_clock::now() - lastShow < std::chrono::seconds(1)) {
+			continue;
+		}
+		lastShow += std::chrono::seconds(1);
+		if(!started && worker.samples()) {
+			const auto startup = worker.firstSample() - connection.connectStart();
+			std::cout << "First sample " << std::chrono::duration_cast<std::chrono::milliseconds>(startup).count()
+				<< " ms after search start, device found in "
+				<< std::chrono::duration_cast<std::chrono::milliseconds>(connection.discoveryTime()).count() << " ms"
+				<< (connection.cached() ? ", profile cached" : "") << std::endl;
+			if(metrics) {
+				metrics->StartupNanoseconds = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(startup).count());
+			}
+			started = true;
+		}
+		if(worker.reconnects() != reconnects) {
+			reconnects = worker.reconnects();
+			std::cout << "Reconnected (" << reconnects << ") in "
+				<< std::chrono::duration_cast<std::chrono::milliseconds>(worker.lastReconnect()).count() << " ms, "
+				<< worker.gapSamples() << " samples missed in all"
+				<< (connection.profileChanged() ? ", firmware or calibration changed, restart to use them" : "") << std::endl;
+		}
+		if(settings.Clock && clock.valid()) {
+			std::cout << "Clock: sample " << lastCounter << " at " << std::fixed << std::setprecision(3) << clock.time(lastCounter) - clockOrigin
+				<< " s, drift " << std::showpos << std::setprecision(1) << clock.driftPpm(prop.Rate) << std::noshowpos << " ppm, error "
+				<< std::setprecision(2) << clock.Error * 1e3 << " ms, " << clock.Points << " segments, " << clock.Rejected << " rejected" << std::endl;
+		}
+		// peak-to-peak amplitude of signal over a second
 		std::cout << "EEG p-p (uV):";
 		for(size_t channel = 0; channel < poss.ChannelsCount; ++channel) {
 			std::cout << std::fixed << std::setw(6) << std::setprecision(3)
-				<< signalAmplitude(prop, data.data(), sampleCount, sampleSize, channel) * 1e6;
+				<< range.peakToPeak(channel) * converter.gain(channel);
 		}
-		
+
 		// lost samples processing
-		if(const size_t lost = lostSamples(data.data(), sampleCount, sampleSize)) {
+		if(lost) {
 			std::cout << " lost " << lost << " samples";
 		}
+		if(const uint64_t overflow = worker.overflowSamples()) {
+			std::cout << " overflow " << overflow << " samples";
+		}
+		if(const uint64_t overflow = worker.overflowEvents()) {
+			std::cout << " overflow " << overflow << " events";
+		}
 		std::cout << std::endl;
-
-		// event processing, pass buffer size in bytes
-		const size_t eventCount = CHECK(itemCount(nb2GetEvent(id, events, sizeof(events)), sizeof(*events)));
-		for(size_t i = 0; i < eventCount; ++i) {
-			std::cout << "Event " << events[i].Number << " counter " << events[i].Counter
-				<< " type " << eventTypePrettyString(Nb2EventType(events[i].Type))
-				<< " value " << std::to_string(events[i].Value) << std::endl;
+		if(settings.Envelope) {
+			showEnvelope(envelope, prop.Rate, displayed);
 		}
+		if(flagged.bad()) {
+			showArtifacts(flagged, epochs.rejected());
+			flagged = ArtifactDetector::Window();
+		}
+		if(settings.Bands && bands.ready()) {
+			const char* names[] = { "delta", "theta", "alpha", "beta" };
+			for(size_t band = 0; band < BandPower::BandsCount; ++band) {
+				std::cout << "EEG " << names[band] << " (uV^2):";
+				for(size_t channel = 0; channel < poss.ChannelsCount; ++channel) {
+					std::cout << ' ' << std::fixed << std::setprecision(1) << bands.power(channel, BandPower::Band(band));
+				}
+				std::cout << std::endl;
+			}
+		}
+		if(settings.Connectivity && connectivity.ready()) {
+			std::cout << "EEG correlation with ch1:";
+			for(size_t channel = 0; channel < poss.ChannelsCount; ++channel) {
+				std::cout << ' ' << std::fixed << std::setprecision(2) << connectivity.correlation(0, channel);
+			}
+			std::cout << std::endl << "EEG alpha coherence with ch1:";
+			for(size_t channel = 0; channel < poss.ChannelsCount; ++channel) {
+				std::cout << ' ' << std::fixed << std::setprecision(2) << connectivity.coherence(BandPower::Alpha, 0, channel);
+			}
+			std::cout << std::endl;
+		}
+		if(montage.derived() && derivedMax[0] >= derivedMin[0]) {
+			std::cout << "Montage p-p (uV):";
+			for(size_t channel = 0; channel < montage.derived(); ++channel) {
+				std::cout << ' ' << montage.label(channel) << ' ' << std::fixed << std::setprecision(1) << derivedMax[channel] - derivedMin[channel];
+			}
+			std::cout << std::endl;
+			std::fill(derivedMin.begin(), derivedMin.end(), std::numeric_limits<float>::max());
+			std::fill(derivedMax.begin(), derivedMax.end(), std::numeric_limits<float>::lowest());
+		}
+		range.reset();
+		lost = 0;
 	}
+	worker.stop();
 }
 
 void showTimeString(std::chrono::seconds::rep time) {
@@ -324,7 +690,7 @@ void processStatus(int id) {
 
 uint32_t inputPatientDateOfBirth(const char* invite) {
 	std::cout << invite;
-	std::tm tm;
+	std::tm tm = {};
 	std::cin >> std::get_time(&tm, "%d.%m.%Y");
 	return uint32_t(std::mktime(&tm));
 }
@@ -340,17 +706,21 @@ void inputStringSafe(uint8_t* str, size_t maxsize, const char* invite) {
 	std::cout << invite;
 	std::string input;
 	std::getline(std::cin, input);
-	std::memcpy(str, input.data(), std::max(input.size(), maxsize));
+	std::memcpy(str, input.data(), std::min(input.size(), maxsize));
+}
+
+void inputPatient(t_nb2Patient& patient) {
+	inputStringSafe(patient.id, sizeof(patient.id), "Patient Id  (up to 16 symbols): ");
+	inputStringSafe(patient.name, sizeof(patient.name), "Patient Name (up to 64 symbols): ");
+	patient.dateOfBirth = inputPatientDateOfBirth("Patient Birth Date: ");
+	patient.gender = inputPatientGender("Patient Gender M/F: ");
 }
 
 void processStartRecord(int id) {
 	t_nb2Record record{};
 	record.time = uint32_t(std::time(nullptr));
 	inputStringSafe(record.filename, sizeof(record.filename), "Filename (up to 8 symbols): ");
-	inputStringSafe(record.patient.id, sizeof(record.patient.id), "Patient Id  (up to 16 symbols): ");
-	inputStringSafe(record.patient.name, sizeof(record.patient.name), "Patient Name (up to 64 symbols): ");
-	record.patient.dateOfBirth = inputPatientDateOfBirth("Patient Birth Date: ");
-	record.patient.gender = inputPatientGender("Patient Gender M/F: ");
+	inputPatient(record.patient);
 	CHECK(nb2RecordStart(id, &record));
 	std::cout << "Record start successfully" << std::endl;
 }
@@ -360,6 +730,473 @@ void processStopRecord(int id) {
 	std::cout << "Record stop successfully" << std::endl;
 }
 
+// acquired samples and events are published to local processes, see processSubscribe
+void processPublish(DeviceConnection& connection, const ProgramSettings& settings) {
+	const t_nb2Property& prop = connection.profile().Property;
+	const t_nb2Possibility& poss = connection.profile().Possibility;
+	SharedBusWriter bus(settings.Target, poss.ChannelsCount + 2, prop);
+	std::cout << "Publish to shared memory " << settings.Target << ", press q and enter to stop" << std::endl;
+	DataOutputs outputs;
+	outputs.Bus = &bus;
+	processDataAndEvents(connection, settings, outputs);
+}
+
+// acquired samples and events are streamed to TCP clients, see processStreamBench
+void processServe(DeviceConnection& connection, const ProgramSettings& settings) {
+	const t_nb2Property& prop = connection.profile().Property;
+	const t_nb2Possibility& poss = connection.profile().Possibility;
+	StreamServer server(settings.Target, poss.ChannelsCount + 2, prop);
+	std::cout << "Serve on " << settings.Target << ", press q and enter to stop" << std::endl;
+	DataOutputs outputs;
+	outputs.Stream = &server;
+	processDataAndEvents(connection, settings, outputs);
+	std::cout << "Serve stop successfully: " << server.framesSent() << " frames sent, "
+		<< server.framesDropped() << " frames dropped for slow clients" << std::endl;
+}
+
+// many connections to a process running in serve mode, the device is not used; latency is
+// from sealing a frame in the server to reading it, so both processes run on the same host
+void processStreamBench(const ProgramSettings& settings) {
+	std::vector<std::unique_ptr<StreamClient>> clients;
+	for(size_t i = 0; i < settings.Clients; ++i) {
+		clients.emplace_back(new StreamClient(settings.Target));
+	}
+	const StreamHello& info = clients.front()->info();
+	std::cout << "Connected " << clients.size() << " clients to " << settings.Target << ": "
+		<< info.ChannelsCount << " channels, " << int(info.Rate) << " Hz" << std::endl;
+
+	Histogram latency; // nanoseconds
+	std::atomic<uint64_t> frames(0), bytes(0), gaps(0);
+	std::atomic<size_t> closed(0);
+	std::vector<std::thread> readers;
+	for(auto& client : clients) {
+		StreamClient* connection = client.get();
+		readers.emplace_back([connection, &latency, &frames, &bytes, &gaps, &closed] {
+			StreamFrameHeader header;
+			std::vector<uint8_t> payload;
+			uint64_t expected = 0;
+			bool started = false;
+			while(connection->read(header, payload)) {
+				const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now().time_since_epoch()).count();
+				latency.record(uint64_t(std::max<int64_t>(0, now - header.Time)));
+				if(started && header.Sequence != expected) {
+					gaps += header.Sequence - expected; // frames dropped by the server
+				}
+				started = true;
+				expected = header.Sequence + 1;
+				++frames;
+				bytes += sizeof(header) + header.Bytes;
+			}
+			++closed;
+		});
+	}
+
+	Histogram::Snapshot previous = latency.snapshot();
+	uint64_t lastFrames = 0, lastBytes = 0, lastGaps = 0;
+	auto lastShow = std::chrono::steady_clock::now();
+	const std::future<void> future = std::async([] { while (std::cin.get() != 'q'); });
+	while(future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready && closed < clients.size()) {
+		if(std::chrono::steady_clock::now() - lastShow < std::chrono::seconds(1)) {
+			continue;
+		}
+		lastShow += std::chrono::seconds(1);
+		const Histogram::Snapshot current = latency.snapshot();
+		const Histogram::Snapshot second = current.since(previous);
+		previous = current;
+		std::cout << "Stream: " << frames - lastFrames << " frames/s " << std::fixed << std::setprecision(2)
+			<< double(bytes - lastBytes) * 1e-6 << " MB/s, frame latency (us) p50 "
+			<< double(second.quantile(0.5)) * 1e-3 << " p99 " << double(second.quantile(0.99)) * 1e-3
+			<< " max " << double(second.quantile(1.)) * 1e-3;
+		if(gaps != lastGaps) {
+			std::cout << ", dropped " << gaps - lastGaps << " frames";
+		}
+		std::cout << std::endl;
+		lastFrames = frames;
+		lastBytes = bytes;
+		lastGaps = gaps;
+	}
+	const bool stopped = closed == clients.size();
+	for(auto& client : clients) {
+		client->shutdown();
+	}
+	for(auto& reader : readers) {
+		reader.join();
+	}
+	if(stopped) {
+		std::cout << "Server stopped, press q and enter to exit" << std::endl;
+	}
+}
+
+// samples only, in blocks of 1 second coded by EegCodec
+void processArchive(DeviceConnection& connection, const ProgramSettings& settings) {
+	const t_nb2Property& prop = connection.profile().Property;
+	const t_nb2Possibility& poss = connection.profile().Possibility;
+	EegArchiveWriter archive(settings.Target, poss.ChannelsCount + 2, size_t(prop.Rate));
+	std::cout << "Archive to " << settings.Target << " started, press q and enter to stop" << std::endl;
+	DataOutputs outputs;
+	outputs.Archive = &archive;
+	processDataAndEvents(connection, settings, outputs);
+	archive.close();
+	std::cout << "Archive stop successfully: " << archive.rawBytes() << " bytes of samples in "
+		<< archive.encodedBytes() << " bytes, ratio " << std::setprecision(2)
+		<< double(archive.rawBytes()) / double(std::max<uint64_t>(1, archive.encodedBytes())) << std::endl;
+}
+
+// samples as acquired in 1 second chunks and events, indexed by sample counter and host time
+void processCapture(DeviceConnection& connection, const ProgramSettings& settings) {
+	RecordingWriter::Header header;
+	header.Information = connection.profile().Information;
+	header.Property = connection.profile().Property;
+	header.ChannelsCount = connection.profile().Possibility.ChannelsCount;
+	header.EnabledChannels = settings.EnabledChannels;
+	RecordingWriter recording(settings.Target, header);
+	std::cout << "Capture to " << settings.Target << " started, press q and enter to stop" << std::endl;
+	DataOutputs outputs;
+	outputs.Recording = &recording;
+	processDataAndEvents(connection, settings, outputs);
+	recording.close();
+	std::cout << "Capture stop successfully: " << recording.samplesWritten() << " samples in "
+		<< recording.chunksWritten() << " chunks" << std::endl;
+}
+
+// every sample row in uV and every event, for other tools reading a pipe or a file
+void processExport(DeviceConnection& connection, const ProgramSettings& settings) {
+	const t_nb2Property& prop = connection.profile().Property;
+	const t_nb2Possibility& poss = connection.profile().Possibility;
+	const SampleConverter converter = createConverter(connection.profile(), settings.InputRange);
+	SampleExporter exporter(settings.Target, settings.ExportFormat, converter, poss.ChannelsCount + 2, size_t(prop.Rate));
+	std::cout << "Export to " << settings.Target << " started, press q and enter to stop" << std::endl;
+	DataOutputs outputs;
+	outputs.Export = &exporter;
+	processDataAndEvents(connection, settings, outputs);
+	exporter.close();
+	std::cout << "Export stop successfully: " << exporter.rowsWritten() << " rows and " << exporter.eventsWritten()
+		<< " events in " << exporter.bytesWritten() << " bytes" << std::endl;
+}
+
+// random access to a file of the capture mode, the device is not used: 1 second around every
+// event, 10 seconds around the middle of the recording by host time and a scan of channel 1
+void processInspect(const ProgramSettings& settings) {
+	const auto opening = std::chrono::steady_clock::now();
+	const RecordingReader reader(settings.Target);
+	const double openTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - opening).count();
+	const RecordingHeader& header = reader.header();
+	const size_t sampleSize = reader.sampleSize();
+	const double microvolts = double(header.Property.Resolution) * 1e6;
+	std::cout << "Recording " << settings.Target << " of " << modelPrettyString(header.Information.Model)
+		<< " SN " << header.Information.SerialNumber << ": " << reader.channels() << " channels, "
+		<< int(header.Property.Rate) << " Hz, " << reader.samples() << " samples in " << reader.chunks() << " chunks, "
+		<< reader.eventCount() << " events, opened in " << std::fixed << std::setprecision(3) << openTime * 1e3 << " ms" << std::endl;
+	if(reader.chunks() == 0) {
+		return;
+	}
+	const auto mean = [&reader, sampleSize, microvolts](uint64_t first, uint64_t count, size_t channel) {
+		double sum = 0.;
+		size_t rows = 0;
+		reader.visit(first, count, [&sum, &rows, sampleSize, channel](const int32_t* data, size_t n, uint64_t) {
+			for(size_t i = 0; i < n; ++i) sum += data[i * sampleSize + channel];
+			rows += n;
+		});
+		return rows ? sum / double(rows) * microvolts : 0.;
+	};
+
+	const size_t rate = size_t(header.Property.Rate);
+	for(size_t i = 0; i < reader.eventCount() && i < 10; ++i) {
+		const t_nb2Event& event = reader.events()[i];
+		const size_t index = reader.findSample(event.Counter);
+		if(index == reader.chunks()) {
+			continue;
+		}
+		const RecordingReader::Chunk chunk = reader.chunk(index);
+		const uint64_t sample = std::max<uint64_t>(event.Counter, chunk.FirstSample);
+		const double at = double(chunk.Time - header.StartTime) * 1e-9 + double(sample - chunk.FirstSample) / double(rate);
+		std::cout << "Event " << event.Number << " " << eventTypePrettyString(Nb2EventType(event.Type)) << " at "
+			<< std::setprecision(3) << at << " s, channel 1 mean around it " << std::setprecision(1)
+			<< mean(event.Counter - std::min<uint64_t>(event.Counter, rate / 2), rate, 0) << " uV" << std::endl;
+	}
+
+	const RecordingReader::Chunk last = reader.chunk(reader.chunks() - 1);
+	const int64_t middle = header.StartTime + (last.Time - header.StartTime) / 2;
+	const uint64_t center = reader.sampleAt(middle);
+	std::cout << "10 s around " << std::setprecision(3) << double(middle - header.StartTime) * 1e-9 << " s: counter "
+		<< center << ", channel 1 mean " << std::setprecision(1) << mean(center - std::min<uint64_t>(center, 5 * rate), 10 * rate, 0)
+		<< " uV" << std::endl;
+
+	const auto scanning = std::chrono::steady_clock::now();
+	int32_t low = std::numeric_limits<int32_t>::max(), high = std::numeric_limits<int32_t>::min();
+	for(size_t i = 0; i < reader.chunks(); ++i) {
+		const RecordingReader::Chunk chunk = reader.chunk(i);
+		for(size_t row = 0; row < chunk.SampleCount; ++row) {
+			low = std::min(low, chunk.Rows[row * sampleSize]);
+			high = std::max(high, chunk.Rows[row * sampleSize]);
+		}
+	}
+	const double scanTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - scanning).count();
+	std::cout << "Channel 1 from " << std::setprecision(1) << low * microvolts << " to " << high * microvolts
+		<< " uV, scanned in " << std::setprecision(3) << scanTime * 1e3 << " ms" << std::endl;
+}
+
+// filtering, band power and artifacts of every recording file of a directory, the device is not used
+void processBatch(const ProgramSettings& settings) {
+	BatchProcessor::Settings batchSettings;
+	batchSettings.Filter = settings.Filter;
+	if(settings.Threads) {
+		batchSettings.ThreadsCount = settings.Threads;
+	}
+	BatchProcessor batch(batchSettings);
+	const std::vector<std::string> paths = BatchProcessor::list(settings.Target);
+	std::cout << "Batch of " << paths.size() << " files in " << settings.Target << std::endl;
+	uint64_t samples = 0;
+	const auto start = std::chrono::steady_clock::now();
+	batch.run(paths, [&samples](const BatchProcessor::FileSummary& file) {
+		if(!file.Error.empty()) {
+			std::cout << file.Path << ": " << file.Error << std::endl;
+			return;
+		}
+		samples += file.Samples;
+		std::cout << file.Path << ": " << std::fixed << std::setprecision(1) << double(file.Samples) / std::max(1.f, file.Rate)
+			<< " s in " << file.Chunks << " chunks, artifacts in " << file.FlaggedWindows << " of " << file.Windows << " windows" << std::endl;
+		std::cout << " sd (uV):";
+		for(const BatchProcessor::ChannelSummary& channel : file.Channels) std::cout << ' ' << channel.Deviation;
+		std::cout << std::endl << " alpha (uV^2):";
+		for(const BatchProcessor::ChannelSummary& channel : file.Channels) std::cout << ' ' << channel.Power[BandPower::Alpha];
+		std::cout << std::endl;
+	});
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Batch done: " << samples << " samples in " << std::setprecision(2) << seconds << " s, "
+		<< double(samples) / std::max(seconds, 1e-9) * 1e-6 << " Msamples/s, " << batch.steals() << " chunks stolen" << std::endl;
+}
+
+// reads samples and events of another process running in publish mode, the device is not used
+void processSubscribe(const ProgramSettings& settings) {
+	SharedBusReader bus(settings.Target);
+	const size_t sampleSize = bus.sampleSize();
+	std::cout << "Subscribed to " << settings.Target << ": " << bus.channels() << " channels, "
+		<< int(bus.rate()) << " Hz" << std::endl;
+
+	std::vector<int32_t> data(size_t(bus.rate() / 2) * sampleSize);
+	t_nb2Event events[100];
+	const std::unique_ptr<SampleBlockKernels> kernels = SampleBlockKernels::create(bus.channels());
+	ChannelRange range(*kernels);
+	size_t lost = 0;
+	size_t expectedCounter = 0;
+	bool attached = true; // the counter does not start from 0 for a subscriber
+	uint64_t overrun = 0;
+	auto lastShow = std::chrono::steady_clock::now();
+	const std::future<void> future = std::async([] { while (std::cin.get() != 'q'); });
+	while(future.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready && !bus.closed()) {
+		const size_t sampleCount = bus.read(data.data(), data.size() / sampleSize);
+		if(attached && sampleCount) {
+			expectedCounter = uint32_t(data[sampleSize - 1]);
+			attached = false;
+		}
+		lost += kernels->lostSamples(data.data(), sampleCount, expectedCounter);
+		range.accumulate(data.data(), sampleCount);
+		const size_t eventCount = bus.read(events, sizeof(events) / sizeof(*events));
+		for(size_t i = 0; i < eventCount; ++i) {
+			std::cout << "Event " << events[i].Number << " counter " << events[i].Counter
+				<< " type " << eventTypePrettyString(Nb2EventType(events[i].Type))
+				<< " value " << std::to_string(events[i].Value) << std::endl;
+		}
+
+		if(std::chrono::steady_clock::now() - lastShow < std::chrono::seconds(1)) {
+			continue;
+		}
+		lastShow += std::chrono::seconds(1);
+		std::cout << "EEG p-p (uV):";
+		for(size_t channel = 0; channel < bus.channels(); ++channel) {
+			std::cout << std::fixed << std::setw(6) << std::setprecision(3)
+				<< range.peakToPeak(channel) * bus.resolution() * 1e6;
+		}
+		// samples overwritten in the bus before this process read them are also lost
+		if(lost) {
+			std::cout << " lost " << lost << " samples";
+		}
+		if(bus.overrunSamples() != overrun) {
+			std::cout << " overrun " << bus.overrunSamples() - overrun << " samples";
+			overrun = bus.overrunSamples();
+		}
+		std::cout << std::endl;
+		range.reset();
+		lost = 0;
+	}
+	if(bus.closed()) {
+		std::cout << "Publisher stopped, press q and enter to exit" << std::endl;
+	}
+}
+
+// continuous recording of the data stream into BDF+ file on the host
+void processRecord(DeviceConnection& connection, const ProgramSettings& settings) {
+	const t_nb2Information& info = connection.profile().Information;
+	const t_nb2Possibility& poss = connection.profile().Possibility;
+	BdfWriter::Header header;
+	header.Property = connection.profile().Property;
+	header.ChannelsCount = poss.ChannelsCount;
+	header.EnabledChannels = settings.EnabledChannels;
+	header.Patient = t_nb2Patient{};
+	inputPatient(header.Patient);
+	header.Equipment = modelPrettyString(info.Model) + "_SN" + std::to_string(info.SerialNumber);
+	header.StartTime = std::time(nullptr);
+	const SampleConverter converter = createConverter(connection.profile(), settings.InputRange);
+	for(size_t ch = 0; ch < poss.ChannelsCount; ++ch) {
+		header.Gain.push_back(converter.gain(ch));
+		header.Offset.push_back(converter.offset(ch));
+	}
+
+	BdfWriter writer(settings.Target, header);
+	std::cout << "Record to " << settings.Target << " started, press q and enter to stop" << std::endl;
+	DataOutputs outputs;
+	outputs.Bdf = &writer;
+	processDataAndEvents(connection, settings, outputs);
+	writer.close();
+	std::cout << "Record stop successfully: " << writer.recordsWritten() << " s written";
+	if(const uint64_t dropped = writer.recordsDropped()) {
+		std::cout << ", " << dropped << " s dropped";
+	}
+	std::cout << std::endl;
+}
+
+// device settings by serial number: '<serial> <data-rate> <input-range> <chs-enabled>' lines,
+// missing values are taken from the command line, text after # is ignored
+std::map<uint32_t, ProgramSettings> readDeviceSettings(const std::string& path, const ProgramSettings& defaults) {
+	std::map<uint32_t, ProgramSettings> devices;
+	std::ifstream file(path);
+	std::string line;
+	while(std::getline(file, line)) {
+		std::istringstream fields(line.substr(0, line.find('#')));
+		std::string serial, rate, range, channels;
+		if(!(fields >> serial)) continue;
+		ProgramSettings sets = defaults;
+		if(fields >> rate) sets.DataRate = dataRateArg(rate);
+		if(fields >> range) sets.InputRange = inputRangeArg(range);
+		if(fields >> channels) sets.EnabledChannels = enabledChannelsArg(channels);
+		devices[uint32_t(std::stoul(serial))] = sets;
+	}
+	return devices;
+}
+
+// one opened and started device of the multi mode: own acquisition thread and rings,
+// processing of the rings is scheduled on the shared thread pool
+struct DeviceSession {
+	DeviceSession(Nb2Device&& device, uint32_t serial, const t_nb2Property& prop, size_t channelsCount, const ProgramSettings& sets) :
+		Device(std::move(device)), Serial(serial), Property(prop), SampleSize(channelsCount + 2),
+		Metrics(std::make_shared<DeviceMetrics>(serial)),
+		Worker(Device.id(), SampleSize, prop.Rate, AcquisitionWorker::Settings(), Metrics.get()),
+		Kernels(SampleBlockKernels::create(channelsCount)), Range(*Kernels),
+		Filtered(sets.Filter.enabled()), Filter(sets.Filter, channelsCount, sets.DataRate),
+		Data(size_t(prop.Rate / 2) * SampleSize), ExpectedCounter(0),
+		Busy(false), Processed(0), Lost(0) {}
+
+	// pool thread, one task per session at a time
+	void process() {
+		for(;;) {
+			const size_t sampleCount = Worker.data().read(Data.data(), Data.size()) / SampleSize;
+			if(sampleCount == 0) break;
+			if(Filtered) Filter.process(Data.data(), sampleCount, SampleSize);
+			Range.accumulate(Data.data(), sampleCount);
+			if(Range.Count >= Property.Rate) Range.reset(); // peak-to-peak amplitudes over one second
+			const size_t lost = Kernels->lostSamples(Data.data(), sampleCount, ExpectedCounter);
+			Lost += lost;
+			Metrics->LostSamples += lost;
+			Processed += sampleCount;
+		}
+		Worker.events().consume(Worker.events().size());
+	}
+
+	Nb2Device Device; // closed after the worker has stopped
+	const uint32_t Serial;
+	const t_nb2Property Property;
+	const size_t SampleSize;
+	const std::shared_ptr<DeviceMetrics> Metrics;
+	AcquisitionWorker Worker;
+	const std::unique_ptr<SampleBlockKernels> Kernels;
+	ChannelRange Range;
+	const bool Filtered;
+	FilterBank Filter;
+	std::vector<int32_t> Data;
+	size_t ExpectedCounter;
+	std::atomic<bool> Busy;
+	std::atomic<uint64_t> Processed;
+	std::atomic<uint64_t> Lost;
+};
+
+// opens all found devices, acquires data from all of them at once and shows
+// per device and aggregate throughput and loss one time per second
+void processMultipleDevices(const ProgramSettings& settings) {
+	const std::map<uint32_t, ProgramSettings> devices = readDeviceSettings(settings.Target, settings);
+	const uint32_t count = searchAllDevices(std::chrono::seconds(3));
+	std::cout << count << " devices found, opening ..." << std::endl;
+
+	std::unique_ptr<MetricsExporter> exporter(settings.Metrics.empty() ? nullptr : new MetricsExporter(settings.Metrics));
+	std::vector<std::unique_ptr<DeviceSession>> sessions;
+	for(uint32_t i = 0; i < count; ++i) {
+		Nb2Device device = Nb2Device::openIndex(i).value();
+		const int id = device.id();
+		const uint32_t serial = device.serialNumber().value();
+		const auto found = devices.find(serial);
+		const ProgramSettings& sets = found != devices.end() ? found->second : settings;
+		showInfoAboutDevice(id);
+		configureDevice(id, sets);
+		CHECK(device.start());
+		const t_nb2Property prop = device.property().value();
+		const t_nb2Possibility poss = device.possibility().value();
+		sessions.emplace_back(new DeviceSession(std::move(device), serial, prop, poss.ChannelsCount, sets));
+		if(exporter) {
+			exporter->add(sessions.back()->Metrics);
+		}
+		sessions.back()->Worker.start();
+	}
+
+	// the pool is destroyed first, it finishes all scheduled processing
+	std::unique_ptr<ThreadPool> pool(new ThreadPool());
+	std::vector<uint64_t> processed(sessions.size()), lost(sessions.size());
+	auto lastShow = std::chrono::steady_clock::now();
+	const std::future<void> future = std::async([] { while (std::cin.get() != 'q'); });
+	while(future.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready) {
+		for(auto& session : sessions) {
+			CHECK(session->Worker.status());
+			if(!session->Busy.exchange(true)) {
+				DeviceSession* s = session.get();
+				pool->submit([s] { s->process(); s->Busy = false; });
+			}
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		if(now - lastShow < std::chrono::seconds(1)) {
+			continue;
+		}
+		const double seconds = std::chrono::duration<double>(now - lastShow).count();
+		lastShow = now;
+		double totalSamples = 0, totalValues = 0, totalLost = 0;
+		for(size_t i = 0; i < sessions.size(); ++i) {
+			const DeviceSession& session = *sessions[i];
+			const uint64_t samples = session.Processed - processed[i];
+			const uint64_t lostNow = session.Lost - lost[i];
+			processed[i] += samples;
+			lost[i] += lostNow;
+			std::cout << "SN" << session.Serial << " " << int(session.Property.Rate) << " Hz: "
+				<< std::fixed << std::setprecision(0) << samples / seconds << " samples/s, lost " << lostNow
+				<< ", overflow " << session.Worker.overflowSamples() << std::endl;
+			totalSamples += samples;
+			totalValues += double(samples) * (session.SampleSize - 2);
+			totalLost += lostNow;
+		}
+		std::cout << "Total: " << sessions.size() << " devices, " << std::fixed << std::setprecision(0)
+			<< totalSamples / seconds << " samples/s, " << totalValues / seconds << " values/s, lost "
+			<< totalLost << " (" << std::setprecision(2)
+			<< (totalSamples + totalLost > 0 ? 100. * totalLost / (totalSamples + totalLost) : 0.) << "%)" << std::endl;
+	}
+	pool.reset();
+
+	for(auto& session : sessions) {
+		session->Worker.stop();
+		CHECK(session->Device.stop());
+		CHECK(session->Device.powerOff(2));
+		CHECK(session->Device.close());
+	}
+}
+
 int main(int argc, const char* argv[]) {
 	try {
 		ProgramSettings settings = processCommandLineArguments(argc, argv);
@@ -367,40 +1204,73 @@ int main(int argc, const char* argv[]) {
 			showUsage();
 			return 0;
 		}
-		showPorgramSettings(argc, argv);
+		// stdout carries the exported samples only, messages go to stderr
+		if (settings.Mode == ProgramSettings::Export && settings.Target == "-") {
+			std::cout.rdbuf(std::cerr.rdbuf());
+		}
+		if (settings.Mode == ProgramSettings::Subscribe) {
+			processSubscribe(settings);
+			return 0;
+		}
+		if (settings.Mode == ProgramSettings::StreamBench) {
+			processStreamBench(settings);
+			return 0;
+		}
+		if (settings.Mode == ProgramSettings::Inspect) {
+			processInspect(settings);
+			return 0;
+		}
+		if (settings.Mode == ProgramSettings::Batch) {
+			processBatch(settings);
+			return 0;
+		}
+		showPorgramSettings(positionalCount(argc, argv), argv);
 
 		// start device search, library resources initialization
 		CHECK(nb2ApiInit());
 
-		searchDevice();
-
-		// open device with number 0
-		std::cout << "Device found, opening ..." << std::endl;
-		int id = CHECK(nb2GetId(0));
-		CHECK(nb2Open(id));
-
-		showInfoAboutDevice(id);
-		configureDevice(id, settings);
+		// all found devices at once
+		if (settings.Mode == ProgramSettings::Multi) {
+			processMultipleDevices(settings);
+			CHECK(nb2ApiDone());
+			return 0;
+		}
 
-		// EEG or impedance acquisition start
-		CHECK(nb2Start(id));
+		// the device used last time if it is found, otherwise device with number 0; opened,
+		// configured and started with what the cache file knows about it
+		std::cout << "Search devices ..." << std::endl;
+		DeviceCache cache("nb2devices.cache");
+		DeviceConnection connection(cache, connectionSettings(settings));
+		CHECK(connection.connect());
+		Nb2Device& device = connection.device();
+		const int id = device.id();
+		showInfoAboutDevice(connection.profile().Version, connection.profile().Information);
 
 		// EEG, events or impedances processing
 		if (settings.Mode == ProgramSettings::Impedance) processImpedances(id);
-		else if (settings.Mode == ProgramSettings::Eeg) processDataAndEvents(id);
+		else if (settings.Mode == ProgramSettings::Eeg) processDataAndEvents(connection, settings);
 		else if (settings.Mode == ProgramSettings::Status) processStatus(id);
 		else if (settings.Mode == ProgramSettings::StartRecord) processStartRecord(id);
 		else if (settings.Mode == ProgramSettings::StopRecord) processStopRecord(id);
+		else if (settings.Mode == ProgramSettings::Record) processRecord(connection, settings);
+		else if (settings.Mode == ProgramSettings::Publish) processPublish(connection, settings);
+		else if (settings.Mode == ProgramSettings::Archive) processArchive(connection, settings);
+		else if (settings.Mode == ProgramSettings::Serve) processServe(connection, settings);
+		else if (settings.Mode == ProgramSettings::Capture) processCapture(connection, settings);
+		else if (settings.Mode == ProgramSettings::Export) processExport(connection, settings);
 
-		// EEG or impedance acquisition stop
-		CHECK(nb2Stop(id));
+		// a device stopped while it was reconnected after a link drop is closed already
+		if (device.opened()) {
+			// EEG or impedance acquisition stop, of the device reopened after a link drop as well
+			CHECK(device.stop());
 
-		// manual power off device after 2 seconds
-		// (if not calling - automatic power off after 3 minutes)
-		CHECK(nb2PowerOff(id, 2));
+			// manual power off device after 2 seconds
+			// (if not calling - automatic power off after 3 minutes)
+			CHECK(device.powerOff(2));
 
-		// close device
-		CHECK(nb2Close(id));
+			// close device, on errors before this point the device closes itself
+			CHECK(device.close());
+		}
 
 		// free library resources
 		CHECK(nb2ApiDone());
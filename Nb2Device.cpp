@@ -0,0 +1,113 @@
+#include "Nb2Device.h"
+#include <cstdio>
+
+const char* Nb2Status::description() const {
+	switch (returnCode) {
+		case ErrId: return "Invalid device id";
+		case ErrParam: return "Invalid function parameters";
+		case ErrFail: return "Call function fail";
+		case ErrObtained: return "Call function obtained";
+		case ErrSupport: return "Call function unsupported";
+		case ErrRecordExists: return "Call function when record exists";
+		default: return returnCode < 0 ? "Unidentified error" : "Ok";
+	}
+}
+
+void Nb2Status::check() const {
+	if (!ok()) {
+		throw Nb2Exception(*this);
+	}
+}
+
+Nb2Exception::Nb2Exception(const Nb2Status& status) : failed(status) {
+	std::snprintf(message, sizeof(message), "%s (%d): %s", status.description(), status.code(), status.function());
+}
+
+Nb2Device::~Nb2Device() {
+	close();
+}
+
+Nb2Device::Nb2Device(Nb2Device&& other) : deviceId(other.deviceId), started(other.started) {
+	other.deviceId = -1;
+	other.started = false;
+}
+
+Nb2Device& Nb2Device::operator=(Nb2Device&& other) {
+	if (this != &other) {
+		close();
+		std::swap(deviceId, other.deviceId);
+		std::swap(started, other.started);
+	}
+	return *this;
+}
+
+Result<Nb2Device> Nb2Device::open(int id) {
+	const int ret = nb2Open(id);
+	if (ret < 0) {
+		return Nb2Status(ret, "nb2Open");
+	}
+	return Nb2Device(id);
+}
+
+Result<Nb2Device> Nb2Device::openIndex(uint32_t index) {
+	const int id = nb2GetId(index);
+	if (id < 0) {
+		return Nb2Status(id, "nb2GetId");
+	}
+	return open(id);
+}
+
+Nb2Status Nb2Device::start() {
+	const int ret = nb2Start(deviceId);
+	started = started || ret >= 0;
+	return Nb2Status(ret, "nb2Start");
+}
+
+Nb2Status Nb2Device::stop() {
+	if (!started) {
+		return Nb2Status(ErrOk, "nb2Stop");
+	}
+	started = false;
+	return Nb2Status(nb2Stop(deviceId), "nb2Stop");
+}
+
+Nb2Status Nb2Device::powerOff(int waitSeconds) {
+	return Nb2Status(nb2PowerOff(deviceId, waitSeconds), "nb2PowerOff");
+}
+
+// stops a started device first, the id is released even if nb2Close fails
+Nb2Status Nb2Device::close() {
+	if (!opened()) {
+		return Nb2Status(ErrOk, "nb2Close");
+	}
+	const Nb2Status stopped = stop();
+	const int ret = nb2Close(deviceId);
+	deviceId = -1;
+	return ret < 0 || stopped.ok() ? Nb2Status(ret, "nb2Close") : stopped;
+}
+
+Result<uint32_t> Nb2Device::serialNumber() const {
+	const int ret = nb2GetSerialNumber(deviceId);
+	if (ret < 0) {
+		return Nb2Status(ret, "nb2GetSerialNumber");
+	}
+	return uint32_t(ret);
+}
+
+Result<t_nb2Property> Nb2Device::property() const {
+	t_nb2Property prop;
+	const int ret = nb2GetProperty(deviceId, &prop);
+	if (ret < 0) {
+		return Nb2Status(ret, "nb2GetProperty");
+	}
+	return prop;
+}
+
+Result<t_nb2Possibility> Nb2Device::possibility() const {
+	t_nb2Possibility poss;
+	const int ret = nb2GetPossibility(deviceId, &poss);
+	if (ret < 0) {
+		return Nb2Status(ret, "nb2GetPossibility");
+	}
+	return poss;
+}
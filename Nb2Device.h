@@ -0,0 +1,95 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+
+// outcome of an nb2 call: its return code and the name of the function, a string literal;
+// copying, checking and passing it around never allocates
+class Nb2Status {
+public:
+	Nb2Status() : returnCode(ErrOk), functionName("") {}
+	Nb2Status(int code, const char* function) : returnCode(code), functionName(function) {}
+
+	bool ok() const { return returnCode >= 0; }
+	explicit operator bool() const { return ok(); }
+	int code() const { return returnCode; }
+	const char* function() const { return functionName; }
+	// static text of the error code
+	const char* description() const;
+	// throws Nb2Exception on error
+	void check() const;
+
+private:
+	int returnCode;
+	const char* functionName;
+};
+
+// error of an nb2 call, the message is formatted into the exception itself
+class Nb2Exception : public std::exception {
+public:
+	explicit Nb2Exception(const Nb2Status& status);
+	const char* what() const noexcept override { return message; }
+	const Nb2Status& status() const { return failed; }
+
+private:
+	Nb2Status failed;
+	char message[128];
+};
+
+// value of an nb2 call or its error
+template<class T>
+class Result {
+public:
+	Result(T value) : result(std::move(value)) {}
+	Result(const Nb2Status& status) : result(), outcome(status) {}
+
+	bool ok() const { return outcome.ok(); }
+	explicit operator bool() const { return ok(); }
+	const Nb2Status& status() const { return outcome; }
+	// throws Nb2Exception on error
+	T& value() & { outcome.check(); return result; }
+	T&& value() && { outcome.check(); return std::move(result); }
+	T valueOr(T fallback) const { return ok() ? result : fallback; }
+
+private:
+	T result;
+	Nb2Status outcome;
+};
+
+// opened device: nb2Open on creation, nb2Stop if started and nb2Close on destruction;
+// calls return Nb2Status or Result and never throw, errors of the destructor are ignored
+class Nb2Device {
+public:
+	Nb2Device() : deviceId(-1), started(false) {}
+	~Nb2Device();
+	Nb2Device(Nb2Device&& other);
+	Nb2Device& operator=(Nb2Device&& other);
+	Nb2Device(const Nb2Device&) = delete;
+	Nb2Device& operator=(const Nb2Device&) = delete;
+
+	static Result<Nb2Device> open(int id);
+	// device with number index of the found ones
+	static Result<Nb2Device> openIndex(uint32_t index);
+
+	bool opened() const { return deviceId >= 0; }
+	bool running() const { return started; }
+	int id() const { return deviceId; }
+
+	Nb2Status start();
+	Nb2Status stop();
+	// power off waitSeconds after close
+	Nb2Status powerOff(int waitSeconds);
+	Nb2Status close();
+
+	Result<uint32_t> serialNumber() const;
+	Result<t_nb2Property> property() const;
+	Result<t_nb2Possibility> possibility() const;
+
+private:
+	explicit Nb2Device(int id) : deviceId(id), started(false) {}
+
+	int deviceId;
+	bool started;
+};
@@ -0,0 +1,74 @@
+#include "Nb2Format.h"
+#include <stdexcept>
+
+Nb2Rate dataRateArg(const std::string& rate) {
+	if (rate == "125")  return Hz125;
+	if (rate == "250")  return Hz250;
+	if (rate == "500")  return Hz500;
+	if (rate == "1000") return Hz1000;
+	throw std::runtime_error("Unknown rate: " + rate);
+}
+
+Nb2Range inputRangeArg(const std::string& range) {
+	if (range == "150") return Mv150;
+	if (range == "300") return Mv300;
+	throw std::runtime_error("Unknown range: " + range);
+}
+
+uint32_t enabledChannelsArg(const std::string& channels) {
+	uint32_t enabled = 0;
+	std::string::size_type offset = 0;
+	std::string::size_type pos = std::string(channels).find(',');
+	while (offset != std::string::npos) {
+		enabled |= 1 << (std::stoi(channels.substr(offset, pos - offset)) - 1);
+		offset = pos < std::string::npos ? pos + 1 : pos;
+		pos = std::string(channels).find(',', offset);
+	}
+	return enabled;
+}
+
+int itemCount(int returnValue, size_t itemSize) {
+	if(returnValue > 0) {
+		if(returnValue % itemSize != 0) {
+			throw std::runtime_error("Bad data/event size in bytes");
+		}
+		return int (returnValue / itemSize);
+	}
+	return returnValue;
+}
+
+std::string versionPrettyStringFirmware(uint64_t version) {
+	return std::to_string((version >> 48) % 0x10000) + '.' +
+		std::to_string((version >> 32) % 0x10000) + '.' +
+		std::to_string(version % 0x100000000);
+}
+
+std::string versionPrettyStringDll(uint64_t version) {
+	return std::to_string((version >> 48) % 0x10000) + '.' +
+		std::to_string((version >> 32) % 0x10000) + '.' +
+		std::to_string((version >> 16) % 0x10000) + '.' +
+		std::to_string(version % 0x10000);
+}
+
+std::string datePrettyString(const t_nb2Date& date) {
+	return std::to_string(date.Day) + '.' + std::to_string(date.Month) + '.' + std::to_string(date.Year);
+}
+
+std::string modelPrettyString(unsigned int model) {
+	if(model == 1902) return "NB2-EEG21";
+	if(model == 1904) return "NB2-EEG21S";
+	if(model == 1900 || model == 1905) return "NB2-EEG16";
+	return std::to_string(model);
+}
+
+std::string eventTypePrettyString(Nb2EventType etype) {
+	switch(etype) {
+		case EvButton: return "button_press";
+		case EvActivity: return "activity";
+		case EvFreeFall: return "free_fall";
+		case EvOrientation: return "orientation";
+		case EvStart: return "start";
+		case EvCharge: return "charge";
+		default: return "unknown_" + std::to_string(etype);
+	}
+}
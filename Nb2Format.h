@@ -0,0 +1,24 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// parsing of the command line and device configuration values, throw std::runtime_error
+// or std::invalid_argument on bad input
+Nb2Rate dataRateArg(const std::string& rate);
+Nb2Range inputRangeArg(const std::string& range);
+// comma-separated 1-based channel numbers into the enabled channels bitset
+uint32_t enabledChannelsArg(const std::string& channels);
+
+// nb2GetData and nb2GetEvents functions return the
+// count of bytes copied to buffer or error code,
+// transform into the number of EEG or event samples
+int itemCount(int returnValue, size_t itemSize);
+
+// device information as shown to the user
+std::string versionPrettyStringFirmware(uint64_t version);
+std::string versionPrettyStringDll(uint64_t version);
+std::string datePrettyString(const t_nb2Date& date);
+std::string modelPrettyString(unsigned int model);
+std::string eventTypePrettyString(Nb2EventType etype);
@@ -0,0 +1,106 @@
+#include "SampleBlock.h"
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define SAMPLE_BLOCK_WIDTH 8
+#elif defined(__SSE4_1__) || defined(__AVX__)
+	#include <smmintrin.h>
+	#define SAMPLE_BLOCK_WIDTH 4
+#else
+	#define SAMPLE_BLOCK_WIDTH 1
+#endif
+
+namespace {
+
+#if SAMPLE_BLOCK_WIDTH > 1
+#if SAMPLE_BLOCK_WIDTH == 8
+typedef __m256i Lanes;
+inline Lanes load(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+inline void store(int32_t* p, Lanes v) { _mm256_storeu_si256((__m256i*)p, v); }
+inline Lanes lanesMin(Lanes a, Lanes b) { return _mm256_min_epi32(a, b); }
+inline Lanes lanesMax(Lanes a, Lanes b) { return _mm256_max_epi32(a, b); }
+#else
+typedef __m128i Lanes;
+inline Lanes load(const int32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+inline void store(int32_t* p, Lanes v) { _mm_storeu_si128((__m128i*)p, v); }
+inline Lanes lanesMin(Lanes a, Lanes b) { return _mm_min_epi32(a, b); }
+inline Lanes lanesMax(Lanes a, Lanes b) { return _mm_max_epi32(a, b); }
+#endif
+
+// the channels in Groups registers, the last group ends at the last channel and overlaps
+// the one before it when Channels is not a multiple of the width, min and max of the
+// overlapped lanes are the same in both; no word past the channels of a row is read
+template<size_t Channels>
+void minMaxRegisters(const int32_t* data, size_t sampleCount, int32_t* minimum, int32_t* maximum) {
+	static_assert(Channels >= SAMPLE_BLOCK_WIDTH, "at least one whole register of channels");
+	const size_t Groups = (Channels + SAMPLE_BLOCK_WIDTH - 1) / SAMPLE_BLOCK_WIDTH;
+	const size_t Stride = Channels + 2;
+	Lanes mn[Groups], mx[Groups];
+	for (size_t g = 0; g < Groups; ++g) {
+		const size_t offset = std::min(g * SAMPLE_BLOCK_WIDTH, Channels - SAMPLE_BLOCK_WIDTH);
+		mn[g] = load(minimum + offset);
+		mx[g] = load(maximum + offset);
+	}
+	for (size_t i = 0; i < sampleCount; ++i) {
+		const int32_t* row = data + i * Stride;
+		for (size_t g = 0; g < Groups; ++g) {
+			const Lanes v = load(row + std::min(g * SAMPLE_BLOCK_WIDTH, Channels - SAMPLE_BLOCK_WIDTH));
+			mn[g] = lanesMin(mn[g], v);
+			mx[g] = lanesMax(mx[g], v);
+		}
+	}
+	for (size_t g = 0; g < Groups; ++g) {
+		const size_t offset = std::min(g * SAMPLE_BLOCK_WIDTH, Channels - SAMPLE_BLOCK_WIDTH);
+		store(minimum + offset, mn[g]);
+		store(maximum + offset, mx[g]);
+	}
+}
+#endif
+
+template<size_t Channels>
+void minMaxOf(const RowLayout<Channels>& layout, const int32_t* data, size_t sampleCount, int32_t* minimum, int32_t* maximum) {
+#if SAMPLE_BLOCK_WIDTH > 1
+	(void)layout;
+	minMaxRegisters<Channels>(data, sampleCount, minimum, maximum);
+#else
+	accumulateMinMax(layout, data, sampleCount, minimum, maximum);
+#endif
+}
+
+// the run time count keeps the state in memory
+template<>
+void minMaxOf<0>(const RowLayout<0>& layout, const int32_t* data, size_t sampleCount, int32_t* minimum, int32_t* maximum) {
+	accumulateMinMax(layout, data, sampleCount, minimum, maximum);
+}
+
+template<size_t Channels>
+class Kernels : public SampleBlockKernels {
+public:
+	explicit Kernels(size_t channelsCount) : layout(channelsCount) {}
+
+	size_t channels() const override { return layout.channels(); }
+	size_t sampleSize() const override { return layout.stride(); }
+	bool specialized() const override { return Channels != 0; }
+
+	size_t lostSamples(const int32_t* data, size_t sampleCount, size_t& expectedCounter) const override {
+		return countLostSamples(layout, data, sampleCount, expectedCounter);
+	}
+	void minMax(const int32_t* data, size_t sampleCount, int32_t* minimum, int32_t* maximum) const override {
+		minMaxOf(layout, data, sampleCount, minimum, maximum);
+	}
+	// the fixed count was no faster here, stores to the planes dominate
+	void deinterleave(const int32_t* data, size_t sampleCount, int32_t* out, size_t planeStride) const override {
+		::deinterleave(RowLayout<0>(layout.channels()), data, sampleCount, out, planeStride);
+	}
+
+private:
+	const RowLayout<Channels> layout;
+};
+
+} // namespace
+
+std::unique_ptr<SampleBlockKernels> SampleBlockKernels::create(size_t channelsCount, bool generic) {
+	if (!generic && channelsCount == 16) return std::unique_ptr<SampleBlockKernels>(new Kernels<16>(channelsCount));
+	if (!generic && channelsCount == 21) return std::unique_ptr<SampleBlockKernels>(new Kernels<21>(channelsCount));
+	return std::unique_ptr<SampleBlockKernels>(new Kernels<0>(channelsCount));
+}
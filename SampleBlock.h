@@ -0,0 +1,86 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// layout of nb2GetData rows: ChannelsCount EEG words, the status word and the counter;
+// with the channel count known at compile time the row loops below have constant bounds
+// and strides; RowLayout<0> is the same code with the count given at run time
+template<size_t Channels>
+struct RowLayout {
+	explicit RowLayout(size_t = Channels) {}
+	static size_t channels() { return Channels; }
+	static size_t stride() { return Channels + 2; }
+};
+
+template<>
+struct RowLayout<0> {
+	explicit RowLayout(size_t channelsCount) : count(channelsCount) {}
+	size_t channels() const { return count; }
+	size_t stride() const { return count + 2; }
+	size_t count;
+};
+
+// number of lost samples, expectedCounter keeps the state between calls, zero counter is a reset
+template<class Layout>
+size_t countLostSamples(const Layout& layout, const int32_t* data, size_t sampleCount, size_t& expectedCounter) {
+	size_t lost = 0;
+	size_t expected = expectedCounter;
+	const uint32_t* counters = reinterpret_cast<const uint32_t*>(data) + layout.stride() - 1;
+	for (size_t i = 0; i < sampleCount; ++i) {
+		const uint32_t counter = counters[i * layout.stride()];
+		if (counter == 0) {
+			expected = 0;
+		}
+		lost += counter - expected;
+		expected = size_t(counter) + 1;
+	}
+	expectedCounter = expected;
+	return lost;
+}
+
+// running min and max of every channel
+template<class Layout>
+void accumulateMinMax(const Layout& layout, const int32_t* data, size_t sampleCount, int32_t* minimum, int32_t* maximum) {
+	for (size_t i = 0; i < sampleCount; ++i) {
+		const int32_t* row = data + i * layout.stride();
+		for (size_t ch = 0; ch < layout.channels(); ++ch) {
+			minimum[ch] = std::min(minimum[ch], row[ch]);
+			maximum[ch] = std::max(maximum[ch], row[ch]);
+		}
+	}
+}
+
+// channel ch of the rows to out + ch * planeStride
+template<class Layout>
+void deinterleave(const Layout& layout, const int32_t* data, size_t sampleCount, int32_t* out, size_t planeStride) {
+	for (size_t i = 0; i < sampleCount; ++i) {
+		const int32_t* row = data + i * layout.stride();
+		for (size_t ch = 0; ch < layout.channels(); ++ch) {
+			out[ch * planeStride + i] = row[ch];
+		}
+	}
+}
+
+// per block work on sample rows through one virtual call per block; the implementation is
+// chosen once for the channel count of the opened device: NB2-EEG16 and NB2-EEG21 rows get
+// their own instantiations, other counts (and generic = true, for comparison) the run time one.
+// The fixed counts keep the min/max of all channels in 2 or 3 AVX2 (4 to 6 SSE4.1) registers
+// for the whole block; lost samples measure the same in both, deinterleave is always the run
+// time one
+class SampleBlockKernels {
+public:
+	virtual ~SampleBlockKernels() {}
+
+	static std::unique_ptr<SampleBlockKernels> create(size_t channelsCount, bool generic = false);
+
+	virtual size_t channels() const = 0;
+	// rows of channels() + 2 words
+	virtual size_t sampleSize() const = 0;
+	virtual bool specialized() const = 0;
+
+	virtual size_t lostSamples(const int32_t* data, size_t sampleCount, size_t& expectedCounter) const = 0;
+	virtual void minMax(const int32_t* data, size_t sampleCount, int32_t* minimum, int32_t* maximum) const = 0;
+	virtual void deinterleave(const int32_t* data, size_t sampleCount, int32_t* out, size_t planeStride) const = 0;
+};
@@ -0,0 +1,143 @@
+#include "SampleConverter.h"
+#include <algorithm>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define SAMPLE_CONVERTER_WIDTH 8
+#elif defined(__SSE4_1__) || defined(__AVX__)
+	#include <smmintrin.h>
+	#define SAMPLE_CONVERTER_WIDTH 4
+#else
+	#define SAMPLE_CONVERTER_WIDTH 1
+#endif
+
+#if SAMPLE_CONVERTER_WIDTH == 8
+namespace {
+
+__m256i laneMask(size_t lanes) {
+	return _mm256_cmpgt_epi32(_mm256_set1_epi32(int(lanes)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// 8 rows of 8 channels into 8 channels of 8 samples
+void transpose(__m256 r[8]) {
+	const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+	const __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+	const __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+	const __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+	const __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	const __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	const __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+	const __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+	r[0] = _mm256_permute2f128_ps(s0, s4, 0x20); r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+	r[1] = _mm256_permute2f128_ps(s1, s5, 0x20); r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+	r[2] = _mm256_permute2f128_ps(s2, s6, 0x20); r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+	r[3] = _mm256_permute2f128_ps(s3, s7, 0x20); r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+} // namespace
+#endif
+
+SampleConverter::SampleConverter(size_t channelsCount, float resolution, const t_nb2Calibration* calibration, Nb2Range range) :
+	channelsCount(channelsCount),
+	paddedCount((channelsCount + SAMPLE_CONVERTER_WIDTH - 1) / SAMPLE_CONVERTER_WIDTH * SAMPLE_CONVERTER_WIDTH),
+	gains(paddedCount, 0.f), offsets(paddedCount, 0.f) {
+	const t_nb2CalibrationRange* cal = !calibration ? nullptr : range == Mv300 ? &calibration->Range300mV : &calibration->Range150mV;
+	const size_t calibrated = std::min<size_t>(channelsCount, sizeof(cal->Value) / sizeof(*cal->Value));
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		const double span = cal && ch < calibrated ? double(cal->Value[ch]) - double(cal->Offset[ch]) : 0.;
+		if (span > 0. && calibration->Voltage > 0.f) {
+			const double gain = double(calibration->Voltage) * 1e6 / span;
+			gains[ch] = float(gain);
+			offsets[ch] = float(-double(cal->Offset[ch]) * gain);
+		}
+		else {
+			gains[ch] = float(double(resolution) * 1e6); // no valid calibration of the channel
+		}
+	}
+}
+
+void SampleConverter::convertRows(const int32_t* data, size_t sampleCount, size_t sampleSize, float* out) const {
+	for (size_t i = 0; i < sampleCount; ++i) {
+		const int32_t* row = data + i * sampleSize;
+		float* values = out + i * channelsCount;
+		size_t ch = 0;
+#if SAMPLE_CONVERTER_WIDTH == 8
+		for (; ch < channelsCount; ch += 8) {
+			// the last group is masked, so it neither reads past the row nor writes past the output row
+			const __m256i mask = laneMask(channelsCount - ch);
+			const __m256 raw = _mm256_cvtepi32_ps(_mm256_maskload_epi32(row + ch, mask));
+			const __m256 uv = _mm256_add_ps(_mm256_mul_ps(raw, _mm256_loadu_ps(&gains[ch])), _mm256_loadu_ps(&offsets[ch]));
+			_mm256_maskstore_ps(values + ch, mask, uv);
+		}
+#elif SAMPLE_CONVERTER_WIDTH == 4
+		for (; ch + 4 <= channelsCount; ch += 4) {
+			const __m128 raw = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(row + ch)));
+			_mm_storeu_ps(values + ch, _mm_add_ps(_mm_mul_ps(raw, _mm_loadu_ps(&gains[ch])), _mm_loadu_ps(&offsets[ch])));
+		}
+#endif
+		for (; ch < channelsCount; ++ch) {
+			values[ch] = float(row[ch]) * gains[ch] + offsets[ch];
+		}
+	}
+}
+
+void SampleConverter::convertPlanar(const int32_t* data, size_t sampleCount, size_t sampleSize,
+	float* out, size_t planeStride, uint32_t* counters) const {
+	size_t i = 0;
+#if SAMPLE_CONVERTER_WIDTH == 8
+	// tiles of 8 rows by 8 channels are converted in registers and transposed
+	for (; i + 8 <= sampleCount; i += 8) {
+		const int32_t* rows = data + i * sampleSize;
+		for (size_t ch = 0; ch < channelsCount; ch += 8) {
+			const size_t lanes = std::min<size_t>(8, channelsCount - ch);
+			const __m256i mask = laneMask(lanes);
+			const __m256 gain = _mm256_loadu_ps(&gains[ch]);
+			const __m256 offset = _mm256_loadu_ps(&offsets[ch]);
+			__m256 r[8];
+			for (size_t k = 0; k < 8; ++k) {
+				const __m256 raw = _mm256_cvtepi32_ps(_mm256_maskload_epi32(rows + k * sampleSize + ch, mask));
+				r[k] = _mm256_add_ps(_mm256_mul_ps(raw, gain), offset);
+			}
+			transpose(r);
+			for (size_t k = 0; k < lanes; ++k) {
+				_mm256_storeu_ps(out + (ch + k) * planeStride + i, r[k]);
+			}
+		}
+	}
+#elif SAMPLE_CONVERTER_WIDTH == 4
+	// tiles of 4 rows by 4 channels, the channels of the last incomplete group one by one
+	const size_t groups = channelsCount / 4 * 4;
+	for (; i + 4 <= sampleCount; i += 4) {
+		const int32_t* rows = data + i * sampleSize;
+		for (size_t ch = 0; ch < groups; ch += 4) {
+			const __m128 gain = _mm_loadu_ps(&gains[ch]);
+			const __m128 offset = _mm_loadu_ps(&offsets[ch]);
+			__m128 r[4];
+			for (size_t k = 0; k < 4; ++k) {
+				const __m128 raw = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(rows + k * sampleSize + ch)));
+				r[k] = _mm_add_ps(_mm_mul_ps(raw, gain), offset);
+			}
+			_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+			for (size_t k = 0; k < 4; ++k) {
+				_mm_storeu_ps(out + (ch + k) * planeStride + i, r[k]);
+			}
+		}
+		for (size_t ch = groups; ch < channelsCount; ++ch) {
+			for (size_t k = 0; k < 4; ++k) {
+				out[ch * planeStride + i + k] = float(rows[k * sampleSize + ch]) * gains[ch] + offsets[ch];
+			}
+		}
+	}
+#endif
+	for (; i < sampleCount; ++i) {
+		const int32_t* row = data + i * sampleSize;
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			out[ch * planeStride + i] = float(row[ch]) * gains[ch] + offsets[ch];
+		}
+	}
+	if (counters) {
+		for (size_t j = 0; j < sampleCount; ++j) {
+			counters[j] = uint32_t(data[j * sampleSize + sampleSize - 1]);
+		}
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// conversion of nb2GetData sample rows from ADC bits to float microvolts with per channel
+// gain and offset precomputed for the input range: uV = (code - Offset) * Voltage / (Value - Offset)
+// from t_nb2Calibration, or code * Resolution when the device has no calibration or applies
+// it itself; whole blocks are converted in one pass (AVX2, SSE4.1 or scalar code)
+class SampleConverter {
+public:
+	// calibration is null for plain resolution scaling
+	SampleConverter(size_t channelsCount, float resolution, const t_nb2Calibration* calibration = nullptr, Nb2Range range = Mv150);
+
+	size_t channels() const { return channelsCount; }
+	// uV per bit and uV at zero code of a channel
+	float gain(size_t channel) const { return gains[channel]; }
+	float offset(size_t channel) const { return offsets[channel]; }
+
+	// sampleCount rows of sampleSize words into sampleCount rows of channelsCount values
+	void convertRows(const int32_t* data, size_t sampleCount, size_t sampleSize, float* out) const;
+	// deinterleaved: sampleCount values of channel ch at out + ch * planeStride, counters
+	// (the last word of the rows) into counters if it is not null
+	void convertPlanar(const int32_t* data, size_t sampleCount, size_t sampleSize,
+		float* out, size_t planeStride, uint32_t* counters = nullptr) const;
+
+private:
+	size_t channelsCount;
+	size_t paddedCount; // multiple of SIMD width, padding gains are 0
+	std::vector<float> gains;
+	std::vector<float> offsets;
+};
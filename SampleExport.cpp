@@ -0,0 +1,255 @@
+#include "SampleExport.h"
+#include "Nb2Format.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#include <fcntl.h>
+	#include <io.h>
+#endif
+
+namespace {
+
+const size_t EventCapacity = 1024;
+
+// "00" to "99"
+const char DigitPairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+char* formatUnsigned(char* p, uint64_t value) {
+	char digits[20];
+	char* d = digits + sizeof(digits);
+	while (value >= 100) {
+		d -= 2;
+		std::memcpy(d, DigitPairs + (value % 100) * 2, 2);
+		value /= 100;
+	}
+	if (value >= 10) {
+		d -= 2;
+		std::memcpy(d, DigitPairs + value * 2, 2);
+	}
+	else {
+		*--d = char('0' + value);
+	}
+	const size_t length = size_t(digits + sizeof(digits) - d);
+	std::memcpy(p, d, length);
+	return p + length;
+}
+
+// 3 decimals, rounded half away from zero
+char* formatMicrovolts(char* p, float value) {
+	const double scaled = double(value) * 1000.;
+	if (!(std::fabs(scaled) < 9e18)) {
+		std::memcpy(p, "nan", 3);
+		return p + 3;
+	}
+	int64_t milli = int64_t(scaled < 0. ? scaled - 0.5 : scaled + 0.5);
+	if (milli < 0) {
+		*p++ = '-';
+		milli = -milli;
+	}
+	p = formatUnsigned(p, uint64_t(milli / 1000));
+	const uint64_t fraction = uint64_t(milli % 1000);
+	*p++ = '.';
+	*p++ = char('0' + fraction / 100);
+	std::memcpy(p, DigitPairs + (fraction % 100) * 2, 2);
+	return p + 2;
+}
+
+void put32(char* p, uint32_t value) {
+	const uint8_t bytes[4] = { uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24) };
+	std::memcpy(p, bytes, 4);
+}
+
+uint32_t floatBits(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+// a counter is at or before another modulo 2^32
+bool notAfter(uint32_t counter, uint32_t other) {
+	return int32_t(counter - other) <= 0;
+}
+
+} // namespace
+
+SampleExporter::SampleExporter(const std::string& path, Format format, const SampleConverter& converter,
+	size_t sampleSize, size_t maxSamples, size_t bufferBytes) :
+	format(format), converter(converter), sampleSize(sampleSize), channelsCount(converter.channels()),
+	maxSamples(std::max<size_t>(1, maxSamples)), out(nullptr), owned(path != "-"),
+	buffer(std::max<size_t>(bufferBytes, 64 + channelsCount * 32)), used(0),
+	held(this->maxSamples * sampleSize), heldCount(0), microvolts(this->maxSamples * channelsCount),
+	rows(0), eventsCount(0), bytes(0) {
+	if (owned) {
+#ifdef _WIN32
+		if (fopen_s(&out, path.c_str(), "wb") != 0) out = nullptr;
+#else
+		out = std::fopen(path.c_str(), "wb");
+#endif
+		if (!out) {
+			throw std::runtime_error("Cannot create file: " + path);
+		}
+	}
+	else {
+		out = stdout;
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY); // no \r inserted, fewer copies
+#endif
+	}
+	pending.reserve(EventCapacity);
+	for (int type = 0; type < 256; ++type) {
+		typeNames.push_back(eventTypePrettyString(Nb2EventType(type)));
+	}
+	if (format == Csv) {
+		std::string header = "counter";
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			header += ",ch" + std::to_string(ch + 1);
+		}
+		header += ",event\n";
+		reserve(header.size());
+		std::memcpy(buffer.data() + used, header.data(), header.size());
+		used += header.size();
+	}
+}
+
+SampleExporter::~SampleExporter() {
+	try {
+		close();
+	}
+	catch (...) {
+	}
+}
+
+void SampleExporter::write(const int32_t* data, size_t sampleCount) {
+	if (!out) {
+		return;
+	}
+	if (sampleCount > maxSamples) {
+		throw std::runtime_error("Too many samples for the exporter");
+	}
+	formatHeld();
+	std::copy(data, data + sampleCount * sampleSize, held.begin());
+	heldCount = sampleCount;
+}
+
+void SampleExporter::write(const t_nb2Event* events, size_t count) {
+	for (size_t i = 0; i < count && out; ++i) {
+		if (pending.size() == EventCapacity) {
+			formatEvent(pending.front()); // rows of the oldest did not come, it is not held forever
+			pending.erase(pending.begin());
+		}
+		pending.push_back(events[i]);
+	}
+}
+
+void SampleExporter::formatHeld() {
+	if (heldCount == 0) {
+		return;
+	}
+	converter.convertRows(held.data(), heldCount, sampleSize, microvolts.data());
+	size_t event = 0;
+	for (size_t i = 0; i < heldCount; ++i) {
+		const uint32_t counter = uint32_t(held[i * sampleSize + sampleSize - 1]);
+		for (; event < pending.size() && notAfter(pending[event].Counter, counter); ++event) {
+			formatEvent(pending[event]);
+		}
+		formatRow(counter, &microvolts[i * channelsCount]);
+	}
+	pending.erase(pending.begin(), pending.begin() + event);
+	rows += heldCount;
+	heldCount = 0;
+}
+
+void SampleExporter::formatRow(uint32_t counter, const float* values) {
+	if (format == Csv) {
+		reserve(12 + channelsCount * 24);
+		char* p = buffer.data() + used;
+		p = formatUnsigned(p, counter);
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			*p++ = ',';
+			p = formatMicrovolts(p, values[ch]);
+		}
+		*p++ = ',';
+		*p++ = '\n';
+		used = size_t(p - buffer.data());
+	}
+	else {
+		const size_t size = (2 + channelsCount) * 4;
+		reserve(size);
+		char* p = buffer.data() + used;
+		put32(p, counter);
+		put32(p + 4, 0);
+		for (size_t ch = 0; ch < channelsCount; ++ch) {
+			put32(p + 8 + ch * 4, floatBits(values[ch]));
+		}
+		used += size;
+	}
+}
+
+void SampleExporter::formatEvent(const t_nb2Event& event) {
+	if (format == Csv) {
+		const std::string& name = typeNames[event.Type];
+		reserve(32 + channelsCount + name.size());
+		char* p = buffer.data() + used;
+		p = formatUnsigned(p, event.Counter);
+		std::memset(p, ',', channelsCount + 1);
+		p += channelsCount + 1;
+		std::memcpy(p, name.data(), name.size());
+		p += name.size();
+		*p++ = ':';
+		p = formatUnsigned(p, event.Value);
+		*p++ = '\n';
+		used = size_t(p - buffer.data());
+	}
+	else {
+		const size_t size = (2 + channelsCount) * 4;
+		reserve(size);
+		char* p = buffer.data() + used;
+		std::memset(p, 0, size);
+		put32(p, event.Counter);
+		put32(p + 4, uint32_t('E') | uint32_t(event.Type) << 8 | uint32_t(event.Value) << 16);
+		if (channelsCount) {
+			put32(p + 8, event.Number);
+		}
+		used += size;
+	}
+	++eventsCount;
+}
+
+void SampleExporter::reserve(size_t size) {
+	if (used + size > buffer.size()) {
+		flush();
+	}
+}
+
+void SampleExporter::flush() {
+	if (used && std::fwrite(buffer.data(), 1, used, out) != used) {
+		throw std::runtime_error("Export write error");
+	}
+	bytes += used;
+	used = 0;
+}
+
+void SampleExporter::close() {
+	if (!out) {
+		return;
+	}
+	formatHeld();
+	for (const t_nb2Event& event : pending) {
+		formatEvent(event);
+	}
+	pending.clear();
+	bool failed = used && std::fwrite(buffer.data(), 1, used, out) != used;
+	bytes += used;
+	used = 0;
+	failed = (owned ? std::fclose(out) != 0 : std::fflush(out) != 0) || failed;
+	out = nullptr;
+	if (failed) {
+		throw std::runtime_error("Export write error");
+	}
+}
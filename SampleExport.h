@@ -0,0 +1,65 @@
+#pragma once
+#include "SampleConverter.h"
+#include <nb2mcs/nb2mcs.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// export of every sample row and event for other tools, to a file or to stdout:
+// CSV: a "counter,ch1,...,chN,event" header line, a line per row with the counter and uV
+//      with 3 decimals and an empty event field, a line per event with the counter, empty
+//      channel fields and "<type>:<value>";
+// binary: little-endian records of 2 + N 32-bit words: counter, tag, N float uV for a row
+//      (tag 0), for an event tag 'E' | type << 8 | value << 16 and the event number as the
+//      first word of the values, the others 0.
+// Numbers are formatted by hand into a buffer written with one fwrite when it is full, nothing
+// is allocated after construction. The rows of a call are held until the next one, so events
+// read after the rows go before the first row with a later counter
+class SampleExporter {
+public:
+	enum Format { Csv, Binary };
+
+	// path "-" is stdout; maxSamples is the largest sampleCount of write
+	SampleExporter(const std::string& path, Format format, const SampleConverter& converter,
+		size_t sampleSize, size_t maxSamples, size_t bufferBytes = 1 << 20);
+	~SampleExporter();
+	SampleExporter(const SampleExporter&) = delete;
+	SampleExporter& operator=(const SampleExporter&) = delete;
+
+	// sample rows of sampleSize words, counter is the last word
+	void write(const int32_t* data, size_t sampleCount);
+	void write(const t_nb2Event* events, size_t count);
+	// writes the held rows and the events, flushes the output
+	void close();
+
+	uint64_t rowsWritten() const { return rows; }
+	uint64_t eventsWritten() const { return eventsCount; }
+	uint64_t bytesWritten() const { return bytes; }
+
+private:
+	void formatHeld();
+	void formatRow(uint32_t counter, const float* values);
+	void formatEvent(const t_nb2Event& event);
+	void reserve(size_t size);
+	void flush();
+
+	const Format format;
+	const SampleConverter& converter;
+	const size_t sampleSize;
+	const size_t channelsCount;
+	const size_t maxSamples;
+	std::FILE* out;
+	bool owned;
+	std::vector<char> buffer;
+	size_t used;
+	std::vector<int32_t> held; // rows of the last write
+	size_t heldCount;
+	std::vector<float> microvolts;
+	std::vector<t_nb2Event> pending; // events not written yet, in the order of reading
+	std::vector<std::string> typeNames;
+	uint64_t rows;
+	uint64_t eventsCount;
+	uint64_t bytes;
+};
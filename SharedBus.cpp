@@ -0,0 +1,214 @@
+#include "SharedBus.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#define NOMINMAX // std::min and std::max
+	#include <windows.h>
+#else
+	#include <cerrno>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace {
+
+size_t alignUp(size_t value) {
+	return (value + 63) / 64 * 64;
+}
+
+std::string objectName(const std::string& name) {
+#ifdef _WIN32
+	return "Local\\" + name;
+#else
+	return name.empty() || name[0] != '/' ? '/' + name : name;
+#endif
+}
+
+// items [head, head + count) of itemSize values, only the newest capacity items of a larger block are written
+template<typename T>
+void writeRing(std::atomic<uint64_t>& head, std::atomic<uint64_t>& reserve, uint64_t capacity,
+	T* ring, size_t itemSize, const T* items, size_t count) {
+	uint64_t start = head.load(std::memory_order_relaxed);
+	if (count > capacity) {
+		items += (count - size_t(capacity)) * itemSize;
+		start += count - capacity;
+		count = size_t(capacity);
+	}
+	reserve.store(start + count, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	const size_t slot = size_t(start % capacity);
+	const size_t first = std::min(count, size_t(capacity) - slot);
+	std::memcpy(ring + slot * itemSize, items, first * itemSize * sizeof(T));
+	std::memcpy(ring, items + first * itemSize, (count - first) * itemSize * sizeof(T));
+	head.store(start + count, std::memory_order_release);
+}
+
+// copies items from the cursor, then drops those the producer could overwrite during the copy
+template<typename T>
+size_t readRing(const std::atomic<uint64_t>& head, const std::atomic<uint64_t>& reserve, uint64_t capacity,
+	const T* ring, size_t itemSize, uint64_t& cursor, uint64_t& overrun, T* out, size_t maxCount) {
+	const uint64_t published = head.load(std::memory_order_acquire);
+	if (published - cursor > capacity) {
+		overrun += published - capacity - cursor;
+		cursor = published - capacity;
+	}
+	size_t count = size_t(std::min<uint64_t>(published - cursor, maxCount));
+	const size_t slot = size_t(cursor % capacity);
+	const size_t first = std::min(count, size_t(capacity) - slot);
+	std::memcpy(out, ring + slot * itemSize, first * itemSize * sizeof(T));
+	std::memcpy(out + first * itemSize, ring, (count - first) * itemSize * sizeof(T));
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	const uint64_t reserved = reserve.load(std::memory_order_relaxed);
+	const uint64_t intact = reserved > capacity ? reserved - capacity : 0; // the oldest item surely not overwritten
+	if (cursor < intact) {
+		const size_t torn = size_t(std::min<uint64_t>(count, intact - cursor));
+		std::memmove(out, out + torn * itemSize, (count - torn) * itemSize * sizeof(T));
+		overrun += torn;
+		cursor += torn;
+		count -= torn;
+	}
+	cursor += count;
+	return count;
+}
+
+} // namespace
+
+SharedMemory::SharedMemory(const std::string& name, size_t size) :
+	path(objectName(name)), owner(true), address(nullptr), length(size) {
+#ifdef _WIN32
+	handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		DWORD(uint64_t(size) >> 32), DWORD(size), path.c_str());
+	if (handle && GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(handle);
+		throw std::runtime_error("Shared memory is used by another producer: " + path);
+	}
+	if (handle) {
+		address = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	}
+	if (!address) {
+		if (handle) CloseHandle(handle);
+		throw std::runtime_error("Cannot create shared memory: " + path);
+	}
+#else
+	::shm_unlink(path.c_str()); // readers of an old bus keep their mapping
+	const int fd = ::shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0 || ::ftruncate(fd, off_t(size)) != 0 ||
+		(address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		const std::string error = std::strerror(errno);
+		if (fd >= 0) {
+			::close(fd);
+			::shm_unlink(path.c_str());
+		}
+		throw std::runtime_error("Cannot create shared memory " + path + ": " + error);
+	}
+	::close(fd);
+#endif
+}
+
+SharedMemory::SharedMemory(const std::string& name) :
+	path(objectName(name)), owner(false), address(nullptr), length(0) {
+#ifdef _WIN32
+	handle = OpenFileMappingA(FILE_MAP_READ, FALSE, path.c_str());
+	if (handle) {
+		address = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+	}
+	MEMORY_BASIC_INFORMATION info;
+	if (!address || !VirtualQuery(address, &info, sizeof(info))) {
+		if (handle) CloseHandle(handle);
+		throw std::runtime_error("Cannot open shared memory: " + path);
+	}
+	length = info.RegionSize;
+#else
+	const int fd = ::shm_open(path.c_str(), O_RDONLY, 0);
+	struct stat st;
+	if (fd < 0 || ::fstat(fd, &st) != 0 ||
+		(address = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		const std::string error = std::strerror(errno);
+		if (fd >= 0) ::close(fd);
+		throw std::runtime_error("Cannot open shared memory " + path + ": " + error);
+	}
+	length = size_t(st.st_size);
+	::close(fd);
+#endif
+}
+
+SharedMemory::~SharedMemory() {
+#ifdef _WIN32
+	UnmapViewOfFile(address);
+	CloseHandle(handle);
+#else
+	::munmap(address, length);
+	if (owner) {
+		::shm_unlink(path.c_str());
+	}
+#endif
+}
+
+SharedBusWriter::SharedBusWriter(const std::string& name, size_t sampleSize, const t_nb2Property& property, float seconds) :
+	memory(name, alignUp(sizeof(SharedBusHeader)) +
+		alignUp(size_t(std::max(1.f, property.Rate * seconds)) * sampleSize * sizeof(int32_t)) +
+		alignUp(size_t(std::max(64.f, seconds * 100.f)) * sizeof(t_nb2Event))),
+	header(new (memory.data()) SharedBusHeader()) {
+	header->SampleSize = uint32_t(sampleSize);
+	header->ChannelsCount = uint32_t(sampleSize - 2);
+	header->Rate = property.Rate;
+	header->Resolution = property.Resolution;
+	header->DataCapacity = size_t(std::max(1.f, property.Rate * seconds));
+	header->EventCapacity = size_t(std::max(64.f, seconds * 100.f));
+	header->DataOffset = alignUp(sizeof(SharedBusHeader));
+	header->EventOffset = header->DataOffset + alignUp(size_t(header->DataCapacity) * sampleSize * sizeof(int32_t));
+	header->DataHead = 0;
+	header->DataReserve = 0;
+	header->EventHead = 0;
+	header->EventReserve = 0;
+	header->Closed = 0;
+	header->Version = SharedBusHeader::VersionValue;
+	rows = reinterpret_cast<int32_t*>(static_cast<char*>(memory.data()) + header->DataOffset);
+	events = reinterpret_cast<t_nb2Event*>(static_cast<char*>(memory.data()) + header->EventOffset);
+	// readers check the magic last
+	std::atomic_thread_fence(std::memory_order_release);
+	header->Magic = SharedBusHeader::MagicValue;
+}
+
+SharedBusWriter::~SharedBusWriter() {
+	header->Closed.store(1, std::memory_order_release);
+}
+
+void SharedBusWriter::write(const int32_t* data, size_t sampleCount) {
+	writeRing(header->DataHead, header->DataReserve, header->DataCapacity, rows, header->SampleSize, data, sampleCount);
+}
+
+void SharedBusWriter::write(const t_nb2Event* items, size_t count) {
+	writeRing(header->EventHead, header->EventReserve, header->EventCapacity, events, 1, items, count);
+}
+
+SharedBusReader::SharedBusReader(const std::string& name) :
+	memory(name), header(static_cast<const SharedBusHeader*>(memory.data())),
+	dataCursor(0), eventCursor(0), samplesOverrun(0), eventsOverrun(0) {
+	if (memory.size() < sizeof(SharedBusHeader) || header->Magic != SharedBusHeader::MagicValue ||
+		header->Version != SharedBusHeader::VersionValue ||
+		header->EventOffset + header->EventCapacity * sizeof(t_nb2Event) > memory.size()) {
+		throw std::runtime_error("Not a sample bus: " + name);
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	rows = reinterpret_cast<const int32_t*>(static_cast<const char*>(memory.data()) + header->DataOffset);
+	events = reinterpret_cast<const t_nb2Event*>(static_cast<const char*>(memory.data()) + header->EventOffset);
+	dataCursor = header->DataHead.load(std::memory_order_acquire);
+	eventCursor = header->EventHead.load(std::memory_order_acquire);
+}
+
+size_t SharedBusReader::read(int32_t* data, size_t maxSamples) {
+	return readRing(header->DataHead, header->DataReserve, header->DataCapacity, rows, header->SampleSize,
+		dataCursor, samplesOverrun, data, maxSamples);
+}
+
+size_t SharedBusReader::read(t_nb2Event* out, size_t maxCount) {
+	return readRing(header->EventHead, header->EventReserve, header->EventCapacity, events, 1,
+		eventCursor, eventsOverrun, out, maxCount);
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// named shared memory mapping: POSIX shm_open/mmap, or a Windows file mapping
+class SharedMemory {
+public:
+	// creates (replacing an old one) read-write, or opens an existing one read-only
+	SharedMemory(const std::string& name, size_t size);
+	explicit SharedMemory(const std::string& name);
+	~SharedMemory();
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+
+	void* data() const { return address; }
+	size_t size() const { return length; }
+
+private:
+	std::string path;
+	bool owner;
+	void* address;
+	size_t length;
+#ifdef _WIN32
+	void* handle;
+#endif
+};
+
+// layout of a bus: header, ring of sample rows, ring of events; rows and events
+// are numbered from 0 by the producer, the head is the number of the next one;
+// before writing a block the producer announces its end in the reserve, so a reader
+// knows which of the items it has just copied may have been overwritten meanwhile
+struct SharedBusHeader {
+	enum { MagicValue = 0x3242534E, VersionValue = 1 }; // "NSB2"
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t SampleSize;    // words of a row, counter is the last word
+	uint32_t ChannelsCount;
+	float Rate;
+	float Resolution;       // Volts per bit
+	uint64_t DataCapacity;  // rows
+	uint64_t EventCapacity; // events
+	uint64_t DataOffset;    // bytes from the start of the mapping
+	uint64_t EventOffset;
+	alignas(64) std::atomic<uint64_t> DataHead;
+	std::atomic<uint64_t> DataReserve;
+	alignas(64) std::atomic<uint64_t> EventHead;
+	std::atomic<uint64_t> EventReserve;
+	alignas(64) std::atomic<uint32_t> Closed; // the producer has stopped
+};
+
+// producer side of a shared memory bus of nb2GetData rows and events: every row is
+// written once into the ring and the head is published, any number of readers in
+// other processes read the same memory, so fan-out costs the producer nothing per reader;
+// the producer never waits for readers, a reader which falls behind a full ring loses data
+class SharedBusWriter {
+public:
+	SharedBusWriter(const std::string& name, size_t sampleSize, const t_nb2Property& property, float seconds = 10.f);
+	~SharedBusWriter();
+
+	void write(const int32_t* data, size_t sampleCount);
+	void write(const t_nb2Event* events, size_t count);
+
+private:
+	SharedMemory memory;
+	SharedBusHeader* header;
+	int32_t* rows;
+	t_nb2Event* events;
+};
+
+// consumer side, attaches read-only and keeps its own cursor, which starts at the current
+// head; data overwritten by the producer before it was read is skipped and counted
+class SharedBusReader {
+public:
+	explicit SharedBusReader(const std::string& name);
+
+	size_t sampleSize() const { return header->SampleSize; }
+	size_t channels() const { return header->ChannelsCount; }
+	float rate() const { return header->Rate; }
+	float resolution() const { return header->Resolution; }
+	// the producer has stopped, nothing more is written
+	bool closed() const { return header->Closed.load(std::memory_order_acquire) != 0; }
+
+	// up to maxSamples rows of sampleSize() words, returns the number of rows
+	size_t read(int32_t* data, size_t maxSamples);
+	size_t read(t_nb2Event* out, size_t maxCount);
+
+	uint64_t overrunSamples() const { return samplesOverrun; }
+	uint64_t overrunEvents() const { return eventsOverrun; }
+
+private:
+	SharedMemory memory;
+	const SharedBusHeader* header;
+	const int32_t* rows;
+	const t_nb2Event* events;
+	uint64_t dataCursor;
+	uint64_t eventCursor;
+	uint64_t samplesOverrun;
+	uint64_t eventsOverrun;
+};
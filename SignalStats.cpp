@@ -0,0 +1,163 @@
+#include "SignalStats.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define SIGNAL_STATS_WIDTH 8
+#elif defined(__SSE4_1__) || defined(__AVX__)
+	#include <smmintrin.h>
+	#define SIGNAL_STATS_WIDTH 4
+#else
+	#define SIGNAL_STATS_WIDTH 1
+#endif
+
+namespace {
+// rows are processed in tiles small enough to stay in L1 cache: the tile is read from
+// memory once, then every group of channels walks it with accumulators in registers
+const size_t TileRows = 64;
+// rows of exact 64-bit squares between flushes, a multiple of TileRows
+const size_t FlushRows = 4096;
+}
+
+SignalStats::SignalStats(size_t channelsCount) :
+	channelsCount(channelsCount),
+	paddedCount((channelsCount + SIGNAL_STATS_WIDTH - 1) / SIGNAL_STATS_WIDTH * SIGNAL_STATS_WIDTH),
+	sampleCount(0),
+	reference(paddedCount), minimum(paddedCount), maximum(paddedCount),
+	sum(paddedCount), sumSquares(paddedCount), squares(paddedCount) {
+	reset();
+}
+
+void SignalStats::reset() {
+	sampleCount = 0;
+	std::fill(reference.begin(), reference.end(), 0);
+	std::fill(minimum.begin(), minimum.end(), std::numeric_limits<int32_t>::max());
+	std::fill(maximum.begin(), maximum.end(), std::numeric_limits<int32_t>::min());
+	std::fill(sum.begin(), sum.end(), 0);
+	std::fill(sumSquares.begin(), sumSquares.end(), 0);
+	std::fill(squares.begin(), squares.end(), 0.);
+}
+
+void SignalStats::flush() {
+	for (size_t ch = 0; ch < channelsCount; ++ch) {
+		squares[ch] += double(sumSquares[ch]);
+		sumSquares[ch] = 0;
+	}
+}
+
+void SignalStats::accumulate(const int32_t* data, size_t count, size_t sampleSize) {
+	if (count == 0) {
+		return;
+	}
+	if (sampleCount == 0) {
+		std::copy(data, data + channelsCount, reference.begin());
+	}
+	sampleCount += count;
+
+	for (size_t tile = 0; tile < count; tile += TileRows) {
+		const int32_t* rows = data + tile * sampleSize;
+		const size_t tileCount = std::min(TileRows, count - tile);
+		size_t channel = 0;
+
+#if SIGNAL_STATS_WIDTH == 8
+		for (; channel < channelsCount; channel += 8) {
+			// the last group is loaded with a mask, so it never reads past the row
+			const int lanes = int(std::min<size_t>(8, channelsCount - channel));
+			const __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+			const __m256i ref = _mm256_loadu_si256((const __m256i*)&reference[channel]);
+			__m256i mn = _mm256_loadu_si256((const __m256i*)&minimum[channel]);
+			__m256i mx = _mm256_loadu_si256((const __m256i*)&maximum[channel]);
+			__m256i s0 = _mm256_loadu_si256((const __m256i*)&sum[channel]);
+			__m256i s1 = _mm256_loadu_si256((const __m256i*)&sum[channel + 4]);
+			__m256i q0 = _mm256_loadu_si256((const __m256i*)&sumSquares[channel]);
+			__m256i q1 = _mm256_loadu_si256((const __m256i*)&sumSquares[channel + 4]);
+			for (size_t i = 0; i < tileCount; ++i) {
+				const int32_t* row = rows + i * sampleSize + channel;
+				const __m256i v = lanes == 8 ? _mm256_loadu_si256((const __m256i*)row) : _mm256_maskload_epi32(row, mask);
+				mn = _mm256_min_epi32(mn, v);
+				mx = _mm256_max_epi32(mx, v);
+				const __m256i d = _mm256_sub_epi32(v, ref);
+				const __m256i d0 = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(d));
+				const __m256i d1 = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(d, 1));
+				s0 = _mm256_add_epi64(s0, d0);
+				s1 = _mm256_add_epi64(s1, d1);
+				q0 = _mm256_add_epi64(q0, _mm256_mul_epi32(d0, d0));
+				q1 = _mm256_add_epi64(q1, _mm256_mul_epi32(d1, d1));
+			}
+			_mm256_storeu_si256((__m256i*)&minimum[channel], mn);
+			_mm256_storeu_si256((__m256i*)&maximum[channel], mx);
+			_mm256_storeu_si256((__m256i*)&sum[channel], s0);
+			_mm256_storeu_si256((__m256i*)&sum[channel + 4], s1);
+			_mm256_storeu_si256((__m256i*)&sumSquares[channel], q0);
+			_mm256_storeu_si256((__m256i*)&sumSquares[channel + 4], q1);
+		}
+#elif SIGNAL_STATS_WIDTH == 4
+		for (; channel + 4 <= channelsCount; channel += 4) {
+			const __m128i ref = _mm_loadu_si128((const __m128i*)&reference[channel]);
+			__m128i mn = _mm_loadu_si128((const __m128i*)&minimum[channel]);
+			__m128i mx = _mm_loadu_si128((const __m128i*)&maximum[channel]);
+			__m128i s0 = _mm_loadu_si128((const __m128i*)&sum[channel]);
+			__m128i s1 = _mm_loadu_si128((const __m128i*)&sum[channel + 2]);
+			__m128i q0 = _mm_loadu_si128((const __m128i*)&sumSquares[channel]);
+			__m128i q1 = _mm_loadu_si128((const __m128i*)&sumSquares[channel + 2]);
+			for (size_t i = 0; i < tileCount; ++i) {
+				const __m128i v = _mm_loadu_si128((const __m128i*)(rows + i * sampleSize + channel));
+				mn = _mm_min_epi32(mn, v);
+				mx = _mm_max_epi32(mx, v);
+				const __m128i d = _mm_sub_epi32(v, ref);
+				const __m128i d0 = _mm_cvtepi32_epi64(d);
+				const __m128i d1 = _mm_cvtepi32_epi64(_mm_srli_si128(d, 8));
+				s0 = _mm_add_epi64(s0, d0);
+				s1 = _mm_add_epi64(s1, d1);
+				q0 = _mm_add_epi64(q0, _mm_mul_epi32(d0, d0));
+				q1 = _mm_add_epi64(q1, _mm_mul_epi32(d1, d1));
+			}
+			_mm_storeu_si128((__m128i*)&minimum[channel], mn);
+			_mm_storeu_si128((__m128i*)&maximum[channel], mx);
+			_mm_storeu_si128((__m128i*)&sum[channel], s0);
+			_mm_storeu_si128((__m128i*)&sum[channel + 2], s1);
+			_mm_storeu_si128((__m128i*)&sumSquares[channel], q0);
+			_mm_storeu_si128((__m128i*)&sumSquares[channel + 2], q1);
+		}
+#endif
+		// scalar code for the remaining channels
+		for (size_t i = 0; i < tileCount && channel < channelsCount; ++i) {
+			const int32_t* row = rows + i * sampleSize;
+			for (size_t ch = channel; ch < channelsCount; ++ch) {
+				const int32_t value = row[ch];
+				minimum[ch] = std::min(minimum[ch], value);
+				maximum[ch] = std::max(maximum[ch], value);
+				const int64_t d = int64_t(value) - reference[ch];
+				sum[ch] += d;
+				sumSquares[ch] += d * d;
+			}
+		}
+		if ((tile + TileRows) % FlushRows == 0) {
+			flush();
+		}
+	}
+	flush();
+}
+
+int64_t SignalStats::peakToPeak(size_t channel) const {
+	return sampleCount ? int64_t(maximum[channel]) - minimum[channel] : 0;
+}
+
+double SignalStats::mean(size_t channel) const {
+	return sampleCount ? reference[channel] + double(sum[channel]) / double(sampleCount) : 0.;
+}
+
+double SignalStats::variance(size_t channel) const {
+	if (sampleCount == 0) {
+		return 0.;
+	}
+	const double s = double(sum[channel]);
+	return std::max(0., (squares[channel] - s * s / double(sampleCount)) / double(sampleCount));
+}
+
+double SignalStats::rms(size_t channel) const {
+	const double m = mean(channel);
+	return std::sqrt(m * m + variance(channel));
+}
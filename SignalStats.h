@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// min/max, mean, rms and variance of all channels, accumulated over any number of
+// blocks of interleaved sample rows in one pass (AVX2, SSE4.1 or scalar code);
+// the values are shifted by the first sample of each channel, so the variance of
+// DC-coupled signals does not lose precision; sums are exact 64-bit integers, the
+// squares are exact within runs of FlushRows rows and added up as doubles after
+// each run (a 24-bit difference squared is up to 2^48, 2^15 of them fill 64 bits)
+class SignalStats {
+public:
+	explicit SignalStats(size_t channelsCount);
+
+	// starts a new period of time
+	void reset();
+	// adds sampleCount rows of sampleSize words, the first channelsCount words of a row are used
+	void accumulate(const int32_t* data, size_t sampleCount, size_t sampleSize);
+
+	size_t channels() const { return channelsCount; }
+	uint64_t count() const { return sampleCount; }
+
+	// values in ADC bits, multiply by t_nb2Property::Resolution for Volts
+	int32_t min(size_t channel) const { return minimum[channel]; }
+	int32_t max(size_t channel) const { return maximum[channel]; }
+	int64_t peakToPeak(size_t channel) const;
+	double mean(size_t channel) const;
+	double rms(size_t channel) const;
+	double variance(size_t channel) const;
+
+private:
+	size_t channelsCount;
+	size_t paddedCount; // multiple of SIMD width, padding lanes are ignored
+	uint64_t sampleCount;
+	std::vector<int32_t> reference;
+	std::vector<int32_t> minimum;
+	std::vector<int32_t> maximum;
+	std::vector<int64_t> sum;
+	std::vector<int64_t> sumSquares; // of the current run, see flush
+	std::vector<double> squares;
+
+	void flush();
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// lock-free single-producer/single-consumer ring buffer of trivially copyable items,
+// one thread calls write, another thread calls read/peek/consume;
+// positions are free-running 64-bit counters, so the capacity may be any size
+// (sample rows are written whole, capacity is a multiple of the row size)
+template <typename T>
+class SpscRing {
+	static_assert(std::is_trivially_copyable<T>::value, "SpscRing items are copied by memcpy");
+public:
+	explicit SpscRing(size_t capacity) : buffer(capacity), head(0), tail(0) {}
+	SpscRing(const SpscRing&) = delete;
+	SpscRing& operator=(const SpscRing&) = delete;
+
+	size_t capacity() const { return buffer.size(); }
+
+	// number of items available for reading, producer or consumer side
+	size_t size() const {
+		return size_t(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+	}
+
+	// producer: copies up to count items, returns number of copied items
+	size_t write(const T* items, size_t count) {
+		const uint64_t h = head.load(std::memory_order_relaxed);
+		const size_t space = buffer.size() - size_t(h - tail.load(std::memory_order_acquire));
+		count = std::min(count, space);
+		copyIn(h, items, count);
+		head.store(h + count, std::memory_order_release);
+		return count;
+	}
+
+	// consumer: copies up to count items, returns number of copied items
+	size_t read(T* items, size_t count) {
+		count = peek(items, count);
+		consume(count);
+		return count;
+	}
+
+	// consumer: copies up to count items without removing them
+	size_t peek(T* items, size_t count) const {
+		const uint64_t t = tail.load(std::memory_order_relaxed);
+		count = std::min(count, size_t(head.load(std::memory_order_acquire) - t));
+		const size_t offset = size_t(t % buffer.size());
+		const size_t first = std::min(count, buffer.size() - offset);
+		std::memcpy(items, buffer.data() + offset, first * sizeof(T));
+		std::memcpy(items + first, buffer.data(), (count - first) * sizeof(T));
+		return count;
+	}
+
+	// consumer: removes count items (no more than size())
+	void consume(size_t count) {
+		tail.store(tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+private:
+	void copyIn(uint64_t position, const T* items, size_t count) {
+		const size_t offset = size_t(position % buffer.size());
+		const size_t first = std::min(count, buffer.size() - offset);
+		std::memcpy(buffer.data() + offset, items, first * sizeof(T));
+		std::memcpy(buffer.data(), items + first, (count - first) * sizeof(T));
+	}
+
+	std::vector<T> buffer;
+	// producer and consumer positions on separate cache lines
+	char padding0[64];
+	std::atomic<uint64_t> head;
+	char padding1[64 - sizeof(uint64_t)];
+	std::atomic<uint64_t> tail;
+};
@@ -0,0 +1,454 @@
+#include "StreamServer.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef _WIN32
+	#include <cerrno>
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <sys/socket.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t MaxIov = 64; // frames of one sendmsg
+const size_t ReadBuffer = 1 << 16;
+
+int64_t steadyNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifndef _WIN32
+// "host:port" or "port", loopback by default
+addrinfo* resolve(const std::string& address, bool passive) {
+	const std::string::size_type colon = address.rfind(':');
+	const std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+	const std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	addrinfo* result = nullptr;
+	const int error = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+	if (error != 0) {
+		throw std::runtime_error("Bad stream address " + address + ": " + ::gai_strerror(error));
+	}
+	return result;
+}
+#endif
+
+} // namespace
+
+StreamServer::StreamServer(const std::string& address, size_t sampleSize, const t_nb2Property& property, const Settings& settings) :
+	sampleSize(sampleSize),
+	batchSamples(std::max<size_t>(1, size_t(property.Rate * float(settings.LatencyMs) / 1000.f))),
+	sets(settings), fillingCount(0), sequence(0),
+	listener(-1), poller(-1), wakeup(-1), stopping(false), connected(0), sent(0), dropped(0) {
+	hello.SampleSize = uint32_t(sampleSize);
+	hello.ChannelsCount = uint32_t(sampleSize - 2);
+	hello.Rate = property.Rate;
+	hello.Resolution = property.Resolution;
+#ifdef _WIN32
+	throw std::runtime_error("Stream server is not supported on Windows: " + address);
+#else
+	addrinfo* addresses = resolve(address, true);
+	std::string error = "no address";
+	for (const addrinfo* a = addresses; a && listener < 0; a = a->ai_next) {
+		listener = ::socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+		const int on = 1;
+		if (listener >= 0 && (::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+			::bind(listener, a->ai_addr, a->ai_addrlen) != 0 || ::listen(listener, 64) != 0)) {
+			error = std::strerror(errno);
+			::close(listener);
+			listener = -1;
+		}
+	}
+	::freeaddrinfo(addresses);
+	if (listener < 0) {
+		throw std::runtime_error("Cannot listen on " + address + ": " + error);
+	}
+	poller = ::epoll_create1(EPOLL_CLOEXEC);
+	wakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	epoll_event listen = {}, wake = {};
+	listen.events = EPOLLIN;
+	listen.data.fd = listener;
+	wake.events = EPOLLIN;
+	wake.data.fd = wakeup;
+	if (poller < 0 || wakeup < 0 || ::epoll_ctl(poller, EPOLL_CTL_ADD, listener, &listen) != 0 ||
+		::epoll_ctl(poller, EPOLL_CTL_ADD, wakeup, &wake) != 0) {
+		error = std::strerror(errno);
+		if (wakeup >= 0) ::close(wakeup);
+		if (poller >= 0) ::close(poller);
+		::close(listener);
+		throw std::runtime_error("Cannot start stream server: " + error);
+	}
+	thread = std::thread(&StreamServer::run, this);
+#endif
+}
+
+StreamServer::~StreamServer() {
+#ifndef _WIN32
+	flush();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	const uint64_t one = 1;
+	(void)::write(wakeup, &one, sizeof(one));
+	thread.join();
+	for (const auto& client : sockets) {
+		::close(client.first);
+	}
+	::close(wakeup);
+	::close(poller);
+	::close(listener);
+#endif
+}
+
+std::shared_ptr<std::vector<uint8_t>> StreamServer::frame(StreamFrameHeader::FrameType type, size_t count, size_t bytes) {
+	auto data = std::make_shared<std::vector<uint8_t>>(sizeof(StreamFrameHeader));
+	data->reserve(sizeof(StreamFrameHeader) + bytes);
+	StreamFrameHeader header = {};
+	header.Magic = StreamFrameHeader::MagicValue;
+	header.Type = uint16_t(type);
+	header.Bytes = uint32_t(bytes);
+	header.Count = uint32_t(count);
+	std::memcpy(data->data(), &header, sizeof(header));
+	return data;
+}
+
+void StreamServer::publish(const int32_t* data, size_t sampleCount) {
+	const size_t rowBytes = sampleSize * sizeof(int32_t);
+	while (sampleCount) {
+		if (!filling) {
+			filling = frame(StreamFrameHeader::Samples, 0, batchSamples * rowBytes);
+			fillingCount = 0;
+			fillingSince = std::chrono::steady_clock::now();
+		}
+		const size_t count = std::min(sampleCount, batchSamples - fillingCount);
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+		filling->insert(filling->end(), bytes, bytes + count * rowBytes);
+		fillingCount += count;
+		data += count * sampleSize;
+		sampleCount -= count;
+		if (fillingCount == batchSamples) {
+			seal();
+		}
+	}
+	if (filling && std::chrono::steady_clock::now() - fillingSince >= std::chrono::milliseconds(sets.LatencyMs)) {
+		seal();
+	}
+}
+
+void StreamServer::publish(const t_nb2Event* events, size_t count) {
+	if (!count) {
+		return;
+	}
+	// events are rare, every call is one frame
+	auto data = frame(StreamFrameHeader::Events, count, count * sizeof(t_nb2Event));
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(events);
+	data->insert(data->end(), bytes, bytes + count * sizeof(t_nb2Event));
+	StreamFrameHeader* header = reinterpret_cast<StreamFrameHeader*>(data->data());
+	header->Sequence = sequence++;
+	header->Time = steadyNanoseconds();
+	hand(data);
+}
+
+void StreamServer::flush() {
+	if (filling) {
+		seal();
+	}
+}
+
+void StreamServer::seal() {
+	StreamFrameHeader* header = reinterpret_cast<StreamFrameHeader*>(filling->data());
+	header->Bytes = uint32_t(filling->size() - sizeof(StreamFrameHeader));
+	header->Count = uint32_t(fillingCount);
+	header->Sequence = sequence++;
+	header->Time = steadyNanoseconds();
+	hand(filling);
+	filling.reset();
+}
+
+void StreamServer::hand(const Frame& frame) {
+	bool first;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		first = handed.empty();
+		handed.push_back(frame);
+	}
+#ifndef _WIN32
+	// the server thread takes all handed frames at once, one signal is enough
+	if (first) {
+		const uint64_t one = 1;
+		(void)::write(wakeup, &one, sizeof(one));
+	}
+#else
+	(void)first;
+#endif
+}
+
+void StreamServer::run() {
+#ifndef _WIN32
+	std::vector<Frame> frames;
+	epoll_event ready[64];
+	for (;;) {
+		const int count = ::epoll_wait(poller, ready, 64, -1);
+		for (int i = 0; i < count; ++i) {
+			const int fd = ready[i].data.fd;
+			if (fd == listener) {
+				accept();
+				continue;
+			}
+			if (fd == wakeup) {
+				uint64_t value;
+				(void)::read(wakeup, &value, sizeof(value));
+				bool last;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					last = stopping;
+					frames.swap(handed);
+				}
+				for (auto client = sockets.begin(); client != sockets.end();) {
+					const int socket = client->first;
+					Client& state = (client++)->second;
+					for (const Frame& frame : frames) {
+						enqueue(state, frame);
+					}
+					if (!state.Waiting && !send(socket, state)) {
+						drop(socket);
+					}
+				}
+				frames.clear();
+				if (last) {
+					return; // the last frames are only sent if the socket buffers take them at once
+				}
+				continue;
+			}
+			const auto client = sockets.find(fd);
+			if (client == sockets.end()) {
+				continue; // dropped by an earlier event of this wait
+			}
+			bool alive = !(ready[i].events & (EPOLLERR | EPOLLHUP));
+			if (alive && (ready[i].events & EPOLLIN)) {
+				// clients do not send anything, the read only detects the close
+				char buffer[256];
+				const ssize_t n = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+				alive = n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+			}
+			if (alive && (ready[i].events & EPOLLOUT)) {
+				alive = send(fd, client->second);
+			}
+			if (!alive) {
+				drop(fd);
+			}
+		}
+	}
+#endif
+}
+
+void StreamServer::accept() {
+#ifndef _WIN32
+	for (;;) {
+		const int socket = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (socket < 0) {
+			return;
+		}
+		const int on = 1;
+		::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.fd = socket;
+		if (::epoll_ctl(poller, EPOLL_CTL_ADD, socket, &event) != 0) {
+			::close(socket);
+			continue;
+		}
+		Client& client = sockets[socket];
+		auto greeting = frame(StreamFrameHeader::Hello, 1, sizeof(hello));
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&hello);
+		greeting->insert(greeting->end(), bytes, bytes + sizeof(hello));
+		reinterpret_cast<StreamFrameHeader*>(greeting->data())->Time = steadyNanoseconds();
+		enqueue(client, greeting);
+		++connected;
+		if (!send(socket, client)) {
+			drop(socket);
+		}
+	}
+#endif
+}
+
+void StreamServer::enqueue(Client& client, const Frame& frame) {
+	client.Queue.push_back(frame);
+	client.Queued += frame->size();
+	// backpressure: the oldest frames not started yet are dropped, the sequence shows the gap
+	const size_t keep = client.Offset ? 1 : 0;
+	while (client.Queued > sets.MaxQueueBytes && client.Queue.size() > keep + 1) {
+		client.Queued -= client.Queue[keep]->size();
+		client.Queue.erase(client.Queue.begin() + keep);
+		++dropped;
+	}
+}
+
+// sends queued frames until the socket buffer is full, false if the connection is broken
+bool StreamServer::send(int socket, Client& client) {
+#ifndef _WIN32
+	while (!client.Queue.empty()) {
+		iovec iov[MaxIov];
+		size_t count = 0;
+		for (size_t i = 0; i < client.Queue.size() && count < MaxIov; ++i, ++count) {
+			const std::vector<uint8_t>& data = *client.Queue[i];
+			const size_t skip = i == 0 ? client.Offset : 0;
+			iov[count].iov_base = const_cast<uint8_t*>(data.data() + skip);
+			iov[count].iov_len = data.size() - skip;
+		}
+		msghdr message = {};
+		message.msg_iov = iov;
+		message.msg_iovlen = count;
+		const ssize_t n = ::sendmsg(socket, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		size_t written = size_t(n);
+		client.Queued -= written;
+		while (written) {
+			const size_t left = client.Queue.front()->size() - client.Offset;
+			if (written < left) {
+				client.Offset += written;
+				break;
+			}
+			written -= left;
+			client.Offset = 0;
+			client.Queue.pop_front();
+			++sent;
+		}
+	}
+	// EPOLLOUT only while there is something to send
+	const bool waiting = !client.Queue.empty();
+	if (waiting != client.Waiting) {
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLRDHUP | (waiting ? uint32_t(EPOLLOUT) : 0u);
+		event.data.fd = socket;
+		if (::epoll_ctl(poller, EPOLL_CTL_MOD, socket, &event) != 0) {
+			return false;
+		}
+		client.Waiting = waiting;
+	}
+	return true;
+#else
+	(void)socket;
+	(void)client;
+	return false;
+#endif
+}
+
+void StreamServer::drop(int socket) {
+#ifndef _WIN32
+	::epoll_ctl(poller, EPOLL_CTL_DEL, socket, nullptr);
+	::close(socket);
+	sockets.erase(socket);
+	--connected;
+#else
+	(void)socket;
+#endif
+}
+
+StreamClient::StreamClient(const std::string& address) :
+	socket(-1), hello(), buffer(ReadBuffer), begin(0), end(0) {
+#ifdef _WIN32
+	throw std::runtime_error("Stream client is not supported on Windows: " + address);
+#else
+	addrinfo* addresses = resolve(address, false);
+	std::string error = "no address";
+	for (const addrinfo* a = addresses; a && socket < 0; a = a->ai_next) {
+		socket = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+		if (socket >= 0 && ::connect(socket, a->ai_addr, a->ai_addrlen) != 0) {
+			error = std::strerror(errno);
+			::close(socket);
+			socket = -1;
+		}
+	}
+	::freeaddrinfo(addresses);
+	if (socket < 0) {
+		throw std::runtime_error("Cannot connect to " + address + ": " + error);
+	}
+	const int on = 1;
+	::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	StreamFrameHeader header;
+	std::vector<uint8_t> payload;
+	if (!read(header, payload) || header.Type != StreamFrameHeader::Hello || payload.size() != sizeof(hello)) {
+		::close(socket);
+		throw std::runtime_error("Not a sample stream: " + address);
+	}
+	std::memcpy(&hello, payload.data(), sizeof(hello));
+#endif
+}
+
+StreamClient::~StreamClient() {
+#ifndef _WIN32
+	::close(socket);
+#endif
+}
+
+void StreamClient::shutdown() {
+#ifndef _WIN32
+	::shutdown(socket, SHUT_RDWR);
+#endif
+}
+
+// at least bytes unread bytes in the buffer
+bool StreamClient::fill(size_t bytes) {
+#ifndef _WIN32
+	if (end - begin >= bytes) {
+		return true;
+	}
+	std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+	end -= begin;
+	begin = 0;
+	if (buffer.size() < bytes) {
+		buffer.resize(bytes);
+	}
+	while (end < bytes) {
+		const ssize_t n = ::recv(socket, buffer.data() + end, buffer.size() - end, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		end += size_t(n);
+	}
+	return true;
+#else
+	(void)bytes;
+	return false;
+#endif
+}
+
+bool StreamClient::read(StreamFrameHeader& header, std::vector<uint8_t>& payload) {
+	if (!fill(sizeof(header))) {
+		return false;
+	}
+	std::memcpy(&header, buffer.data() + begin, sizeof(header));
+	if (header.Magic != StreamFrameHeader::MagicValue) {
+		throw std::runtime_error("Corrupt sample stream");
+	}
+	if (!fill(sizeof(header) + header.Bytes)) {
+		return false;
+	}
+	payload.assign(buffer.begin() + std::ptrdiff_t(begin + sizeof(header)),
+		buffer.begin() + std::ptrdiff_t(begin + sizeof(header) + header.Bytes));
+	begin += sizeof(header) + header.Bytes;
+	return true;
+}
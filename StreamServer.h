@@ -0,0 +1,135 @@
+#pragma once
+#include <nb2mcs/nb2mcs.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// message of a TCP stream: this header and Bytes of payload, host byte order; the payload
+// is StreamHello, sample rows of SampleSize words (counter last) or t_nb2Event items
+struct StreamFrameHeader {
+	enum { MagicValue = 0x3253424E }; // "NBS2"
+	enum FrameType { Hello, Samples, Events };
+	uint32_t Magic;
+	uint16_t Type;
+	uint16_t Reserved;
+	uint32_t Bytes;    // payload
+	uint32_t Count;    // rows or events
+	uint64_t Sequence; // data frames are numbered from 0 by the server, a gap is a frame dropped for this client
+	int64_t Time;      // steady clock nanoseconds when the frame was sealed by the server
+};
+
+// payload of the first frame of a connection
+struct StreamHello {
+	uint32_t SampleSize;
+	uint32_t ChannelsCount;
+	float Rate;
+	float Resolution; // Volts per bit
+};
+
+// TCP server of sample rows and events for processes on the same host or in containers (Linux):
+// the producer batches rows into frames of at most LatencyMs of samples and hands sealed frames
+// to the server thread, which runs an epoll loop; a frame is formatted once, shared by all clients
+// and sent with scatter-gather sendmsg of several queued frames at once; the producer never waits
+// for the network, a client whose queue exceeds MaxQueueBytes loses its oldest frames
+class StreamServer {
+public:
+	struct Settings {
+		Settings() : LatencyMs(20), MaxQueueBytes(8 << 20) {}
+		unsigned LatencyMs;   // the longest time a row waits in a frame being filled
+		size_t MaxQueueBytes; // frames waiting for one client
+	};
+
+	// "host:port" or "port" for the loopback interface
+	StreamServer(const std::string& address, size_t sampleSize, const t_nb2Property& property,
+		const Settings& settings = Settings());
+	~StreamServer();
+	StreamServer(const StreamServer&) = delete;
+	StreamServer& operator=(const StreamServer&) = delete;
+
+	// producer thread only
+	void publish(const int32_t* data, size_t sampleCount);
+	void publish(const t_nb2Event* events, size_t count);
+	// seals the frame being filled regardless of its age
+	void flush();
+
+	size_t clients() const { return connected.load(); }
+	uint64_t framesSent() const { return sent.load(); }
+	uint64_t framesDropped() const { return dropped.load(); }
+
+private:
+	typedef std::shared_ptr<const std::vector<uint8_t>> Frame;
+
+	struct Client {
+		std::deque<Frame> Queue;
+		size_t Offset = 0; // bytes of the front frame already sent
+		size_t Queued = 0; // bytes of the queue
+		bool Waiting = false; // EPOLLOUT is armed
+	};
+
+	std::shared_ptr<std::vector<uint8_t>> frame(StreamFrameHeader::FrameType type, size_t count, size_t bytes);
+	void seal();
+	void hand(const Frame& frame);
+	void run();
+	void accept();
+	void enqueue(Client& client, const Frame& frame);
+	bool send(int socket, Client& client);
+	void drop(int socket);
+
+	const size_t sampleSize;
+	const size_t batchSamples;
+	const Settings sets;
+	StreamHello hello;
+
+	// producer side
+	std::shared_ptr<std::vector<uint8_t>> filling;
+	size_t fillingCount;
+	std::chrono::steady_clock::time_point fillingSince;
+	uint64_t sequence;
+
+	// server thread side
+	std::map<int, Client> sockets;
+	int listener;
+	int poller;
+	int wakeup; // eventfd signalled by hand and the destructor
+
+	std::mutex mutex;
+	std::vector<Frame> handed;
+	bool stopping;
+	std::atomic<size_t> connected;
+	std::atomic<uint64_t> sent;
+	std::atomic<uint64_t> dropped;
+	std::thread thread;
+};
+
+// blocking reader of a stream, one connection
+class StreamClient {
+public:
+	// connects and reads the Hello frame
+	explicit StreamClient(const std::string& address);
+	~StreamClient();
+	StreamClient(const StreamClient&) = delete;
+	StreamClient& operator=(const StreamClient&) = delete;
+
+	const StreamHello& info() const { return hello; }
+	// next whole frame, false when the server has closed the connection or after shutdown
+	bool read(StreamFrameHeader& header, std::vector<uint8_t>& payload);
+	// unblocks read from another thread
+	void shutdown();
+
+private:
+	bool fill(size_t bytes);
+
+	int socket;
+	StreamHello hello;
+	std::vector<uint8_t> buffer;
+	size_t begin;
+	size_t end;
+};
@@ -0,0 +1,180 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed-size pool of worker threads running submitted tasks in FIFO order,
+// the destructor runs all tasks left in the queue and joins the threads
+class ThreadPool {
+public:
+	explicit ThreadPool(size_t threadsCount = std::thread::hardware_concurrency()) : stopping(false) {
+		for (size_t i = 0; i < (threadsCount ? threadsCount : 1); ++i) {
+			threads.emplace_back([this] { run(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t size() const { return threads.size(); }
+
+	void submit(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+	}
+
+private:
+	void run() {
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if (tasks.empty()) {
+					return;
+				}
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+};
+
+// pool of worker threads with a task queue each: a task submitted by a worker goes to its
+// own queue, which it runs newest first while the data of the submitter is still in cache,
+// a task submitted from outside goes to the queues in turn; an idle worker takes the oldest
+// task of another queue, so a worker splitting a large job into many tasks is helped by all
+// others. The destructor runs all tasks left in the queues and joins the threads
+class WorkStealingPool {
+public:
+	explicit WorkStealingPool(size_t threadsCount = std::thread::hardware_concurrency()) :
+		next(0), pending(0), stolen(0), stopping(false) {
+		const size_t count = threadsCount ? threadsCount : 1;
+		for (size_t i = 0; i < count; ++i) {
+			queues.emplace_back(new Queue());
+		}
+		for (size_t i = 0; i < count; ++i) {
+			threads.emplace_back([this, i] { run(i); });
+		}
+	}
+
+	~WorkStealingPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	size_t size() const { return threads.size(); }
+	// tasks taken from the queue of another worker
+	uint64_t steals() const { return stolen.load(); }
+
+	void submit(std::function<void()> task) {
+		const Worker& self = current();
+		const size_t index = self.Pool == this ? self.Index : next++ % queues.size();
+		++pending;
+		{
+			std::lock_guard<std::mutex> lock(queues[index]->Mutex);
+			queues[index]->Tasks.push_back(std::move(task));
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		wake.notify_one();
+	}
+
+private:
+	struct Queue {
+		std::mutex Mutex;
+		std::deque<std::function<void()>> Tasks;
+	};
+
+	struct Worker {
+		const WorkStealingPool* Pool;
+		size_t Index;
+	};
+
+	static Worker& current() {
+		static thread_local Worker worker = { nullptr, 0 };
+		return worker;
+	}
+
+	// the newest task of the own queue, or the oldest of the others starting from the next one
+	bool take(size_t self, std::function<void()>& task) {
+		for (size_t k = 0; k < queues.size(); ++k) {
+			Queue& queue = *queues[(self + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.Mutex);
+			if (queue.Tasks.empty()) {
+				continue;
+			}
+			if (k == 0) {
+				task = std::move(queue.Tasks.back());
+				queue.Tasks.pop_back();
+			}
+			else {
+				task = std::move(queue.Tasks.front());
+				queue.Tasks.pop_front();
+				++stolen;
+			}
+			--pending;
+			return true;
+		}
+		return false;
+	}
+
+	void run(size_t self) {
+		current() = Worker{ this, self };
+		for (;;) {
+			std::function<void()> task;
+			if (take(self, task)) {
+				task();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || pending > 0; });
+			if (stopping && pending == 0) {
+				return;
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> next;
+	std::atomic<size_t> pending; // tasks in the queues
+	std::atomic<uint64_t> stolen;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+
+// nb2sim - simulated nb2mcs backend, implements all functions of nb2mcs.h
+// without BLE adapter and device; build it as nb2mcs library and link
+// the demo (or any other client) against it instead of the real one
+
+#ifdef _MSC_VER
+    #define NB2SIM_EXPORT extern "C" __declspec(dllimport)
+#else
+    #define NB2SIM_EXPORT
+#endif
+
+// simulation settings, default values are taken from NB2SIM_* environment
+// variables at nb2ApiInit (see nb2simDefaultSettings)
+struct t_nb2simSettings {
+    uint32_t DevicesCount;      /*!< Number of simulated devices, NB2SIM_DEVICES (1) */
+    uint32_t Model;             /*!< Model ID: 1900/1905 - 16 channels, 1902/1904 - 21 channels, NB2SIM_MODEL (1902) */
+    uint32_t Seed;              /*!< Generator seed, the same seed gives the same data, NB2SIM_SEED (1) */
+    float Speed;                /*!< Time scale: 1 - real time, 0 - unlimited, NB2SIM_SPEED (1) */
+    float PacketLoss;           /*!< Probability of BLE packet loss from 0 to 1, NB2SIM_LOSS (0) */
+    float JitterMs;             /*!< Maximal BLE packet delivery delay, ms, NB2SIM_JITTER_MS (0) */
+    float EventsPerMinute;      /*!< Average rate of injected events, NB2SIM_EVENTS (6) */
+    float ArtifactsPerMinute;   /*!< Average rate of 1 second channel artifacts (saturation, flatline, step, burst), NB2SIM_ARTIFACTS (0) */
+    uint32_t DiscoveryMs;       /*!< Delay before devices are found after nb2ApiInit, ms, NB2SIM_DISCOVERY_MS (0) */
+    float DropsPerMinute;       /*!< Average rate of BLE link drops: no data until the device is closed, opened and started again, NB2SIM_DROPS (0) */
+    float DropSeconds;          /*!< Time a dropped device is not found by nb2GetCount, NB2SIM_DROP_SECONDS (2) */
+    float ClockDriftPpm;        /*!< Device sample clock deviation from the nominal rate, ppm, NB2SIM_DRIFT_PPM (0) */
+};
+
+// fill settings with default values (environment variables applied)
+NB2SIM_EXPORT void nb2simDefaultSettings(t_nb2simSettings* Settings);
+// replace simulation settings, must be called before nb2ApiInit
+NB2SIM_EXPORT int nb2simConfigure(const t_nb2simSettings* Settings);
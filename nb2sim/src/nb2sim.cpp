@@ -0,0 +1,756 @@
+#include <nb2mcs/nb2mcs.h>
+#include <nb2sim/nb2sim.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// nb2sim - deterministic simulation of NB2 devices behind the nb2mcs API:
+// synthetic EEG (DC offset, mains hum, delta/theta/alpha/beta rhythms and noise),
+// BLE packet delivery with loss and jitter, random events, impedances and records;
+// every generated value is a function of the seed and the sample counter only,
+// so the stream is reproducible regardless of the polling pattern
+
+namespace {
+
+// stateless 64-bit hash, used as counter-based random generator
+uint64_t mix(uint64_t x) {
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+uint64_t mix(uint64_t a, uint64_t b, uint64_t c) {
+	return mix(mix(mix(a) ^ b) ^ c);
+}
+
+// uniform random value in [0, 1)
+double uniform(uint64_t hash) {
+	return double(hash >> 11) * (1.0 / 9007199254740992.0);
+}
+
+float envFloat(const char* name, float value) {
+	const char* env = std::getenv(name);
+	return env ? float(std::atof(env)) : value;
+}
+
+uint32_t envUint(const char* name, uint32_t value) {
+	const char* env = std::getenv(name);
+	return env ? uint32_t(std::strtoul(env, nullptr, 10)) : value;
+}
+
+uint32_t channelsOfModel(uint32_t model) {
+	return model == 1900 || model == 1905 ? 16 : 21;
+}
+
+float rateOf(uint8_t rate) { return 125.f * float(1u << rate); }
+float rangeOf(uint8_t range) { return range == Mv300 ? 0.3f : 0.15f; }
+// 24-bit ADC, +/-Range
+float resolutionOf(uint8_t range) { return rangeOf(range) / 8388608.f; }
+
+const float CalibrationVoltage = 0.1f; // V, calibration source voltage
+const uint32_t EventsCapacity = 1000; // device event queue length
+const float BacklogSeconds = 10.f; // device data queue length
+const float BleCapacityKBs = 100.f; // BLE channel capacity for utilization
+
+struct Device {
+	explicit Device(uint32_t index, const t_nb2simSettings& sets) :
+		Index(index), Id(int(100 + index)), Settings(sets) {
+		Info.Model = sets.Model;
+		Info.SerialNumber = 1024 + index;
+		Info.ProductionDate.Year = 2022;
+		Info.ProductionDate.Month = 4;
+		Info.ProductionDate.Day = uint8_t(1 + index % 28);
+		ChannelsCount = channelsOfModel(sets.Model);
+		DataSettings.DataRate = Hz125;
+		DataSettings.InputRange = Mv150;
+		DataSettings.EnabledChannels = (1u << ChannelsCount) - 1;
+		EventSettings.EnabledEvents = 0x003F;
+		EventSettings.ActivityThreshold = 1;
+		std::memset(&Record, 0, sizeof(Record));
+		std::memset(&Calibration, 0, sizeof(Calibration));
+		Calibration.Date = Info.ProductionDate;
+		Calibration.Voltage = CalibrationVoltage;
+		Calibration.Impedance = 10000.f;
+		for (uint32_t ch = 0; ch < ChannelsCount; ++ch) {
+			calibrate(Calibration.Range150mV, Mv150, ch);
+			calibrate(Calibration.Range300mV, Mv300, ch);
+			Calibration.CalImpedance.Offset[ch] = int16_t(int(seed(ch, 3) % 64) - 32);
+			Calibration.CalImpedance.Value[ch] = uint16_t(10000 + seed(ch, 4) % 200);
+		}
+	}
+
+	uint64_t seed(uint64_t a, uint64_t b) const {
+		return mix(Settings.Seed, (uint64_t(Index) << 32) | a, b);
+	}
+
+	// per channel gain error (+/-0.5%) and offset (+/-2000 bit) of the ADC
+	double gainError(uint32_t ch) const { return (uniform(seed(ch, 1)) - 0.5) * 0.01; }
+	int32_t offsetError(uint32_t ch) const { return int32_t(seed(ch, 2) % 4001) - 2000; }
+
+	void calibrate(t_nb2CalibrationRange& range, uint8_t inputRange, uint32_t ch) const {
+		range.Offset[ch] = offsetError(ch);
+		range.Value[ch] = offsetError(ch) + int32_t(std::lround(
+			CalibrationVoltage / resolutionOf(inputRange) * (1.0 + gainError(ch))));
+	}
+
+	// precomputes one second of periodic signal for each channel in ADC bits
+	void startGenerator() {
+		const uint32_t rate = uint32_t(rateOf(DataSettings.DataRate));
+		const double resolution = resolutionOf(DataSettings.InputRange);
+		const double pi = 3.14159265358979323846;
+		// integer frequencies, so one second of the signal is exactly periodic
+		const double rhythms[] = { 2., 6., 10., 20. }; // delta, theta, alpha, beta
+		const double mains = 50.;
+		Wave.assign(ChannelsCount, std::vector<float>(rate));
+		Dc.assign(ChannelsCount, 0);
+		Gain.assign(ChannelsCount, 1.);
+		for (uint32_t ch = 0; ch < ChannelsCount; ++ch) {
+			double amplitudes[4]; // uV
+			for (size_t r = 0; r < 4; ++r) {
+				amplitudes[r] = (r == 2 ? 20. : 8.) * (0.5 + uniform(seed(ch, 10 + r)));
+			}
+			const double dc = (uniform(seed(ch, 20)) - 0.5) * 20e3; // +/-10 mV electrode offset
+			const double hum = 5. + 25. * uniform(seed(ch, 21));
+			Gain[ch] = CalibrationData ? 1. : 1. + gainError(ch);
+			Dc[ch] = int32_t(std::lround(dc * 1e-6 / resolution * Gain[ch])) + (CalibrationData ? 0 : offsetError(ch));
+			for (uint32_t n = 0; n < rate; ++n) {
+				const double t = double(n) / rate;
+				double uv = hum * std::sin(2. * pi * mains * t);
+				for (size_t r = 0; r < 4; ++r) {
+					uv += amplitudes[r] * std::sin(2. * pi * rhythms[r] * t + 0.7 * double(ch) + double(r));
+				}
+				Wave[ch][n] = float(uv * 1e-6 / resolution * Gain[ch]);
+			}
+		}
+		Noise = float(2e-6 / resolution); // ~2 uV white noise
+		PacketSize = std::max(1u, rate / 25); // 40 ms BLE packets
+		NextPacket = 0;
+		PacketOffset = 0;
+		NextDelivery = packetDeadline(0);
+		EventNumber = 0;
+		Delivered = Lost = 0;
+		EventsFirst = EventsCount = 0;
+		pushEvent(EvStart, 0, 0);
+		Start = std::chrono::steady_clock::now();
+		++Starts;
+		Dropped = false;
+		DropChecked = 0;
+	}
+
+	// a link drop may start in every simulated second of the acquisition; the dropped device
+	// sends nothing more and is not found for DropSeconds, then it has to be opened again
+	bool linkDropped(double time) {
+		if (Dropped || Settings.DropsPerMinute <= 0.f || time == HUGE_VAL) {
+			return Dropped;
+		}
+		for (; DropChecked < uint64_t(time); ++DropChecked) {
+			if (uniform(seed((uint64_t(Starts) << 32) | DropChecked, 60)) < Settings.DropsPerMinute / 60.) {
+				Dropped = true;
+				Hidden = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(Settings.DropSeconds / Settings.Speed));
+				break;
+			}
+		}
+		return Dropped;
+	}
+
+	bool visible() const {
+		return std::chrono::steady_clock::now() >= Hidden;
+	}
+
+	int32_t sample(uint32_t ch, uint32_t counter) const {
+		const uint64_t h = mix(Settings.Seed, (uint64_t(Index) << 32) | ch, counter);
+		// triangular noise from two uniform values
+		const float noise = (float(h & 0xFFFF) + float((h >> 16) & 0xFFFF)) * (1.f / 65536.f) - 1.f;
+		const uint32_t rate = uint32_t(Wave[ch].size());
+		const int32_t value = Dc[ch] + int32_t(Wave[ch][counter % rate] + noise * Noise);
+		return Settings.ArtifactsPerMinute > 0.f ? artifact(ch, counter, rate, value) : value;
+	}
+
+	// whole seconds of a channel are replaced by an artifact: saturation at the ADC limit
+	// (disconnected electrode), flatline, 300 uV step or 400 uV 4 Hz burst
+	int32_t artifact(uint32_t ch, uint32_t counter, uint32_t rate, int32_t value) const {
+		const uint32_t second = counter / rate;
+		const uint64_t h = mix(Settings.Seed, (uint64_t(Index) << 32) | ch, (uint64_t(second) << 8) | 50);
+		if (uniform(h) >= Settings.ArtifactsPerMinute / 60. / ChannelsCount) {
+			return value;
+		}
+		const double resolution = resolutionOf(DataSettings.InputRange);
+		switch (mix(h) % 4) {
+			case 0: return 8388607;
+			case 1: return Dc[ch];
+			case 2: return value + int32_t(300e-6 / resolution);
+			default: return value + int32_t(400e-6 / resolution * std::sin(2. * 3.14159265358979323846 * 4. * (counter % rate) / rate));
+		}
+	}
+
+	// simulated time in seconds since acquisition start, of the device clock
+	double now() const {
+		if (Settings.Speed <= 0.f) {
+			return HUGE_VAL;
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - Start;
+		return elapsed.count() * Settings.Speed * (1. + Settings.ClockDriftPpm * 1e-6);
+	}
+
+	double packetDeadline(uint64_t packet) const {
+		const double rate = rateOf(DataSettings.DataRate);
+		const double jitter = Settings.JitterMs * 1e-3 * uniform(seed(packet, 31));
+		return double((packet + 1) * PacketSize) / rate + jitter;
+	}
+
+	bool packetLost(uint64_t packet) const {
+		return Settings.PacketLoss > 0.f && uniform(seed(packet, 32)) < Settings.PacketLoss;
+	}
+
+	void nextPacket() {
+		injectEvents(NextPacket);
+		++NextPacket;
+		PacketOffset = 0;
+		// packets are delivered in order, late packet delays all next
+		NextDelivery = std::max(NextDelivery, packetDeadline(NextPacket));
+	}
+
+	void injectEvents(uint64_t packet) {
+		const double rate = rateOf(DataSettings.DataRate);
+		const double probability = Settings.EventsPerMinute / 60. / rate;
+		if (probability <= 0.) {
+			return;
+		}
+		for (uint32_t i = 0; i < PacketSize; ++i) {
+			const uint32_t counter = uint32_t(packet * PacketSize + i);
+			if (uniform(seed(counter, 40)) >= probability) {
+				continue;
+			}
+			const uint64_t h = seed(counter, 41);
+			const uint8_t type = uint8_t(h % (EvOrientation + 1));
+			if (EventSettings.EnabledEvents & (1u << type)) {
+				pushEvent(type, uint8_t(type == EvOrientation ? 1u << (h >> 8) % 6 : (h >> 8) % 4), counter);
+			}
+		}
+	}
+
+	void pushEvent(uint8_t type, uint8_t value, uint32_t counter) {
+		t_nb2Event event;
+		event.Type = type;
+		event.Value = value;
+		event.Acceleration.X = 0.f;
+		event.Acceleration.Y = 0.f;
+		event.Acceleration.Z = type == EvFreeFall ? 0.f : 1.f;
+		event.Number = EventNumber++;
+		event.Counter = counter;
+		if (EventsCount == EventsCapacity) {
+			popEvent();
+		}
+		Events[(EventsFirst + EventsCount++) % EventsCapacity] = event;
+	}
+
+	t_nb2Event popEvent() {
+		const t_nb2Event event = Events[EventsFirst];
+		EventsFirst = (EventsFirst + 1) % EventsCapacity;
+		--EventsCount;
+		return event;
+	}
+
+	// copies delivered samples into buffer, returns number of samples
+	uint32_t read(int32_t* data, uint32_t capacity) {
+		const uint32_t sampleSize = ChannelsCount + 2;
+		const double time = now();
+		if (linkDropped(time)) {
+			return 0;
+		}
+		// device queue overflow if host does not read data for a long time
+		while (time != HUGE_VAL && time - NextDelivery > BacklogSeconds) {
+			Lost += PacketSize - PacketOffset;
+			nextPacket();
+		}
+		uint32_t count = 0;
+		while (count < capacity) {
+			if (PacketOffset == 0) {
+				if (NextDelivery > time) {
+					break;
+				}
+				if (packetLost(NextPacket)) {
+					Lost += PacketSize;
+					nextPacket();
+					continue;
+				}
+			}
+			const uint32_t n = std::min(PacketSize - PacketOffset, capacity - count);
+			for (uint32_t i = 0; i < n; ++i) {
+				const uint32_t counter = uint32_t(NextPacket * PacketSize + PacketOffset + i);
+				int32_t* row = data + size_t(count + i) * sampleSize;
+				for (uint32_t ch = 0; ch < ChannelsCount; ++ch) {
+					row[ch] = (DataSettings.EnabledChannels >> ch) & 1 ? sample(ch, counter) : 0;
+				}
+				row[ChannelsCount] = 0; // status word
+				row[ChannelsCount + 1] = int32_t(counter);
+			}
+			count += n;
+			Delivered += n;
+			PacketOffset += n;
+			if (PacketOffset == PacketSize) {
+				nextPacket();
+			}
+		}
+		return count;
+	}
+
+	const uint32_t Index;
+	const int Id;
+	const t_nb2simSettings Settings;
+	std::mutex Mutex;
+
+	t_nb2Information Info;
+	uint32_t ChannelsCount;
+	t_nb2DataSettings DataSettings;
+	t_nb2EventSettings EventSettings;
+	t_nb2Calibration Calibration;
+	t_nb2Record Record;
+	uint8_t Mode = Nb2Mode::Data;
+	bool Opened = false;
+	bool Started = false;
+	bool Recording = false;
+	bool CalibrationData = false;
+	uint32_t PowerOnCount = 1;
+	std::chrono::steady_clock::time_point PowerOn = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point RecordStart;
+
+	// generator state
+	std::vector<std::vector<float>> Wave;
+	std::vector<int32_t> Dc;
+	std::vector<double> Gain;
+	float Noise = 0.f;
+	uint32_t PacketSize = 1;
+	uint64_t NextPacket = 0;
+	uint32_t PacketOffset = 0;
+	double NextDelivery = 0.;
+	uint32_t EventNumber = 0;
+	uint64_t Delivered = 0;
+	uint64_t Lost = 0;
+	std::vector<t_nb2Event> Events = std::vector<t_nb2Event>(EventsCapacity); // ring, polls do not allocate
+	uint32_t EventsFirst = 0;
+	uint32_t EventsCount = 0;
+	std::chrono::steady_clock::time_point Start;
+	uint32_t Starts = 0;
+	bool Dropped = false;
+	uint64_t DropChecked = 0; // simulated seconds checked for a drop
+	std::chrono::steady_clock::time_point Hidden; // not found by nb2GetCount until
+};
+
+struct Simulator {
+	std::mutex Mutex;
+	t_nb2simSettings Settings;
+	bool Configured = false;
+	bool Initialized = false;
+	std::chrono::steady_clock::time_point InitTime;
+	std::vector<std::unique_ptr<Device>> Devices;
+};
+
+Simulator& simulator() {
+	static Simulator sim;
+	return sim;
+}
+
+Device* findDevice(int id) {
+	Simulator& sim = simulator();
+	std::lock_guard<std::mutex> lock(sim.Mutex);
+	for (auto& device : sim.Devices) {
+		if (device->Id == id) {
+			return device.get();
+		}
+	}
+	return nullptr;
+}
+
+// runs function for opened device under device lock, returns ErrId for unknown
+// id and ErrFail if device is not opened
+template <typename Function>
+int withDevice(int id, Function function, bool needOpened = true) {
+	Device* device = findDevice(id);
+	if (!device) {
+		return ErrId;
+	}
+	std::lock_guard<std::mutex> lock(device->Mutex);
+	if (needOpened && !device->Opened) {
+		return ErrFail;
+	}
+	return function(*device);
+}
+
+} // namespace
+
+void nb2simDefaultSettings(t_nb2simSettings* Settings) {
+	if (!Settings) return;
+	Settings->DevicesCount = envUint("NB2SIM_DEVICES", 1);
+	Settings->Model = envUint("NB2SIM_MODEL", 1902);
+	Settings->Seed = envUint("NB2SIM_SEED", 1);
+	Settings->Speed = envFloat("NB2SIM_SPEED", 1.f);
+	Settings->PacketLoss = envFloat("NB2SIM_LOSS", 0.f);
+	Settings->JitterMs = envFloat("NB2SIM_JITTER_MS", 0.f);
+	Settings->EventsPerMinute = envFloat("NB2SIM_EVENTS", 6.f);
+	Settings->ArtifactsPerMinute = envFloat("NB2SIM_ARTIFACTS", 0.f);
+	Settings->DiscoveryMs = envUint("NB2SIM_DISCOVERY_MS", 0);
+	Settings->DropsPerMinute = envFloat("NB2SIM_DROPS", 0.f);
+	Settings->DropSeconds = envFloat("NB2SIM_DROP_SECONDS", 2.f);
+	Settings->ClockDriftPpm = envFloat("NB2SIM_DRIFT_PPM", 0.f);
+}
+
+int nb2simConfigure(const t_nb2simSettings* Settings) {
+	if (!Settings || Settings->PacketLoss < 0.f || Settings->PacketLoss > 1.f || Settings->Speed < 0.f
+		|| Settings->ClockDriftPpm <= -1e6f) {
+		return ErrParam;
+	}
+	Simulator& sim = simulator();
+	std::lock_guard<std::mutex> lock(sim.Mutex);
+	if (sim.Initialized) {
+		return ErrObtained;
+	}
+	sim.Settings = *Settings;
+	sim.Configured = true;
+	return ErrOk;
+}
+
+int nb2ApiInit() {
+	Simulator& sim = simulator();
+	std::lock_guard<std::mutex> lock(sim.Mutex);
+	if (sim.Initialized) {
+		return ErrOk;
+	}
+	if (!sim.Configured) {
+		nb2simDefaultSettings(&sim.Settings);
+	}
+	sim.Devices.clear();
+	for (uint32_t i = 0; i < sim.Settings.DevicesCount; ++i) {
+		sim.Devices.emplace_back(new Device(i, sim.Settings));
+	}
+	sim.InitTime = std::chrono::steady_clock::now();
+	sim.Initialized = true;
+	return ErrOk;
+}
+
+int nb2ApiDone() {
+	Simulator& sim = simulator();
+	std::lock_guard<std::mutex> lock(sim.Mutex);
+	sim.Devices.clear();
+	sim.Initialized = false;
+	sim.Configured = false;
+	return ErrOk;
+}
+
+int nb2EventInit(int* Callback) {
+	(void)Callback;
+	return ErrSupport;
+}
+
+uint32_t nb2GetCount() {
+	Simulator& sim = simulator();
+	std::lock_guard<std::mutex> lock(sim.Mutex);
+	if (!sim.Initialized || std::chrono::steady_clock::now() - sim.InitTime <
+		std::chrono::milliseconds(sim.Settings.DiscoveryMs)) {
+		return 0;
+	}
+	uint32_t count = 0;
+	for (auto& device : sim.Devices) {
+		std::lock_guard<std::mutex> deviceLock(device->Mutex);
+		count += device->visible() ? 1 : 0;
+	}
+	return count;
+}
+
+// index of the devices found now, a dropped one is skipped
+int nb2GetId(uint32_t Index) {
+	if (Index >= nb2GetCount()) {
+		return ErrParam;
+	}
+	Simulator& sim = simulator();
+	std::lock_guard<std::mutex> lock(sim.Mutex);
+	for (auto& device : sim.Devices) {
+		std::lock_guard<std::mutex> deviceLock(device->Mutex);
+		if (device->visible() && Index-- == 0) {
+			return device->Id;
+		}
+	}
+	return ErrParam;
+}
+
+int nb2GetSerialNumber(int Id) {
+	return withDevice(Id, [](Device& d) { return int(d.Info.SerialNumber); }, false);
+}
+
+int nb2GetModel(int Id) {
+	return withDevice(Id, [](Device& d) { return int(d.Info.Model); }, false);
+}
+
+int nb2Open(int Id) {
+	return withDevice(Id, [](Device& d) {
+		if (d.Opened) return int(ErrObtained);
+		if (!d.visible()) return int(ErrFail);
+		d.Opened = true;
+		return int(ErrOk);
+	}, false);
+}
+
+int nb2Close(int Id) {
+	return withDevice(Id, [](Device& d) {
+		d.Opened = false;
+		d.Started = false;
+		return int(ErrOk);
+	}, false);
+}
+
+int nb2GetVersion(int Id, t_nb2Version* Version) {
+	if (!Version) return ErrParam;
+	return withDevice(Id, [Version](Device&) {
+		Version->Dll = (1ull << 48) | (0ull << 32) | (22000ull << 16) | 0ull;
+		Version->Firmware = (1ull << 48) | (0ull << 32) | 220401ull;
+		return int(ErrOk);
+	});
+}
+
+int nb2SetOut(int Id, uint8_t State) {
+	(void)State;
+	return withDevice(Id, [](Device&) { return int(ErrOk); });
+}
+
+int nb2GetDataStatus(int Id, t_nb2DataStatus* DataStatus) {
+	if (!DataStatus) return ErrParam;
+	return withDevice(Id, [DataStatus](Device& d) {
+		const float rate = d.Started && d.Mode == Nb2Mode::Data ? rateOf(d.DataSettings.DataRate) : 0.f;
+		DataStatus->Rate = rate;
+		DataStatus->Ratio = 45.f;
+		DataStatus->Speed = rate * (d.ChannelsCount + 2) * 4 * DataStatus->Ratio / 100.f / 1024.f;
+		DataStatus->Utilization = std::min(100.f, DataStatus->Speed / BleCapacityKBs * 100.f);
+		return int(ErrOk);
+	});
+}
+
+int nb2GetBattery(int Id, t_nb2BatteryProperties* Battery) {
+	if (!Battery) return ErrParam;
+	return withDevice(Id, [Battery](Device& d) {
+		// 1% per 10 minutes of work
+		const auto minutes = std::chrono::duration_cast<std::chrono::minutes>(
+			std::chrono::steady_clock::now() - d.PowerOn).count();
+		Battery->Capacity = 1200;
+		Battery->Level = uint16_t(std::max<long long>(0, 1000 - minutes));
+		Battery->Voltage = uint16_t(3600 + Battery->Level / 2);
+		Battery->Current = int16_t(d.Started ? -120 : -20);
+		Battery->Temperature = 31;
+		return int(ErrOk);
+	});
+}
+
+int nb2GetImpedance(int Id, uint8_t* Impedance) {
+	if (!Impedance) return ErrParam;
+	return withDevice(Id, [Impedance](Device& d) {
+		if (!d.Started || d.Mode != Nb2Mode::Impedance) {
+			return int(ErrFail);
+		}
+		const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::steady_clock::now() - d.Start).count();
+		for (uint32_t ch = 0; ch < d.ChannelsCount; ++ch) {
+			uint32_t value = 0xFFFFFFFF; // not connected
+			if ((d.DataSettings.EnabledChannels >> ch) & 1) {
+				value = uint32_t(2000 + d.seed(ch, 50) % 20000 + mix(uint64_t(seconds), ch, 51) % 500);
+			}
+			std::memcpy(Impedance + ch * sizeof(uint32_t), &value, sizeof(value));
+		}
+		return int(ErrOk);
+	});
+}
+
+int nb2GetInformation(int Id, t_nb2Information* Information) {
+	if (!Information) return ErrParam;
+	return withDevice(Id, [Information](Device& d) {
+		*Information = d.Info;
+		return int(ErrOk);
+	});
+}
+
+int nb2GetCalibration(int Id, t_nb2Calibration* Calibration) {
+	if (!Calibration) return ErrParam;
+	return withDevice(Id, [Calibration](Device& d) {
+		*Calibration = d.Calibration;
+		return int(ErrOk);
+	});
+}
+
+int nb2GetCalibrated(int Id, bool* Calibrated) {
+	if (!Calibrated) return ErrParam;
+	return withDevice(Id, [Calibrated](Device&) {
+		*Calibrated = true;
+		return int(ErrOk);
+	});
+}
+
+int nb2GetUsageStats(int Id, t_nb2UsageStats* UsageStats) {
+	if (!UsageStats) return ErrParam;
+	return withDevice(Id, [UsageStats](Device& d) {
+		std::memset(UsageStats, 0, sizeof(*UsageStats));
+		UsageStats->PowerOnCount = d.PowerOnCount;
+		UsageStats->PowerOnSeconds = uint32_t(std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::steady_clock::now() - d.PowerOn).count());
+		UsageStats->DataSendSeconds = d.Started ? uint32_t(d.Delivered / rateOf(d.DataSettings.DataRate)) : 0;
+		return int(ErrOk);
+	});
+}
+
+int nb2GetProperty(int Id, t_nb2Property* Property) {
+	if (!Property) return ErrParam;
+	return withDevice(Id, [Property](Device& d) {
+		Property->Rate = rateOf(d.DataSettings.DataRate);
+		Property->Range = rangeOf(d.DataSettings.InputRange);
+		Property->Resolution = resolutionOf(d.DataSettings.InputRange);
+		return int(ErrOk);
+	});
+}
+
+int nb2GetPossibility(int Id, t_nb2Possibility* Possibility) {
+	if (!Possibility) return ErrParam;
+	return withDevice(Id, [Possibility](Device& d) {
+		Possibility->ChannelsCount = d.ChannelsCount;
+		Possibility->UserMemorySize = 4096;
+		return int(ErrOk);
+	});
+}
+
+int nb2SetAdjustment(int Id, t_nb2Adjustment* Adjust) {
+	if (!Adjust) return ErrParam;
+	return withDevice(Id, [](Device&) { return int(ErrOk); });
+}
+
+int nb2SetMode(int Id, t_nb2Mode* DataMode) {
+	if (!DataMode || DataMode->Mode > Nb2Mode::Impedance) return ErrParam;
+	return withDevice(Id, [DataMode](Device& d) {
+		if (d.Started) return int(ErrFail);
+		d.Mode = DataMode->Mode;
+		return int(ErrOk);
+	});
+}
+
+int nb2SetDataSettings(int Id, t_nb2DataSettings* DataSettings) {
+	if (!DataSettings || DataSettings->DataRate > Hz1000 || DataSettings->InputRange > Mv300) return ErrParam;
+	return withDevice(Id, [DataSettings](Device& d) {
+		if (d.Started) return int(ErrFail);
+		d.DataSettings = *DataSettings;
+		d.DataSettings.EnabledChannels &= (1u << d.ChannelsCount) - 1;
+		return int(ErrOk);
+	});
+}
+
+int nb2SetEventSettings(int Id, t_nb2EventSettings* EventSettings) {
+	if (!EventSettings || EventSettings->ActivityThreshold > 2) return ErrParam;
+	return withDevice(Id, [EventSettings](Device& d) {
+		d.EventSettings = *EventSettings;
+		return int(ErrOk);
+	});
+}
+
+int nb2CalibrationDataEnable(int Id, uint32_t Enable) {
+	return withDevice(Id, [Enable](Device& d) {
+		if (d.Started) return int(ErrFail);
+		d.CalibrationData = Enable != 0;
+		return int(ErrOk);
+	});
+}
+
+int nb2PowerOff(int Id, int WaitTime) {
+	if (WaitTime < 0) return ErrParam;
+	return withDevice(Id, [](Device& d) {
+		d.Started = false;
+		d.PowerOn = std::chrono::steady_clock::now();
+		++d.PowerOnCount;
+		return int(ErrOk);
+	});
+}
+
+int nb2Start(int Id) {
+	return withDevice(Id, [](Device& d) {
+		if (d.Started) return int(ErrObtained);
+		d.startGenerator();
+		d.Started = true;
+		return int(ErrOk);
+	});
+}
+
+int nb2Stop(int Id) {
+	return withDevice(Id, [](Device& d) {
+		d.Started = false;
+		return int(ErrOk);
+	});
+}
+
+int nb2GetData(int Id, int32_t* Data, uint32_t Size) {
+	if (!Data) return ErrParam;
+	return withDevice(Id, [Data, Size](Device& d) {
+		if (!d.Started || d.Mode != Nb2Mode::Data) {
+			return 0;
+		}
+		// buffer size is passed in bytes, but the count of copied 32-bit words is returned
+		const uint32_t sampleSize = d.ChannelsCount + 2;
+		return int(d.read(Data, Size / uint32_t(sampleSize * sizeof(int32_t))) * sampleSize);
+	});
+}
+
+int nb2GetEvent(int Id, t_nb2Event* Event, uint32_t Size) {
+	if (!Event) return ErrParam;
+	return withDevice(Id, [Event, Size](Device& d) {
+		size_t count = 0;
+		while (count < Size / sizeof(t_nb2Event) && d.EventsCount) {
+			Event[count++] = d.popEvent();
+		}
+		return int(count * sizeof(t_nb2Event));
+	});
+}
+
+int nb2GetAcquisitionStatus(int Id, t_nb2AcquisitionStatus* AcquisitionStatus) {
+	if (!AcquisitionStatus) return ErrParam;
+	return withDevice(Id, [AcquisitionStatus](Device& d) {
+		AcquisitionStatus->State = uint8_t(d.Recording ? 2 : !d.Started ? 0 : d.Mode == Nb2Mode::Impedance ? 3 : 1);
+		AcquisitionStatus->DataRate = d.DataSettings.DataRate;
+		AcquisitionStatus->InputRange = d.DataSettings.InputRange;
+		AcquisitionStatus->EnabledChannels = d.DataSettings.EnabledChannels;
+		const auto seconds = d.Recording ? std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::steady_clock::now() - d.RecordStart).count() : 0;
+		AcquisitionStatus->RecordingTime = uint32_t(seconds);
+		AcquisitionStatus->RecordingErrors = 0;
+		AcquisitionStatus->KBytesWritten = uint32_t(seconds * rateOf(d.DataSettings.DataRate) * (d.ChannelsCount + 2) * 3 / 1024);
+		AcquisitionStatus->KBytesAvailable = 4u * 1024 * 1024 - AcquisitionStatus->KBytesWritten;
+		return int(ErrOk);
+	});
+}
+
+int nb2RecordStart(int Id, t_nb2Record* RecordInformation) {
+	if (!RecordInformation) return ErrParam;
+	return withDevice(Id, [RecordInformation](Device& d) {
+		if (d.Recording) return int(ErrRecordExists);
+		d.Record = *RecordInformation;
+		d.Recording = true;
+		d.RecordStart = std::chrono::steady_clock::now();
+		return int(ErrOk);
+	});
+}
+
+int nb2RecordStop(int Id) {
+	return withDevice(Id, [](Device& d) {
+		if (!d.Recording) return int(ErrFail);
+		d.Recording = false;
+		return int(ErrOk);
+	});
+}
+
+int nb2RecordInformation(int Id, t_nb2Record* RecordInformation) {
+	if (!RecordInformation) return ErrParam;
+	return withDevice(Id, [RecordInformation](Device& d) {
+		if (!d.Recording) return int(ErrFail);
+		*RecordInformation = d.Record;
+		return int(ErrOk);
+	});
+}